@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# scale.sh
+# SVNFS File System - thread scaling of a mounted local repository
+#
+# Usage: bench/scale.sh [max_threads]
+#
+# Imports a generated tree of SCALE_DIRS directories of SCALE_FILES files
+# into a fresh local repository.  Then, for stat, read and readdir and for
+# 1, 2, 4 ... max_threads threads, it mounts the repository afresh and runs
+# bench/svnfs_scale over every path twice: once against cold caches and once
+# against warm ones.  Extra mount options go in SVNFS_OPTS, for example
+# SVNFS_OPTS=ra_threads=8.  Each pass prints one tab-separated line, ready to
+# be plotted against the thread count.
+
+set -e
+
+MAX_THREADS=${1:-$(nproc)}
+SCALE_DIRS=${SCALE_DIRS:-32}
+SCALE_FILES=${SCALE_FILES:-64}
+SCALE_SIZE=${SCALE_SIZE:-16384}
+
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/svnfs_scale.XXXXXX")
+
+cleanup()
+{
+	fusermount -u "$WORK/mnt" 2>/dev/null || :
+	rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+mount_svnfs()
+{
+	"$TOP/svnfs" "file://$WORK/repo" "$WORK/mnt" \
+		-o "cache_root=$WORK/cache${SVNFS_OPTS:+,$SVNFS_OPTS}"
+	until [ -d "$WORK/mnt/1" ]; do
+		sleep 0.1
+	done
+}
+
+make -C "$TOP" svnfs bench/svnfs_scale >/dev/null
+
+# Files of a few different sizes, so that not every read is alike
+mkdir -p "$WORK/tree" "$WORK/mnt"
+d=0
+while [ $d -lt "$SCALE_DIRS" ]; do
+	mkdir "$WORK/tree/dir$d"
+	f=0
+	while [ $f -lt "$SCALE_FILES" ]; do
+		head -c $((SCALE_SIZE * (f % 4 + 1) / 2)) /dev/urandom \
+			> "$WORK/tree/dir$d/file$f"
+		f=$((f + 1))
+	done
+	d=$((d + 1))
+done
+
+svnadmin create "$WORK/repo"
+svn import -q -m "Scaling benchmark tree" "$WORK/tree" "file://$WORK/repo/tree"
+
+(cd "$WORK/tree" &&
+ find . -type d | sed 's|^\./||; s|^|d |' &&
+ find . -type f | sed 's|^\./||; s|^|f |') > "$WORK/manifest"
+
+# Powers of two up to the maximum, and the maximum itself
+counts=
+threads=1
+while [ $threads -lt "$MAX_THREADS" ]; do
+	counts="$counts $threads"
+	threads=$((threads * 2))
+done
+counts="$counts $MAX_THREADS"
+
+printf 'op\tcache\tthreads\tpaths\terrors\tseconds\tops/s'
+printf '\tp50_us\tp90_us\tp99_us\tmax_us\n'
+for op in stat read readdir; do
+	for threads in $counts; do
+		mount_svnfs
+		for cache in cold warm; do
+			"$TOP/bench/svnfs_scale" -t "$threads" -l $cache $op \
+				"$WORK/manifest" "$WORK/mnt/1/tree" || :
+		done
+		fusermount -u "$WORK/mnt"
+	done
+done
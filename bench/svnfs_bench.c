@@ -0,0 +1,444 @@
+/*
+ * svnfs_bench.c
+ * SVNFS File System - microbenchmarks
+ *
+ * Times the in-process paths that every request goes through, with no FUSE
+ * or repository involved: the caches are seeded by hand through
+ * svnfs_local_init, and every benchmark is answered from them.  Run with no
+ * arguments for every benchmark, or with a name to run only those whose
+ * names contain it.  Each reports the time and the heap allocations per
+ * operation.
+ */
+
+#include "../svnfs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* STRUCTURES {{{1 */
+
+/*
+ * SVNFS_BENCH_TIME
+ *
+ * How long to run each benchmark for, in nanoseconds.
+ */
+#define SVNFS_BENCH_TIME 500000000.0
+
+/*
+ * SVNFS_BENCH_REV, SVNFS_BENCH_DIR, SVNFS_BENCH_FILES, SVNFS_BENCH_SIZE
+ *
+ * The revision of the seeded directory /dir, its path under the mount, how
+ * many files it holds, and the size of each of them.
+ */
+#define SVNFS_BENCH_REV 5
+#define SVNFS_BENCH_DIR "/5/dir"
+#define SVNFS_BENCH_FILES 100
+#define SVNFS_BENCH_SIZE (1024 * 1024)
+
+/*
+ * SVNFS_BENCH_INSERT_SIZE
+ *
+ * The size of each entry put in the content cache by the insert benchmark,
+ * which soon has it evicting one entry for each it admits.
+ */
+#define SVNFS_BENCH_INSERT_SIZE (1024 * 1024)
+
+/*
+ * svnfs_bench_t
+ *
+ * One benchmark.
+ */
+typedef struct svnfs_bench_t
+{
+	/* Name to report and to select it by */
+	const char *name;
+
+	/* Runs the operation being measured the given number of times */
+	void (*run)(long iterations);
+} svnfs_bench_t;
+
+/* }}}1 END STRUCTURES */
+
+/* BENCHMARKS {{{1 */
+
+/*
+ * svnfs_bench_sink
+ *
+ * Somewhere for results to go, so that the compiler cannot drop the work.
+ */
+static volatile long svnfs_bench_sink;
+
+/*
+ * svnfs_bench_paths
+ *
+ * Paths of the shapes the kernel asks about, good and bad.
+ */
+static const char *svnfs_bench_paths[] =
+{
+	"/1234/trunk/subversion/libsvn_ra/ra_loader.c",
+	"/HEAD/trunk/README",
+	"/98765",
+	"/HEAD",
+	"/.svnfs",
+	"/12abc/trunk",
+	"/autorun.inf",
+	"/0/trunk/Makefile",
+};
+
+#define SVNFS_BENCH_NPATHS \
+	(sizeof(svnfs_bench_paths) / sizeof(svnfs_bench_paths[0]))
+
+/*
+ * svnfs_bench_path_parse
+ *
+ * Parses a path under the mount, as every operation starts by doing.
+ *
+ * iterations: number of paths to parse
+ */
+static void svnfs_bench_path_parse(long iterations)
+{
+	svnfs_path_t view;
+	long i;
+
+	for(i = 0; i < iterations; i++)
+		if(svnfs_path_parse(svnfs_bench_paths[i % SVNFS_BENCH_NPATHS], &view))
+			svnfs_bench_sink += view.rev;
+}
+
+/*
+ * svnfs_bench_cache_lookup
+ *
+ * Opens and closes a file that is in the content cache, as open() and
+ * release() on a cache hit do.
+ *
+ * iterations: number of files to open
+ */
+static void svnfs_bench_cache_lookup(long iterations)
+{
+	svnfs_cache_t *cache;
+	char path[64];
+	long i;
+
+	for(i = 0; i < iterations; i++)
+	{
+		snprintf(path, sizeof(path), SVNFS_BENCH_DIR "/file%ld",
+		         i % SVNFS_BENCH_FILES);
+		if(svnfs_lib_open(path, SVNFS_RA_DEMAND, &cache, NULL) != 0)
+			abort();
+		svnfs_lib_close(cache);
+	}
+}
+
+/*
+ * svnfs_bench_cache_insert
+ *
+ * Puts a new entry in the content cache, as a fetch does once it has the
+ * file, and lets it go.  Once the cache is full, each insert also evicts
+ * the least recently used entry.
+ *
+ * iterations: number of entries to insert
+ */
+static void svnfs_bench_cache_insert(long iterations)
+{
+	static long serial;
+	svnfs_cache_t *cache;
+	char key[64];
+	long i;
+
+	for(i = 0; i < iterations; i++)
+	{
+		snprintf(key, sizeof(key), "/%d/insert/%ld", SVNFS_BENCH_REV,
+		         serial++);
+		cache = svnfs_cache_new(key, SVNFS_BENCH_REV, "", -1,
+		                        SVNFS_BENCH_INSERT_SIZE, 0, 0);
+		if(!cache)
+			abort();
+
+		/* Nothing else is running, so the cache is ours without its lock */
+		if(!svnfs_cache_admit(cache))
+			abort();
+		svnfs_lib_close(cache);
+	}
+}
+
+/*
+ * svnfs_bench_fill
+ *
+ * Counts the entries of a listing.
+ *
+ * baton:  the count
+ * name:   name of the child
+ * stbuf:  attributes of the child, or NULL
+ * return: 0
+ */
+static int svnfs_bench_fill(void *baton, const char *name,
+                            const struct stat *stbuf)
+{
+	(*(long *)baton)++;
+	return 0;
+}
+
+/*
+ * svnfs_bench_readdir
+ *
+ * Lists the seeded directory, whose listing and attributes are cached, as
+ * readdir() does for ls -l.
+ *
+ * iterations: number of listings
+ */
+static void svnfs_bench_readdir(long iterations)
+{
+	long entries;
+	long i;
+
+	for(i = 0; i < iterations; i++)
+	{
+		entries = 0;
+		if(svnfs_lib_list(SVNFS_BENCH_DIR, svnfs_bench_fill, &entries) != 0
+		   || entries != SVNFS_BENCH_FILES)
+			abort();
+		svnfs_bench_sink += entries;
+	}
+}
+
+/*
+ * svnfs_bench_cache_read
+ *
+ * Reads a file in the content cache a block at a time, as read() does.
+ *
+ * iterations: number of blocks to read
+ */
+static void svnfs_bench_cache_read(long iterations)
+{
+	static char buf[SVNFS_BLKSIZE];
+	svnfs_cache_t *cache;
+	long i;
+
+	if(svnfs_lib_open(SVNFS_BENCH_DIR "/file0", SVNFS_RA_DEMAND, &cache,
+	                  NULL) != 0)
+		abort();
+
+	for(i = 0; i < iterations; i++)
+		if(svnfs_lib_read(cache, buf, sizeof(buf),
+		                  (i * sizeof(buf)) % SVNFS_BENCH_SIZE) != sizeof(buf))
+			abort();
+
+	svnfs_lib_close(cache);
+}
+
+/*
+ * svnfs_bench_attr_hit
+ *
+ * Stats a file whose attributes are cached, as getattr() does.
+ *
+ * iterations: number of files to stat
+ */
+static void svnfs_bench_attr_hit(long iterations)
+{
+	struct stat stbuf;
+	char path[64];
+	long i;
+
+	for(i = 0; i < iterations; i++)
+	{
+		snprintf(path, sizeof(path), SVNFS_BENCH_DIR "/file%ld",
+		         i % SVNFS_BENCH_FILES);
+		if(svnfs_lib_stat(path, &stbuf) != 0)
+			abort();
+		svnfs_bench_sink += stbuf.st_size;
+	}
+}
+
+/*
+ * svnfs_benches
+ *
+ * Every benchmark, in the order they are run.
+ */
+static const svnfs_bench_t svnfs_benches[] =
+{
+	{"path_parse", svnfs_bench_path_parse},
+	{"cache_lookup", svnfs_bench_cache_lookup},
+	{"cache_insert", svnfs_bench_cache_insert},
+	{"readdir_100", svnfs_bench_readdir},
+	{"cache_read_128k", svnfs_bench_cache_read},
+	{"attr_hit", svnfs_bench_attr_hit},
+	{NULL, NULL}
+};
+
+/* }}}1 END BENCHMARKS */
+
+/* ALLOCATION COUNTING {{{1 */
+
+/*
+ * svnfs_bench_allocs
+ *
+ * The number of heap allocations made so far.  Pools get their memory from
+ * the heap in blocks, so allocating from a pool only counts when it makes
+ * the pool grow.
+ */
+static long svnfs_bench_allocs;
+
+/* glibc's own allocator, under the names it also exports */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	svnfs_bench_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	svnfs_bench_allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	svnfs_bench_allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+/* }}}1 END ALLOCATION COUNTING */
+
+/* MAIN OPERATIONS {{{1 */
+
+/*
+ * svnfs_bench_seed
+ *
+ * Fills the caches with SVNFS_BENCH_DIR, holding SVNFS_BENCH_FILES files,
+ * all of them listed, statted and in the content cache.  The content cache
+ * entries stay open, so that the insert benchmark cannot evict them.
+ *
+ * return: 0 on success, or -1 on error
+ */
+static int svnfs_bench_seed(void)
+{
+	static char data[SVNFS_BENCH_SIZE];
+	char name[] = "/tmp/svnfs_bench.XXXXXX";
+	apr_pool_t *seed_pool;
+	apr_hash_t *dirents;
+	svn_dirent_t *dirent;
+	svnfs_cache_t *cache;
+	char key[64];
+	int fd;
+	int i;
+
+	if(apr_pool_create(&seed_pool, NULL) != APR_SUCCESS)
+		return -1;
+
+	/* Every file shares the contents of one unnamed temporary file */
+	fd = mkstemp(name);
+	if(fd < 0)
+		return -1;
+	unlink(name);
+	memset(data, 'x', sizeof(data));
+	if(write(fd, data, sizeof(data)) != sizeof(data))
+		return -1;
+
+	dirents = apr_hash_make(seed_pool);
+	for(i = 0; i < SVNFS_BENCH_FILES; i++)
+	{
+		dirent = apr_pcalloc(seed_pool, sizeof(*dirent));
+		dirent->kind        = svn_node_file;
+		dirent->size        = SVNFS_BENCH_SIZE;
+		dirent->created_rev = SVNFS_BENCH_REV - 2;
+		apr_hash_set(dirents, apr_psprintf(seed_pool, "file%d", i),
+		             APR_HASH_KEY_STRING, dirent);
+
+		snprintf(key, sizeof(key), SVNFS_BENCH_DIR "/file%d", i);
+		cache = svnfs_cache_new(key, SVNFS_BENCH_REV, "", dup(fd),
+		                        SVNFS_BENCH_SIZE, 0, 0);
+		if(!cache || !svnfs_cache_admit(cache))
+			return -1;
+	}
+	close(fd);
+
+	/* Nothing else is running, so the attribute cache is ours without its
+	 * lock */
+	svnfs_dir_store(svnfs_dir_get("/dir", SVNFS_BENCH_REV), "/dir", dirents,
+	                SVNFS_ATTR_FIELDS, seed_pool);
+
+	apr_pool_destroy(seed_pool);
+
+	return 0;
+}
+
+/*
+ * svnfs_bench_now
+ *
+ * return: the time on the monotonic clock, in nanoseconds
+ */
+static double svnfs_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * svnfs_bench_run
+ *
+ * Runs a benchmark for at least SVNFS_BENCH_TIME, doubling the number of
+ * iterations until it takes that long, and reports the time per operation.
+ *
+ * bench: the benchmark
+ */
+static void svnfs_bench_run(const svnfs_bench_t *bench)
+{
+	double start;
+	double elapsed;
+	long iterations;
+	long allocs;
+
+	bench->run(1000); /* Warm up */
+
+	for(iterations = 1000; ; iterations *= 2)
+	{
+		allocs = svnfs_bench_allocs;
+		start = svnfs_bench_now();
+		bench->run(iterations);
+		elapsed = svnfs_bench_now() - start;
+		allocs = svnfs_bench_allocs - allocs;
+		if(elapsed >= SVNFS_BENCH_TIME)
+			break;
+	}
+
+	printf("%-24s %12ld ops %10.1f ns/op %8.2f allocs/op\n", bench->name,
+	       iterations, elapsed / iterations, (double)allocs / iterations);
+}
+
+int main(int argc, char **argv)
+{
+	const svnfs_bench_t *bench;
+	char *init_argv[] =
+	{
+		argv[0], "-o", "cache_size=256,admit_lfu=0,cache_io=buffered,quiet",
+		NULL
+	};
+
+	/* The cache is big enough for the seeded files with room to spare, and
+	 * admits whatever it is given.  Notes on evictions and hit counts would
+	 * land in the middle of the timings, and cost time of their own. */
+	if(svnfs_local_init(3, init_argv) != 0 || svnfs_bench_seed() != 0)
+	{
+		fprintf(stderr, "Could not set up the caches\n");
+		return EXIT_FAILURE;
+	}
+
+	for(bench = svnfs_benches; bench->name; bench++)
+		if(argc < 2 || strstr(bench->name, argv[1]))
+			svnfs_bench_run(bench);
+
+	return EXIT_SUCCESS;
+}
+
+/* }}}1 END MAIN OPERATIONS */
+
+/* vim: set tw=80 ts=4 fdm=marker: */
@@ -0,0 +1,339 @@
+/*
+ * svnfs_scale.c
+ * SVNFS File System - multi-threaded scaling benchmark
+ *
+ * Makes one pass over a manifest of paths under a mounted svnfs with a
+ * given number of threads, each path being visited once by whichever thread
+ * gets to it first, and reports the throughput and latency percentiles of
+ * the pass.  bench/scale.sh runs it cold and warm for growing thread counts.
+ *
+ * Usage: svnfs_scale [-t threads] [-l label] stat|read|readdir manifest root
+ *
+ * The manifest has one line per path, relative to root: "f path" for a file
+ * and "d path" for a directory.  stat visits every path, read opens and
+ * reads every file to the end, and readdir lists every directory.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* STRUCTURES {{{1 */
+
+/*
+ * SVNFS_SCALE_BUFSIZE
+ *
+ * The size of the reads made of each file, which matches what svnfs
+ * advertises through st_blksize.
+ */
+#define SVNFS_SCALE_BUFSIZE (128 * 1024)
+
+/*
+ * svnfs_scale_op_t
+ *
+ * What is done to each path.
+ */
+typedef enum svnfs_scale_op_t
+{
+	SVNFS_SCALE_STAT,
+	SVNFS_SCALE_READ,
+	SVNFS_SCALE_READDIR
+} svnfs_scale_op_t;
+
+/*
+ * svnfs_scale_t
+ *
+ * One pass, shared by the threads making it.
+ */
+typedef struct svnfs_scale_t
+{
+	/* What is done to each path */
+	svnfs_scale_op_t op;
+
+	/* Full paths to visit */
+	char **paths;
+	long count;
+
+	/* Index of the next path nobody has taken yet */
+	long next;
+	pthread_mutex_t lock;
+
+	/* Latency of the visit to each path, in nanoseconds */
+	double *latency;
+
+	/* Number of visits that failed */
+	long errors;
+} svnfs_scale_t;
+
+/* }}}1 END STRUCTURES */
+
+/* WORKERS {{{1 */
+
+/*
+ * svnfs_scale_now
+ *
+ * return: the time on the monotonic clock, in nanoseconds
+ */
+static double svnfs_scale_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * svnfs_scale_visit
+ *
+ * Does the pass's operation to one path.
+ *
+ * op:     what to do
+ * path:   the path
+ * buf:    buffer of SVNFS_SCALE_BUFSIZE bytes for reads
+ * return: 0 on success, or -1 on error
+ */
+static int svnfs_scale_visit(svnfs_scale_op_t op, const char *path, char *buf)
+{
+	struct stat st;
+	struct dirent *entry;
+	DIR *dir;
+	ssize_t got;
+	int fd;
+
+	switch(op)
+	{
+		case SVNFS_SCALE_STAT:
+			return stat(path, &st);
+
+		case SVNFS_SCALE_READ:
+			fd = open(path, O_RDONLY);
+			if(fd < 0)
+				return -1;
+			while((got = read(fd, buf, SVNFS_SCALE_BUFSIZE)) > 0)
+				;
+			close(fd);
+			return got < 0 ? -1 : 0;
+
+		case SVNFS_SCALE_READDIR:
+			dir = opendir(path);
+			if(!dir)
+				return -1;
+			errno = 0;
+			while((entry = readdir(dir)) != NULL)
+				;
+			closedir(dir);
+			return errno ? -1 : 0;
+	}
+
+	return -1;
+}
+
+/*
+ * svnfs_scale_worker
+ *
+ * Takes paths off the pass until there are none left.
+ *
+ * data:   the pass
+ * return: NULL
+ */
+static void *svnfs_scale_worker(void *data)
+{
+	svnfs_scale_t *scale = data;
+	char *buf;
+	double start;
+	long errors;
+	long i;
+
+	buf = malloc(SVNFS_SCALE_BUFSIZE);
+	if(!buf)
+		abort();
+
+	errors = 0;
+	for(;;)
+	{
+		pthread_mutex_lock(&scale->lock);
+			i = scale->next++;
+		pthread_mutex_unlock(&scale->lock);
+		if(i >= scale->count)
+			break;
+
+		start = svnfs_scale_now();
+		if(svnfs_scale_visit(scale->op, scale->paths[i], buf) != 0)
+			errors++;
+		scale->latency[i] = svnfs_scale_now() - start;
+	}
+
+	pthread_mutex_lock(&scale->lock);
+		scale->errors += errors;
+	pthread_mutex_unlock(&scale->lock);
+
+	free(buf);
+	return NULL;
+}
+
+/* }}}1 END WORKERS */
+
+/* MAIN OPERATIONS {{{1 */
+
+/*
+ * svnfs_scale_compare
+ *
+ * Orders latencies for qsort.
+ *
+ * a:      one latency
+ * b:      the other
+ * return: less than, equal to or greater than 0 as a is less than, equal to
+ *         or greater than b
+ */
+static int svnfs_scale_compare(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * svnfs_scale_load
+ *
+ * Reads the paths of one kind from a manifest.
+ *
+ * scale:    the pass, whose paths are filled in
+ * manifest: name of the manifest
+ * root:     directory the manifest's paths are relative to
+ * kind:     'f' for files, 'd' for directories, or 0 for both
+ * return:   0 on success, or -1 on error
+ */
+static int svnfs_scale_load(svnfs_scale_t *scale, const char *manifest,
+                            const char *root, char kind)
+{
+	char line[4096];
+	char **grown;
+	long size;
+	FILE *file;
+	size_t len;
+
+	file = fopen(manifest, "r");
+	if(!file)
+		return -1;
+
+	size = 0;
+	while(fgets(line, sizeof(line), file))
+	{
+		len = strlen(line);
+		if(len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if(len < 3 || line[1] != ' ' || (kind && line[0] != kind))
+			continue;
+
+		if(scale->count == size)
+		{
+			size = size ? size * 2 : 1024;
+			grown = realloc(scale->paths, size * sizeof(char *));
+			if(!grown)
+				return -1;
+			scale->paths = grown;
+		}
+
+		scale->paths[scale->count] = malloc(strlen(root) + len);
+		if(!scale->paths[scale->count])
+			return -1;
+		sprintf(scale->paths[scale->count++], "%s/%s", root, line + 2);
+	}
+
+	fclose(file);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	svnfs_scale_t scale;
+	pthread_t *threads;
+	const char *label;
+	double start;
+	double elapsed;
+	int nthreads;
+	int opt;
+	int i;
+
+	nthreads = 1;
+	label = "-";
+	while((opt = getopt(argc, argv, "t:l:")) != -1)
+	{
+		switch(opt)
+		{
+			case 't':
+				nthreads = atoi(optarg);
+				break;
+			case 'l':
+				label = optarg;
+				break;
+			default:
+				return EXIT_FAILURE;
+		}
+	}
+
+	if(argc - optind != 3 || nthreads < 1)
+	{
+		fprintf(stderr, "Usage: %s [-t threads] [-l label] "
+		        "stat|read|readdir manifest root\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	memset(&scale, 0, sizeof(scale));
+	if(strcmp(argv[optind], "stat") == 0)
+		scale.op = SVNFS_SCALE_STAT;
+	else if(strcmp(argv[optind], "read") == 0)
+		scale.op = SVNFS_SCALE_READ;
+	else if(strcmp(argv[optind], "readdir") == 0)
+		scale.op = SVNFS_SCALE_READDIR;
+	else
+		return EXIT_FAILURE;
+
+	if(svnfs_scale_load(&scale, argv[optind + 1], argv[optind + 2],
+	                    scale.op == SVNFS_SCALE_STAT ? 0
+	                    : scale.op == SVNFS_SCALE_READ ? 'f' : 'd') != 0
+	   || scale.count == 0)
+	{
+		fprintf(stderr, "Could not read manifest \"%s\"\n", argv[optind + 1]);
+		return EXIT_FAILURE;
+	}
+
+	scale.latency = calloc(scale.count, sizeof(double));
+	threads = calloc(nthreads, sizeof(pthread_t));
+	if(!scale.latency || !threads)
+		return EXIT_FAILURE;
+	pthread_mutex_init(&scale.lock, NULL);
+
+	start = svnfs_scale_now();
+	for(i = 0; i < nthreads; i++)
+		if(pthread_create(&threads[i], NULL, svnfs_scale_worker, &scale) != 0)
+			return EXIT_FAILURE;
+	for(i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	elapsed = svnfs_scale_now() - start;
+
+	qsort(scale.latency, scale.count, sizeof(double), svnfs_scale_compare);
+
+	/* op label threads paths errors seconds ops/s p50 p90 p99 max (us) */
+	printf("%s\t%s\t%d\t%ld\t%ld\t%.3f\t%.0f\t%.1f\t%.1f\t%.1f\t%.1f\n",
+	       argv[optind], label, nthreads, scale.count, scale.errors,
+	       elapsed / 1e9, scale.count / (elapsed / 1e9),
+	       scale.latency[scale.count * 50 / 100] / 1e3,
+	       scale.latency[scale.count * 90 / 100] / 1e3,
+	       scale.latency[scale.count * 99 / 100] / 1e3,
+	       scale.latency[scale.count - 1] / 1e3);
+
+	return scale.errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* }}}1 END MAIN OPERATIONS */
+
+/* vim: set tw=80 ts=4 fdm=marker: */
@@ -0,0 +1,200 @@
+#!/bin/sh
+#
+# workloads.sh
+# SVNFS File System - end-to-end workloads against a mounted local repository
+#
+# Usage: bench/workloads.sh [workload...]
+#
+# Imports a generated tree into a fresh local repository: a C project of
+# PROJECT_MODULES modules of PROJECT_FILES source files each, and DATA_FILES
+# files of DATA_SIZE bytes.  Then it runs each workload through a mount of
+# the repository, first against cold caches on a fresh mount and then again
+# against warm ones.  The workloads are:
+#
+#   compile  build the C project out of tree, reading its sources from the
+#            mount
+#   grep     grep -r through the whole tree
+#   tar      tar c of the whole tree
+#   rsync    rsync -a of the whole tree to local disk
+#   sha256   find -type f | xargs sha256sum over the whole tree
+#
+# With no arguments every workload is run.  Extra mount options go in
+# SVNFS_OPTS.  Each run prints one tab-separated line: the wall time, the
+# bytes of file contents the daemon fetched from the repository (from
+# /.svnfs/stats) and the CPU time the daemon used.
+
+set -e
+
+PROJECT_MODULES=${PROJECT_MODULES:-16}
+PROJECT_FILES=${PROJECT_FILES:-24}
+DATA_FILES=${DATA_FILES:-64}
+DATA_SIZE=${DATA_SIZE:-1048576}
+WORKLOADS=${*:-compile grep tar rsync sha256}
+
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/svnfs_workloads.XXXXXX")
+MNT=$WORK/mnt
+TREE=$MNT/1/tree
+TICKS=$(getconf CLK_TCK)
+
+cleanup()
+{
+	fusermount -u "$MNT" 2>/dev/null || :
+	rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+mount_svnfs()
+{
+	"$TOP/svnfs" "file://$WORK/repo" "$MNT" \
+		-o "cache_root=$WORK/cache${SVNFS_OPTS:+,$SVNFS_OPTS}"
+	until [ -d "$MNT/1" ]; do
+		sleep 0.1
+	done
+	pid=$(pgrep -n -f "svnfs file://$WORK/repo")
+}
+
+# Seconds of CPU the daemon has used so far
+daemon_cpu()
+{
+	awk -v ticks="$TICKS" '{ printf "%.2f", ($14 + $15) / ticks }' \
+		"/proc/$pid/stat"
+}
+
+# Bytes of file contents the daemon has fetched so far
+daemon_fetched()
+{
+	awk '$1 == "fetched_bytes" { print $2 }' "$MNT/.svnfs/stats"
+}
+
+now()
+{
+	date +%s.%N
+}
+
+# The difference of two decimal numbers
+minus()
+{
+	awk -v a="$1" -v b="$2" 'BEGIN { printf "%.3f", a - b }'
+}
+
+# WORKLOADS {{{1
+
+run_compile()
+{
+	rm -rf "$WORK/build"
+	mkdir "$WORK/build"
+	make -s -C "$WORK/build" -f "$TREE/project/Makefile" \
+		SRC="$TREE/project" -j"$(nproc)"
+}
+
+run_grep()
+{
+	grep -r -c "no such string in the tree" "$TREE" >/dev/null || :
+}
+
+run_tar()
+{
+	# Through a pipe, since GNU tar skips reading files when writing to
+	# /dev/null
+	tar cf - -C "$MNT/1" tree | cat >/dev/null
+}
+
+run_rsync()
+{
+	rm -rf "$WORK/copy"
+	rsync -a "$TREE/" "$WORK/copy/"
+}
+
+run_sha256()
+{
+	find "$TREE" -type f -print0 | xargs -0 sha256sum >/dev/null
+}
+
+# END WORKLOADS }}}1
+
+# TREE GENERATION {{{1
+
+generate_project()
+{
+	project=$WORK/tree/project
+	mkdir -p "$project/include" "$project/src/main"
+
+	cat > "$project/Makefile" <<'MAKEFILE'
+SRC ?= .
+SOURCES = $(wildcard $(SRC)/src/*/*.c)
+OBJECTS = $(patsubst $(SRC)/src/%.c,obj/%.o,$(SOURCES))
+
+project: $(OBJECTS)
+	$(CC) -o $@ $^
+
+obj/%.o: $(SRC)/src/%.c $(wildcard $(SRC)/include/*.h)
+	@mkdir -p $(dir $@)
+	$(CC) -O2 -I$(SRC)/include -c -o $@ $<
+MAKEFILE
+
+	printf 'int main(void)\n{\n\treturn 0;\n}\n' > "$project/src/main/main.c"
+
+	awk -v modules="$PROJECT_MODULES" -v files="$PROJECT_FILES" \
+	    -v dir="$project" '
+	BEGIN {
+		header = dir "/include/project.h"
+		print "#ifndef PROJECT_H\n#define PROJECT_H\n" > header
+		for(m = 0; m < modules; m++)
+		{
+			system("mkdir -p " dir "/src/mod" m)
+			for(f = 0; f < files; f++)
+			{
+				source = dir "/src/mod" m "/file" f ".c"
+				print "#include \"project.h\"\n" > source
+				for(k = 0; k < 16; k++)
+				{
+					name = "mod" m "_file" f "_func" k
+					print "long " name "(long x);" > header
+					print "long " name "(long x)\n{\n\tlong i;\n" > source
+					print "\tfor(i = 0; i < " k + 8 "; i++)" > source
+					print "\t\tx = x * 31 + i;\n\treturn x;\n}\n" > source
+				}
+				close(source)
+			}
+		}
+		print "\n#endif" > header
+	}'
+}
+
+generate_data()
+{
+	mkdir -p "$WORK/tree/data"
+	i=0
+	while [ $i -lt "$DATA_FILES" ]; do
+		head -c "$DATA_SIZE" /dev/urandom > "$WORK/tree/data/blob$i"
+		i=$((i + 1))
+	done
+}
+
+# END TREE GENERATION }}}1
+
+make -C "$TOP" svnfs >/dev/null
+
+mkdir -p "$WORK/tree" "$MNT"
+generate_project
+generate_data
+svnadmin create "$WORK/repo"
+svn import -q -m "Workload tree" "$WORK/tree" "file://$WORK/repo/tree"
+
+printf 'workload\tcache\twall_s\tfetched_bytes\tdaemon_cpu_s\n'
+for workload in $WORKLOADS; do
+	mount_svnfs
+	for cache in cold warm; do
+		cpu=$(daemon_cpu)
+		fetched=$(daemon_fetched)
+		start=$(now)
+		"run_$workload"
+		end=$(now)
+		printf '%s\t%s\t%s\t%d\t%s\n' "$workload" "$cache" \
+			"$(minus "$end" "$start")" \
+			$(($(daemon_fetched) - fetched)) \
+			"$(minus "$(daemon_cpu)" "$cpu")"
+	done
+	fusermount -u "$MNT"
+done
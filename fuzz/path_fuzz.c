@@ -0,0 +1,99 @@
+/*
+ * path_fuzz.c
+ * SVNFS File System - fuzzing target for svnfs_path_parse
+ *
+ * Checks svnfs_path_parse against a slow, obviously correct parser built on
+ * strtol.  Build with "make fuzz/path_fuzz" and run as any libFuzzer target.
+ */
+
+#include "../svnfs.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * SVNFS_FUZZ_PATH_MAX
+ *
+ * The longest path tried; FUSE hands us nothing longer.
+ */
+#define SVNFS_FUZZ_PATH_MAX 4096
+
+/*
+ * svnfs_fuzz_reference
+ *
+ * Parses a path the slow way, accepting exactly what svnfs_path_parse is
+ * documented to accept.
+ *
+ * path:   the path to be parsed
+ * view:   filled in with what was found
+ * return: nonzero on success, zero on failure
+ */
+static int svnfs_fuzz_reference(const char *path, svnfs_path_t *view)
+{
+	char *end;
+	long rev;
+
+	if(path[0] != '/')
+		return 0;
+
+	if(strncmp(path, "/HEAD", 5) == 0 && (path[5] == '/' || path[5] == '\0'))
+	{
+		view->head = 1;
+		view->rev  = SVN_INVALID_REVNUM;
+		view->rest = path + 5;
+		return 1;
+	}
+
+	if(!isdigit((unsigned char)path[1]))
+		return 0;
+	if(path[1] == '0' && isdigit((unsigned char)path[2]))
+		return 0;
+
+	errno = 0;
+	rev = strtol(path + 1, &end, 10);
+	if(errno == ERANGE)
+		return 0;
+	if(*end != '/' && *end != '\0')
+		return 0;
+
+	view->head = 0;
+	view->rev  = rev;
+	view->rest = end;
+	return 1;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	char path[SVNFS_FUZZ_PATH_MAX];
+	svnfs_path_t view;
+	svnfs_path_t expected;
+	int ok;
+
+	if(size >= sizeof(path))
+		return 0;
+	memcpy(path, data, size);
+	path[size] = '\0';
+
+	memset(&view, 0, sizeof(view));
+	ok = svnfs_path_parse(path, &view);
+	if(ok != svnfs_fuzz_reference(path, &expected))
+		abort();
+	if(!ok)
+		return 0;
+
+	if(view.head != expected.head || view.rev != expected.rev
+	   || view.rest != expected.rest)
+		abort();
+
+	/* The view must lie within the path, at the end of a component */
+	if(view.rest < path || view.rest > path + strlen(path)
+	   || (*view.rest != '/' && *view.rest != '\0'))
+		abort();
+
+	return 0;
+}
+
+/* vim: set tw=80 ts=4 fdm=marker: */
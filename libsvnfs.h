@@ -0,0 +1,182 @@
+/*
+ * libsvnfs.h
+ * SVNFS File System - embeddable interface
+ *
+ * Programs using this interface link against libsvnfs.a and also need
+ * -lfuse and -lsvn_client-1, plus -luring if it was built with IO_URING=1.
+ * Nothing is mounted, but the options are parsed with libfuse's
+ * fuse_opt_parse(), just as for a mount.
+ *
+ * Kyle Sluder
+ */
+
+#ifndef _LIBSVNFS_H_
+#define _LIBSVNFS_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* STRUCTURES {{{1 */
+
+/*
+ * svnfs_lib_filler_t
+ *
+ * Called once for each child of a listed directory.  The stat struct is only
+ * filled in when the listing already knew the child's attributes; otherwise
+ * it is NULL and svnfs_lib_stat() will find them.
+ *
+ * baton:  the baton given with the listing request
+ * name:   name of the child
+ * stbuf:  attributes of the child, or NULL
+ * return: 0 to carry on, or non-zero to stop the listing
+ */
+typedef int (*svnfs_lib_filler_t)(void *baton, const char *name,
+                                  const struct stat *stbuf);
+
+/*
+ * svnfs_lib_stat_t
+ *
+ * One request to svnfs_lib_stat_many().
+ */
+typedef struct svnfs_lib_stat_t
+{
+	/* Path to get the attributes of, as it would appear under the mount */
+	const char *path;
+
+	/* Filled with the attributes of the path */
+	struct stat stbuf;
+
+	/* 0 on success, or -errno on error */
+	int result;
+} svnfs_lib_stat_t;
+
+/*
+ * svnfs_lib_list_t
+ *
+ * One request to svnfs_lib_list_many().
+ */
+typedef struct svnfs_lib_list_t
+{
+	/* Directory to list, as it would appear under the mount */
+	const char *path;
+
+	/* Called for each child of the directory */
+	svnfs_lib_filler_t filler;
+
+	/* Passed to filler */
+	void *baton;
+
+	/* 0 on success, or -errno on error */
+	int result;
+} svnfs_lib_list_t;
+
+/*
+ * svnfs_lib_read_t
+ *
+ * One request to svnfs_lib_read_many().
+ */
+typedef struct svnfs_lib_read_t
+{
+	/* File to read from, as it would appear under the mount */
+	const char *path;
+
+	/* Buffer to read into */
+	char *buf;
+
+	/* Number of bytes to read */
+	size_t len;
+
+	/* Offset in the file at which to start */
+	off_t offset;
+
+	/* The number of bytes read, or -errno on error */
+	int result;
+} svnfs_lib_read_t;
+
+/* }}}1 END STRUCTURES */
+
+/* LIBRARY OPERATIONS {{{1 */
+
+/*
+ * svnfs_lib_init
+ *
+ * Sets up the backend and its caches in the calling process.  The arguments
+ * are those svnfs takes on its command line, without the mount point: the
+ * repository URL and any -o options.  Giving the cache_dir of a mount shares
+ * its content cache, once the mount has let go of it.  Notes on cache misses,
+ * evictions and the like go to standard output unless -oquiet is given.
+ * Also starts the threads, one fewer than ra_threads, which serve the
+ * requests of the *_many() calls alongside their callers.  May only be
+ * called once.
+ *
+ * argc:   number of arguments
+ * argv:   the arguments, starting with a program name
+ * return: 0 on success, or -1 on error
+ */
+int svnfs_lib_init(int argc, char **argv);
+
+/*
+ * svnfs_lib_stat
+ *
+ * Gets the attributes of a path, just as stat(2) under the mount would.
+ *
+ * path:   path to get attributes of
+ * stbuf:  stat struct to fill
+ * return: 0 on success, or -errno on error
+ */
+int svnfs_lib_stat(const char *path, struct stat *stbuf);
+
+/*
+ * svnfs_lib_list
+ *
+ * Lists a directory, just as readdir(3) under the mount would, but without
+ * "." and "..".
+ *
+ * path:   directory to list
+ * filler: called for each child of the directory
+ * baton:  passed to filler
+ * return: 0 on success, or -errno on error
+ */
+int svnfs_lib_list(const char *path, svnfs_lib_filler_t filler, void *baton);
+
+/*
+ * svnfs_lib_stat_many
+ *
+ * Gets the attributes of many paths at once.  Paths in the caches are
+ * answered straight away, and the rest go to the repository together rather
+ * than one after another.
+ *
+ * reqs:   the requests, each of which gets its own result
+ * count:  number of requests
+ */
+void svnfs_lib_stat_many(svnfs_lib_stat_t *reqs, int count);
+
+/*
+ * svnfs_lib_list_many
+ *
+ * Lists many directories at once.  Each filler is only ever called from one
+ * thread at a time, but the fillers of different requests may run
+ * concurrently.
+ *
+ * reqs:   the requests, each of which gets its own result
+ * count:  number of requests
+ */
+void svnfs_lib_list_many(svnfs_lib_list_t *reqs, int count);
+
+/*
+ * svnfs_lib_read_many
+ *
+ * Reads from many files at once, fetching those not in the content cache
+ * together.  Requests for the same file are served one after another with
+ * one open of the file, and so share one fetch.
+ *
+ * reqs:   the requests, each of which gets its own result
+ * count:  number of requests
+ */
+void svnfs_lib_read_many(svnfs_lib_read_t *reqs, int count);
+
+/* END LIBRARY OPERATIONS }}}1 */
+
+#endif /* _LIBSVNFS_H_ */
+
+/* vim: set tw=80 ts=4 fdm=marker */
@@ -7,19 +7,34 @@
 
 #include "svnfs.h"
 
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
 #define FUSE_USE_VERSION 25
 #include <fuse.h>
 #include <fuse_opt.h>
 
+#include <apr_atomic.h>
 #include <apr_general.h>
+#include <apr_fnmatch.h>
 #include <apr_strings.h>
-#include <apr_thread_rwlock.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_cond.h>
+#include <apr_thread_mutex.h>
 
 #include <svn_types.h>
 #include <svn_auth.h>
+#include <svn_client.h>
+#include <svn_config.h>
+#include <svn_error_codes.h>
+#include <svn_path.h>
 #include <svn_ra.h>
 
 /* STATIC GLOBALS {{{1 */
@@ -44,6 +59,24 @@ static char *svnfs_repository;
  */
 static char *svnfs_mountpoint;
 
+/*
+ * svnfs_repos_prefix
+ *
+ * The path of svnfs_repository relative to the repository root, without a
+ * trailing slash ("" if the repository root itself was given).  Changed paths
+ * reported by svn_ra_get_log are relative to the repository root, so they
+ * must have this prefix stripped before they can be compared with the paths
+ * we hand to the RA layer.
+ */
+static const char *svnfs_repos_prefix;
+
+/*
+ * svnfs_ctx
+ *
+ * Options parsed from the command line.
+ */
+static svnfs_context_t svnfs_ctx;
+
 /*
  * svnfs_pool
  *
@@ -52,355 +85,6878 @@ static char *svnfs_mountpoint;
 static apr_pool_t *pool;
 
 /*
- * svnfs_ra_session
+ * svnfs_ra_main
+ *
+ * Session opened by main() to look the repository up, and then owned by
+ * the first I/O thread.
+ */
+static svnfs_ra_conn_t svnfs_ra_main = { NULL, NULL, "main" };
+
+/*
+ * svnfs_ra_main_lock, svnfs_ra_main_cond, svnfs_ra_main_busy
+ *
+ * Hand svnfs_ra_main to one request at a time while there are no I/O
+ * threads.  svnfs_ra_main_busy is protected by the lock, and the condition
+ * is signalled when it is cleared.
+ */
+static apr_thread_mutex_t *svnfs_ra_main_lock;
+static apr_thread_cond_t *svnfs_ra_main_cond;
+static int svnfs_ra_main_busy;
+
+/*
+ * svnfs_ra_started
+ *
+ * Nonzero once the I/O threads are running.  Only modified by
+ * svnfs_fuse_init().
+ */
+static int svnfs_ra_started;
+
+/*
+ * svnfs_ra_demand_head, svnfs_ra_demand_tail,
+ * svnfs_ra_background_head, svnfs_ra_background_tail
+ *
+ * Requests waiting for an I/O thread, oldest first, in two queues so that
+ * demand requests always go ahead of background ones.  Protected by
+ * svnfs_ra_queue_lock.
+ */
+static svnfs_ra_job_t *svnfs_ra_demand_head;
+static svnfs_ra_job_t *svnfs_ra_demand_tail;
+static svnfs_ra_job_t *svnfs_ra_background_head;
+static svnfs_ra_job_t *svnfs_ra_background_tail;
+
+/*
+ * svnfs_ra_background_busy, svnfs_ra_background_limit
+ *
+ * Number of I/O threads running background requests, and how many may.
+ * Protected by svnfs_ra_queue_lock.
+ */
+static int svnfs_ra_background_busy;
+static int svnfs_ra_background_limit;
+
+/*
+ * svnfs_ra_queue_lock
+ *
+ * Mutex protecting the request queues and the requests on them.
+ */
+static apr_thread_mutex_t *svnfs_ra_queue_lock;
+
+/*
+ * svnfs_ra_queue_cond
+ *
+ * Signalled when there may be a request for an I/O thread to run.
+ */
+static apr_thread_cond_t *svnfs_ra_queue_cond;
+
+/*
+ * svnfs_bucket_mount, svnfs_bucket_background
+ *
+ * Token buckets for file contents streamed by the whole mount and by
+ * background requests.  Protected by svnfs_bucket_lock.
+ */
+static svnfs_bucket_t svnfs_bucket_mount;
+static svnfs_bucket_t svnfs_bucket_background;
+
+/*
+ * svnfs_bucket_lock
+ *
+ * Mutex protecting the token buckets.
+ */
+static apr_thread_mutex_t *svnfs_bucket_lock;
+
+/*
+ * svnfs_ra_failures
+ *
+ * Number of requests in a row that have failed because the connection broke.
+ * Reset by the first request to succeed.
+ */
+static volatile apr_uint32_t svnfs_ra_failures;
+
+/*
+ * svnfs_ra_callbacks
+ *
+ * Callbacks, including authentication, with which every session is opened.
+ * Only modified by main().
+ */
+static svn_ra_callbacks2_t *svnfs_ra_callbacks;
+
+/*
+ * svnfs_ra_config
+ *
+ * Subversion configuration with which every session is opened.  Only
+ * modified by main().
+ */
+static apr_hash_t *svnfs_ra_config;
+
+/*
+ * svnfs_ra_call_key
+ *
+ * Thread-private pointer to the svnfs_ra_call_t of the request the thread is
+ * running, if it can be cancelled, for svnfs_ra_cancel.
+ */
+static apr_threadkey_t *svnfs_ra_call_key;
+
+#ifdef SVNFS_HAVE_IO_URING
+/*
+ * svnfs_uring_key
+ *
+ * Thread-private pointer to the svnfs_uring_t of the thread, made the first
+ * time it is wanted and torn down when the thread exits.
+ */
+static apr_threadkey_t *svnfs_uring_key;
+#endif
+
+/*
+ * svnfs_hedge_session
+ *
+ * Second session on which slow STAT and DIR requests are duplicated, or NULL
+ * if it has not been opened yet or broke.  Only used by the hedge thread.
+ */
+static svn_ra_session_t *svnfs_hedge_session;
+
+/*
+ * svnfs_hedge_pool
+ *
+ * Pool from which svnfs_hedge_session is allocated.  Only used by the hedge
+ * thread.
+ */
+static apr_pool_t *svnfs_hedge_pool;
+
+/*
+ * svnfs_hedge_started
+ *
+ * Nonzero once the hedge thread is running.  Only modified by
+ * svnfs_fuse_init().
+ */
+static int svnfs_hedge_started;
+
+/*
+ * svnfs_hedge_queue
+ *
+ * Requests waiting to fall due for hedging.  Protected by svnfs_hedge_lock.
+ */
+static svnfs_hedge_t *svnfs_hedge_queue;
+
+/*
+ * svnfs_hedge_samples, svnfs_hedge_nsamples
+ *
+ * A ring of the most recent STAT and DIR latencies, and how many have ever
+ * been recorded.  Protected by svnfs_hedge_lock.
+ */
+static apr_interval_time_t svnfs_hedge_samples[SVNFS_HEDGE_SAMPLES];
+static apr_size_t svnfs_hedge_nsamples;
+
+/*
+ * svnfs_hedge_delay
+ *
+ * How long a STAT or DIR request may take before it is duplicated: the
+ * svnfs_ctx.hedge percentile of svnfs_hedge_samples, or 0 until there are
+ * enough samples.  Protected by svnfs_hedge_lock.
+ */
+static apr_interval_time_t svnfs_hedge_delay;
+
+/*
+ * svnfs_hedge_credit
+ *
+ * Hundredths of a duplicate request that may still be sent within the
+ * budget.  Protected by svnfs_hedge_lock.
+ */
+static int svnfs_hedge_credit;
+
+/*
+ * svnfs_hedge_lock
+ *
+ * Mutex protecting the hedging state above.
+ */
+static apr_thread_mutex_t *svnfs_hedge_lock;
+
+/*
+ * svnfs_hedge_cond
+ *
+ * Signalled when a request is added to svnfs_hedge_queue.
+ */
+static apr_thread_cond_t *svnfs_hedge_cond;
+
+/*
+ * svnfs_arena_base, svnfs_arena_size, svnfs_arena_next
+ *
+ * The region reserved for the memory arena, or NULL if there is none; its
+ * size, and how much of it has been carved into slabs.  Only modified by
+ * svnfs_arena_init(), except svnfs_arena_next, which is protected by
+ * svnfs_arena_lock.
+ */
+static char *svnfs_arena_base;
+static apr_size_t svnfs_arena_size;
+static apr_size_t svnfs_arena_next;
+
+/*
+ * svnfs_arena_classes
+ *
+ * The size class of each slab carved from the region.  Protected by
+ * svnfs_arena_lock.
+ */
+static unsigned char *svnfs_arena_classes;
+
+/*
+ * svnfs_arena_free
+ *
+ * Free objects of each size class, linked through their first word.
+ * Protected by svnfs_arena_lock.
+ */
+static void *svnfs_arena_free[SVNFS_ARENA_CLASSES];
+
+/*
+ * svnfs_arena_lock
+ *
+ * Mutex protecting the memory arena.
+ */
+static apr_thread_mutex_t *svnfs_arena_lock;
+
+/* 
+ * svnfs_cache_files
+ *
+ * An apr_hash_t that maps paths in the filesystems to svnfs_cache_t entries
+ * for files on disk that contain the contents of the represented files.  For
+ * example, the path /1/foo might map to an unnamed file under
+ * svnfs_ctx.cache_root which contains the contents of the repository file
+ * "/foo" at revision 1.
+ */
+static apr_hash_t *svnfs_cache_files;
+
+/*
+ * svnfs_cache_head, svnfs_cache_tail
+ *
+ * The most and least recently used entries in svnfs_cache_files.  Protected
+ * by svnfs_cache_lock.
+ */
+static svnfs_cache_t *svnfs_cache_head;
+static svnfs_cache_t *svnfs_cache_tail;
+
+/*
+ * svnfs_cache_used
+ *
+ * Total size in bytes of the files in svnfs_cache_files.  Protected by
+ * svnfs_cache_lock.
+ */
+static apr_off_t svnfs_cache_used;
+
+/*
+ * svnfs_cache_lock
+ *
+ * Mutex protecting svnfs_cache_files, the LRU list and the counts of each
+ * entry.
+ */
+static apr_thread_mutex_t *svnfs_cache_lock;
+
+/*
+ * svnfs_cache_fills
+ *
+ * Maps the keys of svnfs_cache_files entries which some thread is currently
+ * fetching to the fetch's urgent flag (a volatile apr_uint32_t *).  Protected
+ * by svnfs_cache_lock.
+ */
+static apr_hash_t *svnfs_cache_fills;
+
+/*
+ * svnfs_cache_probation
+ *
+ * Maps the keys of entries on probation which are open to the entries, so
+ * that opening the file again shares the entry rather than fetching it
+ * again.  Protected by svnfs_cache_lock.
+ */
+static apr_hash_t *svnfs_cache_probation;
+
+/*
+ * svnfs_cache_cond
+ *
+ * Signalled whenever a fetch in svnfs_cache_fills finishes, so that threads
+ * opening the same file can use the result.
+ */
+static apr_thread_cond_t *svnfs_cache_cond;
+
+/*
+ * svnfs_cache_ghosts
+ *
+ * The keys of the last SVNFS_GHOST_SIZE large files fetched on probation, as
+ * keys of a hash.  Protected by svnfs_cache_lock.
+ */
+static apr_hash_t *svnfs_cache_ghosts;
+
+/*
+ * svnfs_cache_ghost_ring, svnfs_cache_ghost_next
+ *
+ * The same keys in the order they were added, as heap-allocated strings, and
+ * the slot the next one goes in; the key already there is forgotten.
+ * Protected by svnfs_cache_lock.
+ */
+static char *svnfs_cache_ghost_ring[SVNFS_GHOST_SIZE];
+static int svnfs_cache_ghost_next;
+
+/*
+ * svnfs_cache_sketch
+ *
+ * Count-Min sketch of how often each file has been opened lately, saturating
+ * at 15.  Protected by svnfs_cache_lock.
+ */
+static unsigned char svnfs_cache_sketch[SVNFS_SKETCH_DEPTH][SVNFS_SKETCH_WIDTH];
+
+/*
+ * svnfs_cache_sketch_adds
+ *
+ * Opens counted since the sketch was last halved.  Protected by
+ * svnfs_cache_lock.
+ */
+static unsigned int svnfs_cache_sketch_adds;
+
+/*
+ * svnfs_cache_hits, svnfs_cache_misses, svnfs_cache_rejects
+ *
+ * Opens found in the content cache, opens which had to fetch, and fetched
+ * files turned away by svnfs_cache_admit.  Protected by svnfs_cache_lock.
+ */
+static unsigned int svnfs_cache_hits;
+static unsigned int svnfs_cache_misses;
+static unsigned int svnfs_cache_rejects;
+
+/*
+ * svnfs_cache_fetched, svnfs_cache_fetches
+ *
+ * Bytes of file contents fetched from the repository, and the number of
+ * files they made up.  Protected by svnfs_cache_lock.
+ */
+static apr_off_t svnfs_cache_fetched;
+static unsigned int svnfs_cache_fetches;
+
+/*
+ * svnfs_cache_fds, svnfs_cache_fd_limit
+ *
+ * Descriptors held open by content cache entries, and how many of them
+ * svnfs_cache_evict lets stay open, or 0 for no limit.  The count is only
+ * changed atomically; the limit is set once by svnfs_setup.
+ */
+static volatile apr_uint32_t svnfs_cache_fds;
+static apr_uint32_t svnfs_cache_fd_limit;
+
+/*
+ * svnfs_store_file
+ *
+ * The index file of the persistent content cache, held open and locked so
+ * that no other mount uses the same directory.  Only modified by
+ * svnfs_store_open().
+ */
+static apr_file_t *svnfs_store_file;
+
+/*
+ * svnfs_store_header, svnfs_store_slots
+ *
+ * The index of the persistent content cache as mapped into memory, or NULL
+ * if there is none.  Only modified by svnfs_store_open(); the contents are
+ * protected by svnfs_cache_lock.
+ */
+static svnfs_store_header_t *svnfs_store_header;
+static svnfs_store_slot_t *svnfs_store_slots;
+
+/*
+ * svnfs_store_cold
+ *
+ * Nonzero while the index may still hold files which this mount has neither
+ * opened nor evicted.  Protected by svnfs_cache_lock.
+ */
+static int svnfs_store_cold;
+
+/*
+ * svnfs_store_evict_next, svnfs_store_scrub_next
+ *
+ * The slots at which svnfs_store_evict and the scrubber resume their walks
+ * through the index.  Protected by svnfs_cache_lock.
+ */
+static apr_uint32_t svnfs_store_evict_next;
+static apr_uint32_t svnfs_store_scrub_next;
+
+/*
+ * svnfs_rules
+ *
+ * The content cache rules, as an array of svnfs_rule_t *, or NULL before
+ * any are set.  Protected by svnfs_cache_lock.
+ */
+static apr_array_header_t *svnfs_rules;
+
+/*
+ * svnfs_rules_pool
+ *
+ * Pool from which svnfs_rules is allocated; replaced along with the rules.
+ * Protected by svnfs_cache_lock.
+ */
+static apr_pool_t *svnfs_rules_pool;
+
+/*
+ * svnfs_rules_text
+ *
+ * Rules given with -o pin and -o quota, one per line, to be set once the
+ * cache exists.  Only used by main().
+ */
+static char *svnfs_rules_text;
+
+/*
+ * svnfs_attr_revs
+ *
+ * Maps revisions to the svnfs_attr_rev_t holding the attribute and directory
+ * caches of that revision.  Since revisions never change, entries never need
+ * to be invalidated, only evicted.  Protected by svnfs_attr_lock.
+ */
+static apr_hash_t *svnfs_attr_revs;
+
+/*
+ * svnfs_attr_head, svnfs_attr_tail
+ *
+ * The revisions in svnfs_attr_revs, most recently used first.  Protected by
+ * svnfs_attr_lock.
+ */
+static svnfs_attr_rev_t *svnfs_attr_head;
+static svnfs_attr_rev_t *svnfs_attr_tail;
+
+/*
+ * svnfs_attr_entries
+ *
+ * Number of entries in the caches of all revisions.  Protected by
+ * svnfs_attr_lock.
+ */
+static apr_size_t svnfs_attr_entries;
+
+/*
+ * svnfs_attr_pool
+ *
+ * Pool from which svnfs_attr_revs is allocated.  The caches of each revision
+ * have a pool of their own.  Protected by svnfs_attr_lock.
+ */
+static apr_pool_t *svnfs_attr_pool;
+
+/*
+ * svnfs_attr_lock
+ *
+ * Mutex protecting the attribute and directory caches.
+ */
+static apr_thread_mutex_t *svnfs_attr_lock;
+
+/*
+ * svnfs_attr_cond
+ *
+ * Signalled whenever a directory listing started by svnfs_attr_get finishes,
+ * so that stats waiting on it can be answered.
+ */
+static apr_thread_cond_t *svnfs_attr_cond;
+
+/*
+ * svnfs_attr_none
+ *
+ * The attributes returned for nodes which do not exist.
+ */
+static svnfs_attr_t svnfs_attr_none =
+{
+	svn_node_none, 0, SVN_INVALID_REVNUM, SVNFS_ATTR_FIELDS
+};
+
+/*
+ * svnfs_reject_names
+ *
+ * The literal names given with -o reject or -o reject_probes, as keys of a
+ * hash so that they can be tested in constant time.  Only modified by main().
+ */
+static apr_hash_t *svnfs_reject_names;
+
+/*
+ * svnfs_reject_globs
+ *
+ * The patterns given with -o reject or -o reject_probes which contain
+ * wildcards, as an array of const char *.  Only modified by main().
+ */
+static apr_array_header_t *svnfs_reject_globs;
+
+/*
+ * svnfs_probe_names
+ *
+ * Names which desktops, shells and version control tools probe for in every
+ * directory they look at, and which -o reject_probes rejects.
+ */
+static const char *svnfs_probe_names[] =
+{
+	".git", ".hg", ".DS_Store", "desktop.ini", ".directory", "Thumbs.db",
+	".Trash", ".Trash-*", "autorun.inf", NULL
+};
+
+/*
+ * svnfs_head_rev
+ *
+ * The youngest revision last seen by the /HEAD tracker.  Paths below /HEAD
+ * are resolved against this revision.  Protected by svnfs_head_lock.
+ */
+static svn_revnum_t svnfs_head_rev;
+
+/*
+ * svnfs_head_changes
+ *
+ * Maps repository paths to the youngest revision (an svn_revnum_t *) in which
+ * the /HEAD tracker saw them change.  Protected by svnfs_head_lock.
+ */
+static apr_hash_t *svnfs_head_changes;
+
+/*
+ * svnfs_head_opens
+ *
+ * Maps repository paths to the /HEAD revision (an svn_revnum_t *) at which
+ * they were last opened through /HEAD.  Together with svnfs_head_changes this
+ * tells us whether the kernel's cached pages for a /HEAD file are still good.
+ * Protected by svnfs_head_lock.
+ */
+static apr_hash_t *svnfs_head_opens;
+
+/*
+ * svnfs_head_floor
+ *
+ * The revision below which svnfs_head_changes and svnfs_head_opens have been
+ * pruned, or SVN_INVALID_REVNUM if they never have.  Protected by
+ * svnfs_head_lock.
+ */
+static svn_revnum_t svnfs_head_floor = SVN_INVALID_REVNUM;
+
+/*
+ * svnfs_head_pool
+ *
+ * Pool from which the keys and values of svnfs_head_changes and
+ * svnfs_head_opens are allocated.  Protected by svnfs_head_lock.
+ */
+static apr_pool_t *svnfs_head_pool;
+
+/*
+ * svnfs_head_lock
+ *
+ * Mutex protecting the /HEAD tracking state above.
+ */
+static apr_thread_mutex_t *svnfs_head_lock;
+
+/*
+ * svnfs_lib_queue
+ *
+ * Batches of svnfs_lib_*_many() requests with some not yet taken by any
+ * thread, oldest first.  Protected by svnfs_lib_lock.
+ */
+static struct svnfs_lib_batch_t *svnfs_lib_queue;
+
+/*
+ * svnfs_lib_lock, svnfs_lib_cond, svnfs_lib_done
+ *
+ * Mutex protecting svnfs_lib_queue and the batches on it; the condition the
+ * library's worker threads wait on for a batch to be queued; and the
+ * condition signalled whenever a batch has been served in full.
+ */
+static apr_thread_mutex_t *svnfs_lib_lock;
+static apr_thread_cond_t *svnfs_lib_cond;
+static apr_thread_cond_t *svnfs_lib_done;
+
+/*
+ * svnfs_lib_workers
+ *
+ * Number of the library's worker threads running.  Only modified by
+ * svnfs_lib_init().
+ */
+static int svnfs_lib_workers;
+
+/*
+ * svnfs_opts
+ *
+ * Flags and parameters passable to SVNFS on the command line.  The first
+ * unnamed parameter must be the URL of the repository, and the second must be
+ * the mountpoint.
+ *
+ * head_poll=N:  check for a new youngest revision every N seconds (default 10;
+ *               0 pins /HEAD at the revision that was youngest at mount time)
+ * stat_batch=N: list a directory instead of statting its children once N
+ *               stats under it have missed the cache (default 4; 0 disables)
+ * reject=P:     answer stats of names matching any of the colon-separated
+ *               globs in P with ENOENT, unless a cached listing of the parent
+ *               shows the name exists (may be given more than once)
+ * reject_probes: as reject, for the names in svnfs_probe_names
+ * pin=/R/P:     never evict cached files under path prefix P in revisions R
+ *               (N, N-M, N- or *); may be given more than once, and the
+ *               rules can be changed later through /.svnfs/rules
+ * quota=/R/P:S: let cached files under P in revisions R take up at most S
+ *               bytes (suffix K, M or G allowed); may be given more than once
+ * cache_size=N: keep at most N megabytes of file contents (default 1024)
+ * attr_size=N:  keep the attributes of at most N thousand nodes and the
+ *               listings of as many directories (default 256)
+ * scan_size=N:  keep files of N megabytes or more out of the cache the first
+ *               time they are opened, unless they are read out of order
+ *               (default 16; 0 disables)
+ * admit_lfu=N:  when the cache is full, admit a file only if it has been
+ *               opened more often lately than the file it would push out
+ *               (default 1; 0 for plain LRU)
+ * ra_retries=N: retry requests that fail because the connection broke up to
+ *               N times on a fresh session (default 5)
+ * ra_backoff=N: wait around N milliseconds before the first such retry,
+ *               doubling each time after (default 100)
+ * ra_threads=N: run repository requests on N threads, each with a session
+ *               of its own, however many threads libfuse uses (default 4)
+ * hedge=N:      duplicate STAT and DIR requests on a second session once
+ *               they take longer than the Nth percentile of recent ones
+ *               (default 95; 0 disables)
+ * hedge_budget=N: send at most N duplicates per 100 such requests
+ *               (default 5)
+ * timeout_meta=N: give up on LATEST, STAT and DIR requests after N seconds,
+ *               and on connections silent for that long (default 30)
+ * timeout_file=N: give up on fetching a file after N seconds (default 600)
+ * timeout_log=N: give up on fetching /HEAD changes after N seconds
+ *               (default 120)
+ * rate_limit=N: stream file contents at no more than N kilobytes per second
+ *               in total, demand fetches excepted (default 0, no limit)
+ * rate_background=N: stream background fetches at no more than N kilobytes
+ *               per second (default 0, no limit)
+ * background_uid=N: treat files opened by user N, such as a cache warmer,
+ *               as background fetches (default -1, none)
+ * cache_dir=D:  keep the content cache in directory D across mounts, rather
+ *               than in temporary files
+ * cache_io=M:   how to read and write cached files: "buffered" through the
+ *               page cache; "dontneed" (the default), dropping their pages
+ *               once written back and once read, since the kernel keeps its
+ *               own copy of what we return; or "direct", bypassing the page
+ *               cache with O_DIRECT where the filesystem allows
+ * arena=N:      keep content cache entries in a region of N megabytes
+ *               backed by huge pages, carved into slabs of fixed-size
+ *               objects (default 0, use the heap)
+ * arena_hugetlb: back the region with reserved huge pages rather than
+ *               transparent ones
+ * cache_root=D: create the temporary files, which have no names, under
+ *               directory D (default svnfs.UID in the temporary directory)
+ * scrub_interval=N: check a few of the files kept by earlier mounts every N
+ *               seconds, discarding any that are damaged (default 60; 0
+ *               disables)
+ * quiet:        print only errors and warnings, not the notes on cache
+ *               misses, evictions and the like
+ */
+#define SVNFS_OPT(t, o, v) { t, offsetof(struct svnfs_context_t, o), v }
+enum
+{
+	SVNFS_KEY_REJECT,
+	SVNFS_KEY_REJECT_PROBES,
+	SVNFS_KEY_PIN,
+	SVNFS_KEY_QUOTA
+};
+static struct fuse_opt svnfs_opts[] = 
+{
+	SVNFS_OPT("head_poll=%d", head_poll, 0),
+	SVNFS_OPT("stat_batch=%d", stat_batch, 0),
+	SVNFS_OPT("cache_size=%d", cache_size, 0),
+	SVNFS_OPT("attr_size=%d", attr_size, 0),
+	SVNFS_OPT("scan_size=%d", scan_size, 0),
+	SVNFS_OPT("admit_lfu=%d", admit_lfu, 0),
+	SVNFS_OPT("ra_retries=%d", ra_retries, 0),
+	SVNFS_OPT("ra_backoff=%d", ra_backoff, 0),
+	SVNFS_OPT("ra_threads=%d", ra_threads, 0),
+	SVNFS_OPT("hedge=%d", hedge, 0),
+	SVNFS_OPT("hedge_budget=%d", hedge_budget, 0),
+	SVNFS_OPT("timeout_meta=%d", timeout_meta, 0),
+	SVNFS_OPT("timeout_file=%d", timeout_file, 0),
+	SVNFS_OPT("timeout_log=%d", timeout_log, 0),
+	SVNFS_OPT("rate_limit=%d", rate_limit, 0),
+	SVNFS_OPT("rate_background=%d", rate_background, 0),
+	SVNFS_OPT("background_uid=%d", background_uid, 0),
+	SVNFS_OPT("cache_dir=%s", cache_dir, 0),
+	SVNFS_OPT("cache_root=%s", cache_root, 0),
+	SVNFS_OPT("arena=%d", arena, 0),
+	SVNFS_OPT("arena_hugetlb", arena_hugetlb, 1),
+	SVNFS_OPT("cache_io=buffered", cache_io, SVNFS_IO_BUFFERED),
+	SVNFS_OPT("cache_io=dontneed", cache_io, SVNFS_IO_DONTNEED),
+	SVNFS_OPT("cache_io=direct", cache_io, SVNFS_IO_DIRECT),
+	SVNFS_OPT("scrub_interval=%d", scrub_interval, 0),
+	SVNFS_OPT("quiet", quiet, 1),
+	FUSE_OPT_KEY("reject=", SVNFS_KEY_REJECT),
+	FUSE_OPT_KEY("reject_probes", SVNFS_KEY_REJECT_PROBES),
+	FUSE_OPT_KEY("pin=", SVNFS_KEY_PIN),
+	FUSE_OPT_KEY("quota=", SVNFS_KEY_QUOTA),
+	FUSE_OPT_END
+};
+
+#ifndef SVNFS_LIBRARY
+/*
+ * svnfs_fuse_operations
+ *
+ * The FUSE operations SVNFS implements.
+ */
+static struct fuse_operations svnfs_fuse_operations =
+{
+	.getattr  = svnfs_fuse_getattr,
+	.read     = svnfs_fuse_read,
+	.write    = svnfs_fuse_write,
+	.truncate = svnfs_fuse_truncate,
+	.open     = svnfs_fuse_open,
+	.readdir  = svnfs_fuse_readdir,
+	.flush    = svnfs_fuse_flush,
+	.release  = svnfs_fuse_release,
+	.statfs   = svnfs_fuse_statfs,
+	.init     = svnfs_fuse_init
+};
+#endif /* SVNFS_LIBRARY */
+
+/* }}} END STATIC GLOBALS */
+
+/* READDIR HELPERS {{{1 */
+
+/*
+ * svnfs_readdir_entry_t
+ *
+ * One entry of a directory listing copied out of the directory cache, so that
+ * it can be handed to the filler without holding svnfs_attr_lock.
+ */
+typedef struct svnfs_readdir_entry_t
+{
+	/* Name of the child */
+	const char *name;
+
+	/* Attributes of the child, or NULL if they are not known */
+	struct stat *stbuf;
+} svnfs_readdir_entry_t;
+
+/*
+ * svnfs_readdir_snapshot
+ *
+ * Copies the children of a listed directory into an array of
+ * svnfs_readdir_entry_t.  Children whose attributes are known get a filled
+ * stat struct.  libfuse only takes the file type and inode number from it,
+ * and the kernel still looks each child up with a getattr, but library
+ * callers get the whole of it.  Must be called with svnfs_attr_lock held.
+ *
+ * dir:        the directory cache entry, which must have been listed
+ * repos_path: session-relative path of the directory
+ * pool:       pool from which to allocate the array
+ * return:     the array of entries
+ */
+static apr_array_header_t *svnfs_readdir_snapshot(svnfs_dir_t *dir,
+                                                  const char *repos_path,
+                                                  apr_pool_t *pool)
+{
+	apr_array_header_t *entries;
+	svnfs_readdir_entry_t *entry;
+	apr_hash_index_t *iter;
+	const char *name;
+	svnfs_attr_t *attr;
+
+	if(strcmp(repos_path, "/") == 0)
+		repos_path = "";
+
+	entries = apr_array_make(pool, apr_hash_count(dir->children),
+	                         sizeof(svnfs_readdir_entry_t));
+
+	for(iter = apr_hash_first(pool, dir->children); iter;
+	    iter = apr_hash_next(iter))
+	{
+		apr_hash_this(iter, (const void **)(&name), NULL, (void **)(&attr));
+
+		entry = apr_array_push(entries);
+		entry->name  = apr_pstrdup(pool, name);
+		entry->stbuf = NULL;
+
+		if((attr->fields & SVNFS_ATTR_FIELDS) == SVNFS_ATTR_FIELDS)
+		{
+			entry->stbuf = apr_pcalloc(pool, sizeof(struct stat));
+			svnfs_attr_fill(entry->stbuf,
+			                apr_pstrcat(pool, repos_path, "/", name, NULL),
+			                attr);
+		}
+	}
+
+	return entries;
+}
+
+/*
+ * svnfs_readdir_baton_t
+ *
+ * Carries the FUSE filler through svnfs_lib_list().
+ */
+typedef struct svnfs_readdir_baton_t
+{
+	/* Buffer the filler adds entries to */
+	void *buf;
+
+	/* The filler libfuse gave us */
+	fuse_fill_dir_t filler;
+} svnfs_readdir_baton_t;
+
+/*
+ * svnfs_readdir_fill
+ *
+ * Hands one child found by svnfs_lib_list() to the FUSE filler.
+ *
+ * baton:  the svnfs_readdir_baton_t
+ * name:   name of the child
+ * stbuf:  attributes of the child, or NULL
+ * return: non-zero once the filler's buffer is full
+ */
+static int svnfs_readdir_fill(void *baton, const char *name,
+                              const struct stat *stbuf)
+{
+	svnfs_readdir_baton_t *readdir = baton;
+
+	return readdir->filler(readdir->buf, name, stbuf, 0);
+}
+
+/* END READDIR HELPERS }}}1 */
+
+/* LIBRARY OPERATIONS {{{1 */
+
+/*
+ * svnfs_lib_batch_t
+ *
+ * A batch of requests shared out among the threads serving it.
+ */
+typedef struct svnfs_lib_batch_t
+{
+	/* Serves request i of the batch */
+	void (*run)(void *reqs, int i);
+
+	/* The requests */
+	void *reqs;
+
+	/* Number of requests */
+	int count;
+
+	/* Index of the next request nobody has taken yet, and the number of
+	 * requests served */
+	int next;
+	int done;
+
+	/* Next batch on svnfs_lib_queue */
+	struct svnfs_lib_batch_t *link;
+} svnfs_lib_batch_t;
+
+/*
+ * svnfs_lib_take
+ *
+ * Takes the next request of a batch, taking the batch off svnfs_lib_queue
+ * once none are left.  Must be called with svnfs_lib_lock held.
+ *
+ * batch:  the batch, which must have a request left
+ * return: index of the request
+ */
+static int svnfs_lib_take(svnfs_lib_batch_t *batch)
+{
+	svnfs_lib_batch_t **p;
+
+	if(batch->next + 1 == batch->count)
+	{
+		for(p = &svnfs_lib_queue; *p != batch; p = &(*p)->link)
+			;
+		*p = batch->link;
+	}
+
+	return batch->next++;
+}
+
+/*
+ * svnfs_lib_serve
+ *
+ * Serves a request taken from a batch.  Must be called with svnfs_lib_lock
+ * held, which is let go meanwhile.
+ *
+ * batch: the batch
+ * i:     index of the request
+ */
+static void svnfs_lib_serve(svnfs_lib_batch_t *batch, int i)
+{
+	apr_thread_mutex_unlock(svnfs_lib_lock);
+		batch->run(batch->reqs, i);
+	apr_thread_mutex_lock(svnfs_lib_lock);
+
+	if(++batch->done == batch->count)
+		apr_thread_cond_broadcast(svnfs_lib_done);
+}
+
+/*
+ * svnfs_lib_worker
+ *
+ * A worker thread of the library: takes requests off the oldest batch
+ * queued until there are none left, then waits for another batch.  Requests
+ * answered from the caches take next to no time, so a thread that is
+ * waiting on the repository does not hold up those behind it for long.
+ *
+ * thread: the thread
+ * data:   unused
+ * return: never returns
+ */
+static void *svnfs_lib_worker(apr_thread_t *thread, void *data)
+{
+	apr_thread_mutex_lock(svnfs_lib_lock);
+	for(;;)
+	{
+		if(svnfs_lib_queue)
+			svnfs_lib_serve(svnfs_lib_queue, svnfs_lib_take(svnfs_lib_queue));
+		else
+			apr_thread_cond_wait(svnfs_lib_cond, svnfs_lib_lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * svnfs_lib_start
+ *
+ * Starts the library's worker threads, one fewer than there are repository
+ * connections to keep busy, since the caller of a batch serves it too.
+ */
+static void svnfs_lib_start(void)
+{
+	apr_thread_t *thread;
+
+	if(apr_thread_mutex_create(&svnfs_lib_lock, APR_THREAD_MUTEX_DEFAULT,
+	                           pool) != APR_SUCCESS
+	   || apr_thread_cond_create(&svnfs_lib_cond, pool) != APR_SUCCESS
+	   || apr_thread_cond_create(&svnfs_lib_done, pool) != APR_SUCCESS)
+	{
+		printf("Could not set up the batch queue\n");
+		return;
+	}
+
+	while(svnfs_lib_workers < svnfs_ctx.ra_threads - 1
+	      && apr_thread_create(&thread, NULL, svnfs_lib_worker, NULL, pool)
+	         == APR_SUCCESS)
+		svnfs_lib_workers++;
+
+	if(svnfs_lib_workers < svnfs_ctx.ra_threads - 1)
+		printf("Could only start %d of %d batch threads\n",
+		       svnfs_lib_workers, svnfs_ctx.ra_threads - 1);
+}
+
+/*
+ * svnfs_lib_batch
+ *
+ * Serves a batch of requests with the library's worker threads, the caller
+ * being one of them.  Every thread submits its own misses, so they reach the
+ * repository together.
+ *
+ * run:    serves request i of the batch
+ * reqs:   the requests
+ * count:  number of requests
+ */
+static void svnfs_lib_batch(void (*run)(void *reqs, int i), void *reqs,
+                            int count)
+{
+	svnfs_lib_batch_t batch;
+	svnfs_lib_batch_t **p;
+	int i;
+
+	/* Only the one request, or no threads to be had */
+	if(count <= 1 || svnfs_lib_workers == 0)
+	{
+		for(i = 0; i < count; i++)
+			run(reqs, i);
+		return;
+	}
+
+	batch.run   = run;
+	batch.reqs  = reqs;
+	batch.count = count;
+	batch.next  = 0;
+	batch.done  = 0;
+	batch.link  = NULL;
+
+	apr_thread_mutex_lock(svnfs_lib_lock);
+		for(p = &svnfs_lib_queue; *p; p = &(*p)->link)
+			;
+		*p = &batch;
+		apr_thread_cond_broadcast(svnfs_lib_cond);
+
+		while(batch.next < batch.count)
+			svnfs_lib_serve(&batch, svnfs_lib_take(&batch));
+
+		/* The workers still have the batch until they are done with it */
+		while(batch.done < batch.count)
+			apr_thread_cond_wait(svnfs_lib_done, svnfs_lib_lock);
+	apr_thread_mutex_unlock(svnfs_lib_lock);
+}
+
+/*
+ * svnfs_lib_stat_one
+ *
+ * Serves one request of svnfs_lib_stat_many().
+ *
+ * reqs:   the svnfs_lib_stat_t requests
+ * i:      index of the request to serve
+ */
+static void svnfs_lib_stat_one(void *reqs, int i)
+{
+	svnfs_lib_stat_t *req = (svnfs_lib_stat_t *)reqs + i;
+
+	req->result = svnfs_lib_stat(req->path, &req->stbuf);
+}
+
+/*
+ * svnfs_lib_list_one
+ *
+ * Serves one request of svnfs_lib_list_many().
+ *
+ * reqs:   the svnfs_lib_list_t requests
+ * i:      index of the request to serve
+ */
+static void svnfs_lib_list_one(void *reqs, int i)
+{
+	svnfs_lib_list_t *req = (svnfs_lib_list_t *)reqs + i;
+
+	req->result = svnfs_lib_list(req->path, req->filler, req->baton);
+}
+
+/*
+ * svnfs_lib_group_t
+ *
+ * The requests of svnfs_lib_read_many() for one file, which are served
+ * with one open.
+ */
+typedef struct svnfs_lib_group_t
+{
+	/* All the requests of the call */
+	svnfs_lib_read_t *reqs;
+
+	/* For each request of the call, the next for the same file, or -1 */
+	int *chain;
+
+	/* The first request for this file */
+	int first;
+} svnfs_lib_group_t;
+
+/*
+ * svnfs_lib_read_group
+ *
+ * Serves the requests of svnfs_lib_read_many() for one file.
+ *
+ * groups: the svnfs_lib_group_t groups
+ * g:      index of the group to serve
+ */
+static void svnfs_lib_read_group(void *groups, int g)
+{
+	svnfs_lib_group_t *group = (svnfs_lib_group_t *)groups + g;
+	svnfs_lib_read_t *req;
+	svnfs_cache_t *cache;
+	int ret;
+	int i;
+
+	ret = svnfs_lib_open(group->reqs[group->first].path, SVNFS_RA_DEMAND,
+	                     &cache, NULL);
+
+	for(i = group->first; i >= 0; i = group->chain[i])
+	{
+		req = &group->reqs[i];
+		if(ret == 0)
+			req->result = svnfs_lib_read(cache, req->buf, req->len,
+			                             req->offset);
+		else
+			req->result = ret;
+	}
+
+	if(ret == 0)
+		svnfs_lib_close(cache);
+}
+
+int svnfs_lib_stat(const char *path, struct stat *stbuf)
+{
+	svn_revnum_t rev;
+	const char *repos_path;
+	svnfs_attr_t attr;
+	apr_pool_t *subpool;
+	int ret;
+
+	memset(stbuf, 0, sizeof(struct stat));
+	if(strcmp(path, "/") == 0)
+	{
+		stbuf->st_mode = S_IFDIR | 0755;
+		stbuf->st_ino  = 1;
+		return 0;
+	}
+
+	if(strcmp(path, SVNFS_CTL_DIR) == 0)
+	{
+		stbuf->st_mode  = S_IFDIR | 0755;
+		stbuf->st_nlink = 2;
+		stbuf->st_ino   = svnfs_ino(path, SVN_INVALID_REVNUM);
+		return 0;
+	}
+
+	if(svnfs_ctl_path(path))
+	{
+		stbuf->st_mode  = S_IFREG | (strcmp(path, SVNFS_CTL_STATS) == 0
+		                             ? 0444 : 0644);
+		stbuf->st_nlink = 1;
+		stbuf->st_ino   = svnfs_ino(path, SVN_INVALID_REVNUM);
+		return 0;
+	}
+
+	/* Weed out probes for names that never exist before doing any work */
+	if(svnfs_reject_match(path) && !svnfs_reject_listed(path))
+		return -ENOENT;
+
+	if(!svnfs_path_split(path, &rev, &repos_path))
+		return -ENOENT;
+
+	if(apr_pool_create(&subpool, NULL) != APR_SUCCESS)
+		return -ENOMEM;
+	ret = svnfs_attr_get(repos_path, rev, &attr, subpool);
+	apr_pool_destroy(subpool);
+
+	if(ret != 0)
+		return ret;
+
+	if(attr.kind == svn_node_none) /* Path does not exist in this revision */
+		return -ENOENT;
+
+	svnfs_attr_fill(stbuf, repos_path, &attr);
+
+	return 0;
+}
+
+int svnfs_lib_list(const char *path, svnfs_lib_filler_t filler, void *baton)
+{
+	svn_error_t *err;
+	svn_revnum_t rev;
+	const char *repos_path;
+
+	apr_pool_t *subpool;
+	svnfs_dir_t *dir;
+	apr_array_header_t *entries;
+	svnfs_readdir_entry_t *entry;
+	svnfs_ra_op_t op;
+	int ret;
+	int i;
+
+	memset(&op, 0, sizeof(op));
+
+	if(apr_pool_create(&subpool, NULL) != APR_SUCCESS)
+		return -ENOMEM;
+
+	if(strcmp(path, "/") == 0)
+	{
+		op.kind = SVNFS_RA_LATEST;
+		err = svnfs_ra_execute(&op, subpool);
+		if(err == SVN_NO_ERROR)
+		{
+			rev = op.latest;
+		}
+		else
+		{
+			/* The revisions the /HEAD tracker knows of are good enough */
+			svn_handle_error2(err, stderr, FALSE, "svnfs: ");
+			svn_error_clear(err);
+			apr_thread_mutex_lock(svnfs_head_lock);
+				rev = svnfs_head_rev;
+			apr_thread_mutex_unlock(svnfs_head_lock);
+		}
+
+		if(filler(baton, SVNFS_CTL_DIR + 1, NULL) == 0
+		   && filler(baton, "HEAD", NULL) == 0)
+			for(; rev > 0; rev--)
+				if(filler(baton, apr_itoa(subpool, rev), NULL) != 0)
+					break;
+
+		apr_pool_destroy(subpool);
+		return 0;
+	}
+
+	if(strcmp(path, SVNFS_CTL_DIR) == 0)
+	{
+		if(filler(baton, SVNFS_CTL_RULES + strlen(SVNFS_CTL_DIR) + 1,
+		          NULL) == 0
+		   && filler(baton, SVNFS_CTL_QUERY + strlen(SVNFS_CTL_DIR) + 1,
+		             NULL) == 0)
+			filler(baton, SVNFS_CTL_STATS + strlen(SVNFS_CTL_DIR) + 1, NULL);
+		apr_pool_destroy(subpool);
+		return 0;
+	}
+
+	if(!svnfs_path_split(path, &rev, &repos_path))
+	{
+		apr_pool_destroy(subpool);
+		return -ENOENT; /* Invalid path */
+	}
+
+	entries = NULL;
+
+	/* A directory never changes once listed, so use any listing we have */
+	apr_thread_mutex_lock(svnfs_attr_lock);
+		dir = svnfs_dir_get(repos_path, rev);
+		if(dir->children)
+			entries = svnfs_readdir_snapshot(dir, repos_path, subpool);
+		else
+			dir->attr_rev->busy++;
+	apr_thread_mutex_unlock(svnfs_attr_lock);
+
+	if(!entries)
+	{
+		/* Only the names are needed here, and anything more costs the
+		 * server work for each entry */
+		svnfs_note("Attempting to get '%s@@%ld'...\n", repos_path, rev);
+		op.kind   = SVNFS_RA_DIR;
+		op.path   = repos_path;
+		op.rev    = rev;
+		op.fields = 0;
+		err = svnfs_ra_execute(&op, subpool);
+
+		/* Keep the listing, so that stats of names which are not in it can
+		 * be answered without asking the server */
+		apr_thread_mutex_lock(svnfs_attr_lock);
+			dir->attr_rev->busy--;
+			if(err == SVN_NO_ERROR)
+			{
+				if(!dir->children)
+					svnfs_dir_store(dir, repos_path, op.dirents, 0, subpool);
+				entries = svnfs_readdir_snapshot(dir, repos_path, subpool);
+			}
+		apr_thread_mutex_unlock(svnfs_attr_lock);
+
+		if(err != SVN_NO_ERROR)
+		{
+			apr_pool_destroy(subpool);
+			svn_handle_error2(err, stderr, FALSE, "svnfs: ");
+			ret = svnfs_ra_errno(err, -EPIPE);
+			svn_error_clear(err);
+			return ret;
+		}
+	}
+
+	for(i = 0; i < entries->nelts; i++)
+	{
+		entry = &APR_ARRAY_IDX(entries, i, svnfs_readdir_entry_t);
+		if(filler(baton, entry->name, entry->stbuf) != 0)
+			break;
+	}
+
+	apr_pool_destroy(subpool);
+
+	return 0;
+}
+
+void svnfs_lib_stat_many(svnfs_lib_stat_t *reqs, int count)
+{
+	svnfs_lib_batch(svnfs_lib_stat_one, reqs, count);
+}
+
+void svnfs_lib_list_many(svnfs_lib_list_t *reqs, int count)
+{
+	svnfs_lib_batch(svnfs_lib_list_one, reqs, count);
+}
+
+void svnfs_lib_read_many(svnfs_lib_read_t *reqs, int count)
+{
+	svnfs_lib_group_t *groups;
+	svnfs_lib_group_t *group;
+	apr_hash_t *seen;
+	apr_pool_t *subpool;
+	int *last;
+	int *chain;
+	int ngroups;
+	int i;
+
+	if(apr_pool_create(&subpool, NULL) != APR_SUCCESS)
+	{
+		for(i = 0; i < count; i++)
+			reqs[i].result = -ENOMEM;
+		return;
+	}
+
+	/* Requests for the same file are chained in the order given, and the
+	 * chain is served by one thread with one open */
+	groups = apr_palloc(subpool, count * sizeof(*groups));
+	chain  = apr_palloc(subpool, count * sizeof(*chain));
+	seen   = apr_hash_make(subpool);
+	ngroups = 0;
+	for(i = 0; i < count; i++)
+	{
+		chain[i] = -1;
+		last = apr_hash_get(seen, reqs[i].path, APR_HASH_KEY_STRING);
+		if(last)
+		{
+			chain[*last] = i;
+			*last = i;
+			continue;
+		}
+
+		group = &groups[ngroups++];
+		group->reqs  = reqs;
+		group->chain = chain;
+		group->first = i;
+		last = apr_palloc(subpool, sizeof(*last));
+		*last = i;
+		apr_hash_set(seen, reqs[i].path, APR_HASH_KEY_STRING, last);
+	}
+
+	svnfs_lib_batch(svnfs_lib_read_group, groups, ngroups);
+	apr_pool_destroy(subpool);
+}
+
+int svnfs_lib_open(const char *path, svnfs_ra_class_t priority,
+                   svnfs_cache_t **cache, int *keep_cache)
+{
+	char *cache_key;
+	const char *repos_path;
+	svn_revnum_t rev;
+	apr_pool_t *subpool;
+	int ret;
+
+	if(!svnfs_path_split(path, &rev, &repos_path))
+	{
+		printf("Attempted to open malformed path \"%s\"\n", path);
+		return -ENOENT;
+	}
+
+	if(apr_pool_create(&subpool, NULL) != APR_SUCCESS)
+		return -ENOMEM;
+
+	/* The cache is keyed on the concrete revision rather than on path, so
+	 * that /HEAD/foo shares an entry with /N/foo while HEAD is N, and is not
+	 * served stale once HEAD moves on. */
+	cache_key = apr_psprintf(subpool, "/%ld%s", rev, repos_path);
+
+	/* Verify that we have a cache of the data */
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		svnfs_cache_sketch_add(cache_key);
+		*cache = apr_hash_get(svnfs_cache_files, cache_key,
+		                      APR_HASH_KEY_STRING);
+		if(*cache)
+		{
+			(*cache)->refs++;
+			svnfs_cache_touch(*cache);
+			svnfs_cache_hits++;
+		}
+		else
+		{
+			svnfs_cache_misses++;
+		}
+
+		if((svnfs_cache_hits + svnfs_cache_misses) % 1024 == 0)
+			svnfs_note("Content cache: %u hits, %u misses, %u turned away\n",
+			           svnfs_cache_hits, svnfs_cache_misses,
+			           svnfs_cache_rejects);
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	if(*cache)
+	{
+		ret = svnfs_cache_reopen(*cache, subpool);
+		if(ret != 0)
+		{
+			svnfs_lib_close(*cache);
+			apr_pool_destroy(subpool);
+			return ret;
+		}
+	}
+	else
+	{
+		/* CACHE MISS */
+		svnfs_note("Cache miss on path \"%s\"\n", cache_key);
+
+		ret = svnfs_cache_fill(cache_key, repos_path, rev, priority, cache,
+		                       subpool);
+		if(ret != 0)
+		{
+			apr_pool_destroy(subpool);
+			return ret;
+		}
+	}
+
+	apr_pool_destroy(subpool);
+
+	/* A numbered revision never changes, so anything read from it before is
+	 * still good.  Under /HEAD it is only if no commit has touched the file
+	 * since then. */
+	if(keep_cache)
+	{
+		if(svnfs_path_is_head(path))
+			*keep_cache = svnfs_head_keep_cache(repos_path, rev);
+		else
+			*keep_cache = 1;
+	}
+
+	return 0;
+}
+
+int svnfs_lib_read(svnfs_cache_t *cache, char *buf, size_t len, off_t offset)
+{
+	int bytes_read;
+
+	/* The contents may still be on their way */
+	if(cache->fill)
+	{
+		bytes_read = svnfs_ra_await(cache->fill, offset + len < cache->size
+		                                         ? offset + len : cache->size);
+		if(bytes_read < 0)
+			return bytes_read;
+	}
+
+	bytes_read = svnfs_cache_read(cache, buf, len, offset);
+	if(bytes_read < 0)
+	{
+		printf("Failed to read from cache file\n");
+		return bytes_read;
+	}
+
+	/* Readahead requests may overtake one another, so only a jump of more
+	 * than a few blocks counts as reading out of order */
+	if(cache->probation)
+	{
+		apr_thread_mutex_lock(svnfs_cache_lock);
+			if(offset > cache->next_offset + 8 * SVNFS_BLKSIZE
+			   || offset + 8 * SVNFS_BLKSIZE < cache->next_offset)
+				cache->random = 1;
+			if(offset + (apr_off_t)bytes_read > cache->next_offset)
+				cache->next_offset = offset + bytes_read;
+		apr_thread_mutex_unlock(svnfs_cache_lock);
+	}
+
+	return bytes_read;
+}
+
+void svnfs_lib_close(svnfs_cache_t *cache)
+{
+	int renaming;
+
+	/* The entry may be gone once the lock is let go, unless it is held for
+	 * renaming */
+	renaming = 0;
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		cache->refs--;
+		if(cache->probation && cache->refs == 0 && svnfs_cache_settle(cache))
+			renaming = cache->renaming;
+		svnfs_cache_evict(); /* This may have been all that stood in the way */
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	if(renaming)
+		svnfs_store_rename(cache);
+}
+
+/* END LIBRARY OPERATIONS }}}1 */
+
+/* FUSE OPERATIONS {{{1 */
+
+int svnfs_fuse_getattr(const char *path, struct stat *stbuf)
+{
+	return svnfs_lib_stat(path, stbuf);
+}
+
+int svnfs_fuse_open(const char *path, struct fuse_file_info *fi)
+{
+	svnfs_cache_t *cache;
+	svnfs_ra_class_t priority;
+	int keep_cache;
+	int ret;
+
+	if(svnfs_ctl_path(path))
+		return svnfs_ctl_open(path, fi);
+
+	if((fi->flags & O_ACCMODE) != O_RDONLY)
+		return -EROFS;
+
+	/* Opens by a cache warmer must not crowd out anyone else */
+	priority = SVNFS_RA_DEMAND;
+	if(svnfs_ctx.background_uid >= 0
+	   && fuse_get_context()->uid == (uid_t)svnfs_ctx.background_uid)
+		priority = SVNFS_RA_BACKGROUND;
+
+	ret = svnfs_lib_open(path, priority, &cache, &keep_cache);
+	if(ret != 0)
+		return ret;
+
+	fi->fh = (uint64_t)(uintptr_t)cache;
+	fi->keep_cache = keep_cache;
+
+	return 0;
+}
+
+int svnfs_fuse_read(const char *path, char *buf, size_t len, off_t offset,
+                    struct fuse_file_info *fi)
+{
+	svnfs_cache_t *cache;
+
+	if(svnfs_ctl_path(path))
+		return svnfs_ctl_read(buf, len, offset, fi);
+
+	/* Use the entry found by open(), since under /HEAD the path may have
+	 * come to name a different revision since then */
+	cache = (svnfs_cache_t *)(uintptr_t)fi->fh;
+	if(!cache)
+	{
+		printf("Could not find cache for \"%s\"\n", path);
+		return -EIO;
+	}
+
+	return svnfs_lib_read(cache, buf, len, offset);
+}
+
+int svnfs_fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                       off_t offset, struct fuse_file_info *fi)
+{
+	svnfs_readdir_baton_t baton;
+
+	baton.buf    = buf;
+	baton.filler = filler;
+
+	filler(buf, ".", NULL, 0);
+	filler(buf, "..", NULL, 0);
+
+	return svnfs_lib_list(path, svnfs_readdir_fill, &baton);
+}
+
+int svnfs_fuse_write(const char *path, const char *buf, size_t len,
+                     off_t offset, struct fuse_file_info *fi)
+{
+	if(!svnfs_ctl_path(path))
+		return -EBADF;
+
+	return svnfs_ctl_write(buf, len, offset, fi);
+}
+
+int svnfs_fuse_truncate(const char *path, off_t size)
+{
+	if(!svnfs_ctl_path(path))
+		return -EROFS;
+
+	return 0;
+}
+
+int svnfs_fuse_flush(const char *path, struct fuse_file_info *fi)
+{
+	if(!svnfs_ctl_path(path))
+		return 0;
+
+	return svnfs_ctl_flush(fi);
+}
+
+int svnfs_fuse_release(const char *path, struct fuse_file_info *fi)
+{
+	svnfs_cache_t *cache;
+
+	if(svnfs_ctl_path(path))
+	{
+		svnfs_ctl_release(fi);
+		return 0;
+	}
+
+	cache = (svnfs_cache_t *)(uintptr_t)fi->fh;
+	if(cache)
+		svnfs_lib_close(cache);
+
+	return 0;
+}
+
+int svnfs_fuse_statfs(const char *path, struct statvfs *stbuf)
+{
+	apr_off_t capacity;
+	apr_off_t used;
+	unsigned int files;
+
+	capacity = (apr_off_t)svnfs_ctx.cache_size * 1024 * 1024;
+
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		used  = svnfs_cache_used;
+		files = apr_hash_count(svnfs_cache_files);
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	/* Open files may hold the cache over its capacity for a while */
+	if(used > capacity)
+		used = capacity;
+
+	memset(stbuf, 0, sizeof(struct statvfs));
+	stbuf->f_bsize   = SVNFS_BLKSIZE;
+	stbuf->f_frsize  = SVNFS_BLKSIZE;
+	stbuf->f_blocks  = capacity / SVNFS_BLKSIZE;
+	stbuf->f_bfree   = (capacity - used) / SVNFS_BLKSIZE;
+	stbuf->f_bavail  = stbuf->f_bfree;
+	stbuf->f_files   = files;
+	stbuf->f_namemax = 255;
+
+	return 0;
+}
+
+/* }}}1 END FUSE OPERATIONS */
+
+/* HELPER OPERATIONS {{{1 */
+
+void svnfs_note(const char *format, ...)
+{
+	va_list args;
+
+	if(svnfs_ctx.quiet)
+		return;
+
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+}
+
+int svnfs_path_parse(const char *path, svnfs_path_t *view)
+{
+	const char *p;
+	svn_revnum_t rev;
+	unsigned int digit;
+
+	if(path[0] != '/')
+		return 0;
+
+	/* /HEAD follows the youngest revision */
+	if(strncmp(path + 1, "HEAD", 4) == 0 && (path[5] == '/' || path[5] == '\0'))
+	{
+		view->head = 1;
+		view->rev  = SVN_INVALID_REVNUM;
+		view->rest = path + 5;
+		return 1;
+	}
+
+	/* Anything else is a revision number, spelt the one way readdir spells
+	 * it: no sign, no leading zeros, and small enough to be one */
+	p = path + 1;
+	rev = 0;
+	if(*p == '0')
+	{
+		p++;
+	}
+	else
+	{
+		for(; (digit = (unsigned char)*p - '0') < 10; p++)
+		{
+			if(rev > (LONG_MAX - (svn_revnum_t)digit) / 10)
+				return 0;
+			rev = rev * 10 + digit;
+		}
+		if(p == path + 1)
+			return 0;
+	}
+
+	if(*p != '/' && *p != '\0')
+		return 0;
+
+	view->head = 0;
+	view->rev  = rev;
+	view->rest = p;
+	return 1;
+}
+
+int svnfs_path_split(const char *path, svn_revnum_t *rev,
+                     const char **repos_path)
+{
+	svnfs_path_t view;
+
+	if(!svnfs_path_parse(path, &view))
+		return 0;
+
+	*rev = view.rev;
+	if(view.head)
+	{
+		apr_thread_mutex_lock(svnfs_head_lock);
+			*rev = svnfs_head_rev;
+		apr_thread_mutex_unlock(svnfs_head_lock);
+	}
+
+	/* Path specified revision root */
+	*repos_path = *view.rest ? view.rest : "/";
+
+	return 1;
+}
+
+ino_t svnfs_ino(const char *repos_path, svn_revnum_t created_rev)
+{
+	apr_uint64_t hash;
+	const char *cur;
+	int i;
+
+	/* 64-bit FNV-1a over the repository-root-relative path, followed by the
+	 * revision.  The prefix is included so that mounting a subdirectory of
+	 * the repository gives the same numbers as mounting its root. */
+	hash = 14695981039346656037ULL;
+	for(cur = svnfs_repos_prefix; *cur; cur++)
+		hash = (hash ^ (unsigned char)*cur) * 1099511628211ULL;
+	if(!(svnfs_repos_prefix[0] && strcmp(repos_path, "/") == 0))
+		for(cur = repos_path; *cur; cur++)
+			hash = (hash ^ (unsigned char)*cur) * 1099511628211ULL;
+	for(i = 0; i < (int)sizeof(created_rev); i++)
+		hash = (hash ^ ((apr_uint64_t)created_rev >> (i * 8) & 0xff))
+		       * 1099511628211ULL;
+
+	/* 0 is not a valid inode number, and 1 belongs to the mount root */
+	if(hash <= 1)
+		hash += 2;
+
+	return (ino_t)hash;
+}
+
+int svnfs_path_is_head(const char *path)
+{
+	return strncmp(path, "/HEAD", 5) == 0
+	       && (path[5] == '/' || path[5] == '\0');
+}
+
+void svnfs_reject_add(const char *patterns)
+{
+	char *list;
+	char *pattern;
+	char *last;
+
+	list = apr_pstrdup(pool, patterns);
+	for(pattern = apr_strtok(list, ":", &last); pattern;
+	    pattern = apr_strtok(NULL, ":", &last))
+	{
+		if(apr_fnmatch_test(pattern))
+			*(const char **)apr_array_push(svnfs_reject_globs) = pattern;
+		else
+			apr_hash_set(svnfs_reject_names, pattern, APR_HASH_KEY_STRING,
+			             pattern);
+	}
+}
+
+int svnfs_reject_match(const char *path)
+{
+	const char *name;
+	int i;
+
+	name = strrchr(path, '/') + 1;
+
+	if(apr_hash_get(svnfs_reject_names, name, APR_HASH_KEY_STRING))
+		return 1;
+
+	for(i = 0; i < svnfs_reject_globs->nelts; i++)
+		if(apr_fnmatch(APR_ARRAY_IDX(svnfs_reject_globs, i, const char *),
+		               name, 0) == APR_SUCCESS)
+			return 1;
+
+	return 0;
+}
+
+int svnfs_reject_listed(const char *path)
+{
+	svn_revnum_t rev;
+	const char *repos_path;
+	const char *name;
+	apr_ssize_t parent_len;
+	svnfs_attr_rev_t *attr_rev;
+	svnfs_dir_t *dir;
+	int listed;
+
+	if(!svnfs_path_split(path, &rev, &repos_path))
+		return 0;
+
+	name = strrchr(repos_path, '/') + 1;
+	if(!*name) /* Revision root */
+		return 1;
+
+	/* The parent is the start of the path, or "/" for the revision root */
+	parent_len = name - repos_path == 1 ? 1 : name - repos_path - 1;
+
+	apr_thread_mutex_lock(svnfs_attr_lock);
+		attr_rev = apr_hash_get(svnfs_attr_revs, &rev, sizeof(rev));
+		dir = attr_rev ? apr_hash_get(attr_rev->dirs, repos_path, parent_len)
+		               : NULL;
+		listed = dir && dir->children
+		         && apr_hash_get(dir->children, name, APR_HASH_KEY_STRING);
+	apr_thread_mutex_unlock(svnfs_attr_lock);
+
+	return listed;
+}
+
+/* END HELPER OPERATIONS }}}1 */
+
+/* MEMORY ARENA {{{1 */
+
+/*
+ * svnfs_arena_class
+ *
+ * Finds the size class an allocation falls in.
+ *
+ * size:   size of the allocation
+ * return: the class, or SVNFS_ARENA_CLASSES if it is too big for any
+ */
+static int svnfs_arena_class(apr_size_t size)
+{
+	int class;
+
+	for(class = 0; class < SVNFS_ARENA_CLASSES; class++)
+		if(size <= (apr_size_t)SVNFS_ARENA_MIN << class)
+			break;
+
+	return class;
+}
+
+/*
+ * svnfs_arena_carve
+ *
+ * Takes a fresh slab from the region for a size class and puts its objects
+ * on the class's free list.  Must be called with svnfs_arena_lock held.
+ *
+ * class:  the size class
+ * return: nonzero on success, zero if the region is used up
+ */
+static int svnfs_arena_carve(int class)
+{
+	apr_size_t object;
+	apr_size_t offset;
+	char *slab;
+
+	if(svnfs_arena_next + SVNFS_ARENA_SLAB > svnfs_arena_size)
+		return 0;
+
+	slab = svnfs_arena_base + svnfs_arena_next;
+	svnfs_arena_classes[svnfs_arena_next / SVNFS_ARENA_SLAB] = class;
+	svnfs_arena_next += SVNFS_ARENA_SLAB;
+
+	object = (apr_size_t)SVNFS_ARENA_MIN << class;
+	for(offset = 0; offset + object <= SVNFS_ARENA_SLAB; offset += object)
+	{
+		*(void **)(slab + offset) = svnfs_arena_free[class];
+		svnfs_arena_free[class] = slab + offset;
+	}
+
+	return 1;
+}
+
+int svnfs_arena_init(apr_size_t size, int hugetlb, apr_pool_t *pool)
+{
+	apr_size_t huge;
+	char *base;
+
+	/* Whole huge pages, and whole slabs within them */
+	huge = 2 * 1024 * 1024;
+	size = (size + huge - 1) & ~(huge - 1);
+
+	base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if(hugetlb)
+	{
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(base == MAP_FAILED)
+			printf("No huge pages reserved; trying transparent ones\n");
+	}
+#endif
+
+	/* Transparent huge pages only back aligned regions, so map enough to
+	 * align within */
+	if(base == MAP_FAILED)
+	{
+		base = mmap(NULL, size + huge, PROT_READ | PROT_WRITE,
+		            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(base == MAP_FAILED)
+		{
+			printf("Could not reserve %lu bytes for the memory arena\n",
+			       (unsigned long)size);
+			return -ENOMEM;
+		}
+		base = (char *)(((uintptr_t)base + huge - 1) & ~(uintptr_t)(huge - 1));
+#ifdef MADV_HUGEPAGE
+		madvise(base, size, MADV_HUGEPAGE);
+#endif
+	}
+
+	svnfs_arena_classes = apr_pcalloc(pool, size / SVNFS_ARENA_SLAB);
+	if(apr_thread_mutex_create(&svnfs_arena_lock, APR_THREAD_MUTEX_DEFAULT,
+	                           pool) != APR_SUCCESS)
+		return -ENOMEM;
+
+	svnfs_arena_next = 0;
+	svnfs_arena_size = size;
+	svnfs_arena_base = base;
+
+	return 0;
+}
+
+void *svnfs_arena_alloc(apr_size_t size)
+{
+	void *p;
+	int class;
+
+	class = svnfs_arena_class(size);
+	if(!svnfs_arena_base || class == SVNFS_ARENA_CLASSES)
+		return malloc(size);
+
+	apr_thread_mutex_lock(svnfs_arena_lock);
+		p = svnfs_arena_free[class];
+		if(!p && svnfs_arena_carve(class))
+			p = svnfs_arena_free[class];
+		if(p)
+			svnfs_arena_free[class] = *(void **)p;
+	apr_thread_mutex_unlock(svnfs_arena_lock);
+
+	/* Once the region is full, the overflow at least still works */
+	return p ? p : malloc(size);
+}
+
+char *svnfs_arena_strdup(const char *s)
+{
+	char *p;
+
+	p = svnfs_arena_alloc(strlen(s) + 1);
+	if(p)
+		strcpy(p, s);
+
+	return p;
+}
+
+void svnfs_arena_release(void *p)
+{
+	int class;
+
+	if(!svnfs_arena_base || (char *)p < svnfs_arena_base
+	   || (char *)p >= svnfs_arena_base + svnfs_arena_size)
+	{
+		free(p);
+		return;
+	}
+
+	class = svnfs_arena_classes[((char *)p - svnfs_arena_base)
+	                            / SVNFS_ARENA_SLAB];
+
+	apr_thread_mutex_lock(svnfs_arena_lock);
+		*(void **)p = svnfs_arena_free[class];
+		svnfs_arena_free[class] = p;
+	apr_thread_mutex_unlock(svnfs_arena_lock);
+}
+
+/* END MEMORY ARENA }}}1 */
+
+/* CONTENT CACHE {{{1 */
+
+/*
+ * svnfs_cache_mktemp
+ *
+ * Creates an anonymous file under svnfs_ctx.cache_root to fetch a file
+ * into.  It has no name, so it goes away by itself when closed, even if we
+ * are killed.
+ *
+ * key:     key of the file in svnfs_cache_files
+ * fd:      pointer to receive a descriptor of the file, open for reading and
+ *          writing
+ * subpool: pool for temporary allocations
+ * return:  0 on success, or -errno on error
+ */
+static int svnfs_cache_mktemp(const char *key, int *fd, apr_pool_t *subpool)
+{
+	char *dir;
+	char *path;
+
+	/* Spread the files out as the persistent store does, so that no one
+	 * directory has to take every name created where O_TMPFILE is
+	 * unsupported */
+	dir = apr_psprintf(subpool, "%s/%02x", svnfs_ctx.cache_root,
+	                   (unsigned int)(svnfs_store_hash(key) & 0xff));
+	apr_dir_make(dir, APR_UREAD | APR_UWRITE | APR_UEXECUTE, subpool);
+
+#ifdef O_TMPFILE
+	*fd = open(dir, O_TMPFILE | O_RDWR, 0600);
+	if(*fd >= 0)
+		return 0;
+#endif
+
+	/* Otherwise the name only lasts until the next line */
+	path = apr_psprintf(subpool, "%s/svnfs.XXXXXX", dir);
+	*fd = mkstemp(path);
+	if(*fd < 0)
+	{
+		printf("Could not create temp file in \"%s\"\n", dir);
+		return -EIO;
+	}
+	unlink(path);
+
+	return 0;
+}
+
+/*
+ * svnfs_cache_fetch
+ *
+ * Does the work of svnfs_cache_fill: fetches a file from the repository into
+ * a new temporary file, and makes a content cache entry for it which has not
+ * yet been added to svnfs_cache_files.
+ *
+ * key:        key of the entry in svnfs_cache_files
+ * repos_path: session-relative path of the file
+ * rev:        revision of the file
+ * priority:   priority class of the fetch
+ * urgent:     flag which lifts throttling of the fetch once set
+ * hash:       hash of the file in the persistent store, or 0 if there is
+ *             none
+ * cache:      pointer to receive the entry
+ * subpool:    pool for temporary allocations
+ * return:     0 on success, or -errno on error
+ */
+static int svnfs_cache_fetch(const char *key, const char *repos_path,
+                             svn_revnum_t rev, svnfs_ra_class_t priority,
+                             volatile apr_uint32_t *urgent, apr_uint64_t hash,
+                             svnfs_cache_t **cache, apr_pool_t *subpool)
+{
+	char *cache_path;
+	apr_file_t *cache_file;
+	apr_os_file_t fd;
+	apr_finfo_t finfo;
+	svnfs_ra_op_t op;
+	svn_error_t *err;
+	int ret;
+
+	cache_path = "";
+	if(hash)
+		ret = svnfs_store_mktemp(hash, &fd, &cache_path, subpool);
+	else
+		ret = svnfs_cache_mktemp(key, &fd, subpool);
+	if(ret != 0)
+		return ret;
+
+	/* The descriptor stays with the entry, so the APR file wrapped around it
+	 * must not close it */
+	if(apr_os_file_put(&cache_file, &fd, APR_READ | APR_WRITE, subpool)
+	   != APR_SUCCESS)
+	{
+		close(fd);
+		if(*cache_path)
+			apr_file_remove(cache_path, subpool);
+		return -ENOMEM;
+	}
+
+	memset(&op, 0, sizeof(op));
+	op.kind     = SVNFS_RA_FILE;
+	op.priority = priority;
+	op.urgent   = urgent;
+	op.path     = repos_path;
+	op.rev      = rev;
+	op.file     = cache_file;
+	op.hashed   = hash != 0;
+	err = svnfs_ra_execute(&op, subpool);
+	if(err != SVN_NO_ERROR)
+	{
+		printf("Could not get %s@%ld\n", repos_path, rev);
+		svn_handle_error2(err, stderr, FALSE, "svnfs: ");
+		ret = svnfs_ra_errno(err, -ENOENT);
+		svn_error_clear(err);
+		close(fd);
+		if(*cache_path)
+			apr_file_remove(cache_path, subpool);
+		return ret;
+	}
+
+	if(apr_file_info_get(&finfo, APR_FINFO_SIZE, cache_file) != APR_SUCCESS)
+	{
+		printf("Could not size temp file\n");
+		close(fd);
+		if(*cache_path)
+			apr_file_remove(cache_path, subpool);
+		return -EIO;
+	}
+
+	/* The checksum tells a later mount that the file is whole; it was taken
+	 * of what was written, every write having been checked */
+	*cache = svnfs_cache_new(key, rev, cache_path, fd, finfo.size, hash,
+	                         hash ? op.checksum : 0);
+	if(!*cache)
+	{
+		close(fd);
+		if(*cache_path)
+			apr_file_remove(cache_path, subpool);
+		return -ENOMEM;
+	}
+	svnfs_cache_unbuffer(*cache);
+
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		svnfs_cache_fetched += finfo.size;
+		svnfs_cache_fetches++;
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	return 0;
+}
+
+/*
+ * svnfs_cache_stream
+ *
+ * Does the work of svnfs_cache_fill for a demand request on probation:
+ * starts fetching a file into a new temporary file, and makes a content
+ * cache entry for it which is read as the contents arrive.  Entries on
+ * probation mostly go once read, so this one is not kept by the persistent
+ * store.
+ *
+ * key:        key of the entry in svnfs_cache_files
+ * repos_path: session-relative path of the file
+ * rev:        revision of the file
+ * size:       size of the file
+ * cache:      pointer to receive the entry
+ * subpool:    pool for temporary allocations
+ * return:     0 on success, or -errno on error
+ */
+static int svnfs_cache_stream(const char *key, const char *repos_path,
+                              svn_revnum_t rev, apr_off_t size,
+                              svnfs_cache_t **cache, apr_pool_t *subpool)
+{
+	apr_file_t *cache_file;
+	apr_os_file_t fd;
+	svnfs_ra_op_t op;
+	svnfs_ra_job_t *job;
+	int ret;
+
+	ret = svnfs_cache_mktemp(key, &fd, subpool);
+	if(ret != 0)
+		return ret;
+
+	if(apr_os_file_put(&cache_file, &fd, APR_READ | APR_WRITE, subpool)
+	   != APR_SUCCESS)
+	{
+		close(fd);
+		return -ENOMEM;
+	}
+
+	memset(&op, 0, sizeof(op));
+	op.kind     = SVNFS_RA_FILE;
+	op.priority = SVNFS_RA_DEMAND;
+	op.path     = repos_path;
+	op.rev      = rev;
+	op.file     = cache_file;
+	op.streamed = 1;
+	job = svnfs_ra_begin(&op);
+	if(!job)
+	{
+		close(fd);
+		return -ENOMEM;
+	}
+
+	*cache = svnfs_cache_new(key, rev, "", fd, size, 0, 0);
+	if(!*cache)
+	{
+		svnfs_ra_end(job);
+		close(fd);
+		return -ENOMEM;
+	}
+	(*cache)->fill = job;
+
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		svnfs_cache_fetched += size;
+		svnfs_cache_fetches++;
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	return 0;
+}
+
+svnfs_cache_t *svnfs_cache_new(const char *key, svn_revnum_t rev,
+                               const char *cache_path, int fd,
+                               apr_off_t size, apr_uint64_t hash,
+                               apr_uint64_t checksum)
+{
+	svnfs_cache_t *cache;
+
+	/* Entries are freed one at a time on eviction, which a pool cannot do,
+	 * so they come from the arena along with their strings */
+	cache = svnfs_arena_alloc(sizeof(svnfs_cache_t) + strlen(key) + 1
+	                          + strlen(cache_path) + 1);
+	if(!cache)
+		return NULL;
+
+	cache->rev         = rev;
+	cache->key         = (char *)(cache + 1);
+	cache->cache_path  = cache->key + strlen(key) + 1;
+	cache->fd          = fd;
+	cache->direct      = 0;
+	cache->size        = size;
+	cache->hash        = hash;
+	cache->checksum    = checksum;
+	cache->refs        = 1;
+	cache->rule        = NULL;
+	cache->probation   = 0;
+	cache->next_offset = 0;
+	cache->random      = 0;
+	cache->fill        = NULL;
+	cache->renaming    = 0;
+	cache->prev        = NULL;
+	cache->next        = NULL;
+	strcpy(cache->key, key);
+	strcpy(cache->cache_path, cache_path);
+	apr_atomic_inc32(&svnfs_cache_fds);
+
+	return cache;
+}
+
+/*
+ * svnfs_cache_pread
+ *
+ * Reads from a descriptor at an offset until the buffer is full or the end
+ * of the file is reached.
+ *
+ * fd:     the descriptor
+ * buf:    buffer to read into
+ * len:    size of buf
+ * offset: offset to read from
+ * return: number of bytes read, or -errno on error
+ */
+static ssize_t svnfs_cache_pread(int fd, char *buf, size_t len, off_t offset)
+{
+	size_t done;
+	ssize_t n;
+
+	/* pread leaves the offset of the descriptor alone, so every reader of
+	 * an entry can share it */
+	for(done = 0; done < len; done += n)
+	{
+		n = pread(fd, buf + done, len - done, offset + done);
+		if(n < 0 && errno == EINTR)
+		{
+			n = 0;
+			continue;
+		}
+		if(n < 0)
+			return -errno;
+		if(n == 0)
+			break;
+	}
+
+	return done;
+}
+
+int svnfs_cache_read(svnfs_cache_t *cache, char *buf, size_t len,
+                     off_t offset)
+{
+	char *bounce;
+	off_t start;
+	size_t span;
+	ssize_t n;
+
+	if(!cache->direct)
+	{
+		n = svnfs_cache_pread(cache->fd, buf, len, offset);
+
+		/* The kernel keeps what we return in the file's own pages, so a
+		 * second copy here would only crowd out other files */
+		if(n > 0 && svnfs_ctx.cache_io != SVNFS_IO_BUFFERED)
+			posix_fadvise(cache->fd, offset, n, POSIX_FADV_DONTNEED);
+
+		return n;
+	}
+
+	/* O_DIRECT wants the buffer, offset and length all aligned, and FUSE
+	 * promises none of them */
+	start = offset & ~(off_t)(SVNFS_DIRECT_ALIGN - 1);
+	span  = (offset - start + len + SVNFS_DIRECT_ALIGN - 1)
+	        & ~(size_t)(SVNFS_DIRECT_ALIGN - 1);
+	if(posix_memalign((void **)&bounce, SVNFS_DIRECT_ALIGN, span) != 0)
+		return -ENOMEM;
+
+	n = svnfs_cache_pread(cache->fd, bounce, span, start);
+
+	/* Pages left over from the fill, which could not be dropped until they
+	 * were written back, go as they are reached */
+	if(n > 0)
+		posix_fadvise(cache->fd, start, n, POSIX_FADV_DONTNEED);
+
+	if(n > 0)
+	{
+		n -= offset - start;
+		if(n < 0)
+			n = 0;
+		if((size_t)n > len)
+			n = len;
+		memcpy(buf, bounce + (offset - start), n);
+	}
+
+	free(bounce);
+	return n;
+}
+
+void svnfs_cache_unbuffer(svnfs_cache_t *cache)
+{
+	int flags;
+
+	if(svnfs_ctx.cache_io == SVNFS_IO_BUFFERED)
+		return;
+
+	/* Dirty pages cannot be dropped, and waiting for them to be written
+	 * would hold up the open, so writeback is only started here.  Whatever
+	 * is still dirty is dropped by the reads which reach it. */
+#ifdef SYNC_FILE_RANGE_WRITE
+	sync_file_range(cache->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+	posix_fadvise(cache->fd, 0, 0, POSIX_FADV_DONTNEED);
+
+	if(svnfs_ctx.cache_io != SVNFS_IO_DIRECT)
+		return;
+
+	/* Some filesystems, tmpfs among them, refuse O_DIRECT; dropping pages
+	 * after each read is the next best thing there */
+	flags = fcntl(cache->fd, F_GETFL);
+	if(flags >= 0 && fcntl(cache->fd, F_SETFL, flags | O_DIRECT) == 0)
+		cache->direct = 1;
+	else
+		printf("Direct I/O unavailable for \"%s\"\n", cache->key);
+}
+
+void svnfs_cache_discard(svnfs_cache_t *cache)
+{
+	if(cache->fd >= 0)
+	{
+		close(cache->fd);
+		apr_atomic_dec32(&svnfs_cache_fds);
+	}
+	if(*cache->cache_path)
+		apr_file_remove(cache->cache_path, pool);
+	svnfs_arena_release(cache);
+}
+
+/*
+ * svnfs_cache_pinned
+ *
+ * Determines whether a file is pinned.  Must be called with svnfs_cache_lock
+ * held.
+ *
+ * rev:        revision of the file
+ * repos_path: session-relative path of the file
+ * return:     nonzero if the rule governing the file is a pin rule
+ */
+static int svnfs_cache_pinned(svn_revnum_t rev, const char *repos_path)
+{
+	svnfs_rule_t *rule;
+
+	rule = svnfs_rule_match(rev, repos_path);
+
+	return rule && rule->pin;
+}
+
+/*
+ * svnfs_cache_ghost
+ *
+ * Remembers that a large file has been fetched, forgetting the one
+ * remembered longest ago if need be.  Must be called with svnfs_cache_lock
+ * held.
+ *
+ * key:    key of the file in svnfs_cache_files
+ * return: nonzero if the file was already remembered, zero otherwise
+ */
+static int svnfs_cache_ghost(const char *key)
+{
+	char **slot;
+
+	if(apr_hash_get(svnfs_cache_ghosts, key, APR_HASH_KEY_STRING))
+		return 1;
+
+	slot = &svnfs_cache_ghost_ring[svnfs_cache_ghost_next];
+	svnfs_cache_ghost_next = (svnfs_cache_ghost_next + 1) % SVNFS_GHOST_SIZE;
+
+	if(*slot)
+	{
+		apr_hash_set(svnfs_cache_ghosts, *slot, APR_HASH_KEY_STRING, NULL);
+		svnfs_arena_release(*slot);
+	}
+
+	*slot = svnfs_arena_strdup(key);
+	if(*slot)
+		apr_hash_set(svnfs_cache_ghosts, *slot, APR_HASH_KEY_STRING, *slot);
+
+	return 0;
+}
+
+/*
+ * svnfs_cache_unlink
+ *
+ * Takes a content cache entry off the LRU list.  Must be called with
+ * svnfs_cache_lock held.
+ *
+ * cache: the entry
+ */
+static void svnfs_cache_unlink(svnfs_cache_t *cache)
+{
+	if(cache->prev)
+		cache->prev->next = cache->next;
+	else if(svnfs_cache_head == cache)
+		svnfs_cache_head = cache->next;
+
+	if(cache->next)
+		cache->next->prev = cache->prev;
+	else if(svnfs_cache_tail == cache)
+		svnfs_cache_tail = cache->prev;
+
+	cache->prev = NULL;
+	cache->next = NULL;
+}
+
+/*
+ * svnfs_cache_remove
+ *
+ * Evicts a single content cache entry, which must not be open.  Must be
+ * called with svnfs_cache_lock held.
+ *
+ * cache: the entry
+ */
+static void svnfs_cache_remove(svnfs_cache_t *cache)
+{
+	svnfs_note("Evicting \"%s\"\n", cache->key);
+
+	svnfs_cache_unlink(cache);
+	apr_hash_set(svnfs_cache_files, cache->key, APR_HASH_KEY_STRING, NULL);
+	svnfs_cache_used -= cache->size;
+	if(cache->rule)
+	{
+		cache->rule->used -= cache->size;
+		cache->rule->files--;
+	}
+	svnfs_store_forget(cache);
+	svnfs_cache_discard(cache);
+}
+
+int svnfs_cache_reopen(svnfs_cache_t *cache, apr_pool_t *subpool)
+{
+	char *path;
+	int fd;
+
+	/* The name only changes while the file is still open */
+	path = NULL;
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		if(cache->fd < 0)
+			path = apr_pstrdup(subpool, cache->cache_path);
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+	if(!path)
+		return 0;
+
+	fd = open(path, O_RDONLY | (cache->direct ? O_DIRECT : 0));
+	if(fd < 0)
+	{
+		printf("Could not reopen \"%s\"\n", path);
+		return -EIO;
+	}
+
+	/* Another handle may have got there first */
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		if(cache->fd < 0)
+		{
+			cache->fd = fd;
+			fd = -1;
+			apr_atomic_inc32(&svnfs_cache_fds);
+		}
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+	if(fd >= 0)
+		close(fd);
+
+	return 0;
+}
+
+/*
+ * svnfs_cache_sketch_slots
+ *
+ * Finds the counters for a file in each row of svnfs_cache_sketch.
+ *
+ * key:   key of the file in svnfs_cache_files
+ * slots: array of SVNFS_SKETCH_DEPTH to receive the column in each row
+ */
+static void svnfs_cache_sketch_slots(const char *key, unsigned int *slots)
+{
+	apr_uint64_t hash;
+	apr_uint32_t step;
+	int i;
+
+	/* 64-bit FNV-1a, split in two to derive one column per row */
+	hash = 14695981039346656037ULL;
+	for(; *key; key++)
+		hash = (hash ^ (unsigned char)*key) * 1099511628211ULL;
+
+	step = (apr_uint32_t)(hash >> 32) | 1;
+	for(i = 0; i < SVNFS_SKETCH_DEPTH; i++)
+		slots[i] = ((apr_uint32_t)hash + i * step) % SVNFS_SKETCH_WIDTH;
+}
+
+/*
+ * svnfs_cache_sketch_get
+ *
+ * Estimates how often a file has been opened lately.  Must be called with
+ * svnfs_cache_lock held.
+ *
+ * key:    key of the file in svnfs_cache_files
+ * return: the smallest of its counters
+ */
+static unsigned int svnfs_cache_sketch_get(const char *key)
+{
+	unsigned int slots[SVNFS_SKETCH_DEPTH];
+	unsigned int count;
+	int i;
+
+	svnfs_cache_sketch_slots(key, slots);
+
+	count = svnfs_cache_sketch[0][slots[0]];
+	for(i = 1; i < SVNFS_SKETCH_DEPTH; i++)
+		if(svnfs_cache_sketch[i][slots[i]] < count)
+			count = svnfs_cache_sketch[i][slots[i]];
+
+	return count;
+}
+
+void svnfs_cache_sketch_add(const char *key)
+{
+	unsigned int slots[SVNFS_SKETCH_DEPTH];
+	unsigned int count;
+	int i;
+	int j;
+
+	if(!svnfs_ctx.admit_lfu)
+		return;
+
+	/* Only raise the smallest counters; the others already overestimate */
+	count = svnfs_cache_sketch_get(key);
+	if(count < 15)
+	{
+		svnfs_cache_sketch_slots(key, slots);
+		for(i = 0; i < SVNFS_SKETCH_DEPTH; i++)
+			if(svnfs_cache_sketch[i][slots[i]] == count)
+				svnfs_cache_sketch[i][slots[i]]++;
+	}
+
+	if(++svnfs_cache_sketch_adds >= SVNFS_SKETCH_WIDTH * 8)
+	{
+		for(i = 0; i < SVNFS_SKETCH_DEPTH; i++)
+			for(j = 0; j < SVNFS_SKETCH_WIDTH; j++)
+				svnfs_cache_sketch[i][j] >>= 1;
+		svnfs_cache_sketch_adds = 0;
+	}
+}
+
+int svnfs_cache_admit(svnfs_cache_t *cache)
+{
+	svnfs_cache_t *victim;
+	svnfs_cache_t *prev;
+	svnfs_rule_t *rule;
+	apr_off_t capacity;
+
+	capacity = (apr_off_t)svnfs_ctx.cache_size * 1024 * 1024;
+	rule = svnfs_rule_match(cache->rev, strchr(cache->key + 1, '/'));
+
+	/* Under a quota, make room among the entries sharing it first */
+	if(rule && !rule->pin)
+	{
+		for(victim = svnfs_cache_tail;
+		    victim && rule->used + cache->size > rule->quota; victim = prev)
+		{
+			prev = victim->prev;
+			if(victim->rule == rule && victim->refs == 0)
+				svnfs_cache_remove(victim);
+		}
+
+		if(rule->used + cache->size > rule->quota)
+		{
+			svnfs_note("Turning away \"%s\", which is over its quota\n",
+			           cache->key);
+			cache->probation = 1;
+			svnfs_cache_rejects++;
+			return 0;
+		}
+	}
+
+	if(svnfs_ctx.admit_lfu && !(rule && rule->pin)
+	   && svnfs_cache_used + cache->size > capacity)
+	{
+		for(victim = svnfs_cache_tail;
+		    victim && (victim->refs > 0 || (victim->rule && victim->rule->pin));
+		    victim = victim->prev)
+			;
+
+		if(victim && svnfs_cache_sketch_get(cache->key)
+		             <= svnfs_cache_sketch_get(victim->key))
+		{
+			svnfs_note("Turning away \"%s\" in favour of \"%s\"\n",
+			           cache->key, victim->key);
+			cache->probation = 1;
+			svnfs_cache_rejects++;
+			return 0;
+		}
+	}
+
+	cache->probation = 0;
+	cache->rule = rule;
+	if(rule)
+	{
+		rule->used += cache->size;
+		rule->files++;
+	}
+	apr_hash_set(svnfs_cache_files, cache->key, APR_HASH_KEY_STRING, cache);
+	svnfs_cache_used += cache->size;
+	svnfs_store_keep(cache);
+	svnfs_cache_touch(cache);
+	svnfs_cache_evict();
+
+	return 1;
+}
+
+int svnfs_cache_settle(svnfs_cache_t *cache)
+{
+	int whole;
+
+	if(apr_hash_get(svnfs_cache_probation, cache->key, APR_HASH_KEY_STRING)
+	   == cache)
+		apr_hash_set(svnfs_cache_probation, cache->key, APR_HASH_KEY_STRING,
+		             NULL);
+
+	whole = 1;
+	if(cache->fill)
+	{
+		whole = svnfs_ra_end(cache->fill);
+		cache->fill = NULL;
+	}
+
+	if(whole && cache->random
+	   && !apr_hash_get(svnfs_cache_files, cache->key, APR_HASH_KEY_STRING)
+	   && svnfs_cache_admit(cache))
+	{
+		svnfs_note("Admitted \"%s\" from probation\n", cache->key);
+		return 1;
+	}
+
+	svnfs_note("Dropping \"%s\" after one pass\n", cache->key);
+	svnfs_cache_discard(cache);
+	return 0;
+}
+
+int svnfs_cache_fill(const char *key, const char *repos_path, svn_revnum_t rev,
+                     svnfs_ra_class_t priority, svnfs_cache_t **cache,
+                     apr_pool_t *subpool)
+{
+	volatile apr_uint32_t *urgent;
+	svnfs_attr_t attr;
+	apr_uint64_t hash;
+	int large;
+	int stored;
+	int probation;
+	int ret;
+
+	/* The size is nearly always cached already, since getattr comes first */
+	large = svnfs_ctx.scan_size > 0
+	        && svnfs_attr_get(repos_path, rev, &attr, subpool) == 0
+	        && (attr.fields & SVN_DIRENT_SIZE)
+	        && attr.size >= (apr_off_t)svnfs_ctx.scan_size * 1024 * 1024;
+
+	hash = svnfs_store_header ? svnfs_store_hash(key) : 0;
+
+	/* Only one thread fetches any given file; the rest wait for it */
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		for(;;)
+		{
+			*cache = apr_hash_get(svnfs_cache_files, key, APR_HASH_KEY_STRING);
+			if(*cache)
+			{
+				(*cache)->refs++;
+				svnfs_cache_touch(*cache);
+				apr_thread_mutex_unlock(svnfs_cache_lock);
+
+				ret = svnfs_cache_reopen(*cache, subpool);
+				if(ret != 0)
+					svnfs_lib_close(*cache);
+				return ret;
+			}
+
+			/* One whose fetch failed is only kept for the handles already
+			 * reading it */
+			*cache = apr_hash_get(svnfs_cache_probation, key,
+			                      APR_HASH_KEY_STRING);
+			if(*cache && !((*cache)->fill && svnfs_ra_failed((*cache)->fill)))
+			{
+				(*cache)->refs++;
+				apr_thread_mutex_unlock(svnfs_cache_lock);
+				return 0;
+			}
+
+			urgent = apr_hash_get(svnfs_cache_fills, key, APR_HASH_KEY_STRING);
+			if(!urgent)
+				break;
+
+			/* Someone is waiting on this fetch now, so stop throttling it */
+			if(priority == SVNFS_RA_DEMAND)
+				apr_atomic_set32(urgent, 1);
+
+			apr_thread_cond_wait(svnfs_cache_cond, svnfs_cache_lock);
+		}
+		urgent = apr_pcalloc(subpool, sizeof(*urgent));
+
+		/* A large file seen for the first time may well be part of a scan,
+		 * so it does not get to push anything out until it proves
+		 * otherwise.  One kept by an earlier mount has proved itself. */
+		stored = svnfs_store_has(key, hash);
+		probation = large && !stored && !svnfs_cache_pinned(rev, repos_path)
+		            && !svnfs_cache_ghost(key);
+		apr_hash_set(svnfs_cache_fills, key, APR_HASH_KEY_STRING,
+		             (void *)urgent);
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	ret = -ENOENT;
+	if(stored)
+		ret = svnfs_store_load(key, rev, hash, cache, subpool);
+	if(ret != 0 && probation && priority == SVNFS_RA_DEMAND)
+		ret = svnfs_cache_stream(key, repos_path, rev, attr.size, cache,
+		                         subpool);
+	if(ret != 0)
+		ret = svnfs_cache_fetch(key, repos_path, rev, priority, urgent, hash,
+		                        cache, subpool);
+
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		apr_hash_set(svnfs_cache_fills, key, APR_HASH_KEY_STRING, NULL);
+		if(ret == 0 && probation)
+			(*cache)->probation = 1;
+		else if(ret == 0)
+			svnfs_cache_admit(*cache); /* Else it stays on probation */
+
+		/* Whoever opens the file while it is open shares it, including
+		 * those woken below, rather than each fetching it again */
+		if(ret == 0 && (*cache)->probation)
+		{
+			apr_hash_set(svnfs_cache_probation, key, APR_HASH_KEY_STRING,
+			             NULL);
+			apr_hash_set(svnfs_cache_probation, (*cache)->key,
+			             APR_HASH_KEY_STRING, *cache);
+		}
+		apr_thread_cond_broadcast(svnfs_cache_cond);
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	if(ret == 0)
+		svnfs_store_rename(*cache);
+
+	return ret;
+}
+
+void svnfs_cache_touch(svnfs_cache_t *cache)
+{
+	svnfs_cache_unlink(cache);
+
+	cache->next = svnfs_cache_head;
+	if(svnfs_cache_head)
+		svnfs_cache_head->prev = cache;
+	svnfs_cache_head = cache;
+	if(!svnfs_cache_tail)
+		svnfs_cache_tail = cache;
+}
+
+void svnfs_cache_evict(void)
+{
+	svnfs_cache_t *cache;
+	svnfs_cache_t *prev;
+	apr_off_t capacity;
+
+	capacity = (apr_off_t)svnfs_ctx.cache_size * 1024 * 1024;
+
+	/* Files left by earlier mounts and not wanted since go first */
+	while(svnfs_cache_used > capacity && svnfs_store_evict())
+		;
+
+	for(cache = svnfs_cache_tail; cache && svnfs_cache_used > capacity;
+	    cache = prev)
+	{
+		prev = cache->prev;
+		if(cache->refs > 0 || (cache->rule && cache->rule->pin))
+			continue;
+
+		svnfs_cache_remove(cache);
+	}
+
+	/* Past the limit on descriptors, idle files with a name are closed to be
+	 * opened again when next wanted, and the rest have to go */
+	for(cache = svnfs_cache_tail;
+	    cache && svnfs_cache_fd_limit
+	    && apr_atomic_read32(&svnfs_cache_fds) > svnfs_cache_fd_limit;
+	    cache = prev)
+	{
+		prev = cache->prev;
+		if(cache->refs > 0 || cache->fd < 0)
+			continue;
+
+		if(*cache->cache_path)
+		{
+			close(cache->fd);
+			cache->fd = -1;
+			apr_atomic_dec32(&svnfs_cache_fds);
+		}
+		else if(!(cache->rule && cache->rule->pin))
+			svnfs_cache_remove(cache);
+	}
+}
+
+/* END CONTENT CACHE }}}1 */
+
+/* PERSISTENT STORE {{{1 */
+
+/*
+ * svnfs_store_fnv
+ *
+ * Continues a 64-bit FNV-1a hash over some bytes.
+ *
+ * hash:   hash so far, or 14695981039346656037 to start one
+ * data:   the bytes
+ * len:    number of bytes
+ * return: the new hash
+ */
+static apr_uint64_t svnfs_store_fnv(apr_uint64_t hash, const void *data,
+                                    apr_size_t len)
+{
+	const unsigned char *p;
+
+	for(p = data; len > 0; p++, len--)
+		hash = (hash ^ *p) * 1099511628211ULL;
+
+	return hash;
+}
+
+/*
+ * svnfs_store_path
+ *
+ * Names the file in the persistent store with the given hash.
+ *
+ * hash:   hash of the file
+ * pool:   pool to allocate the name from
+ * return: the name
+ */
+static char *svnfs_store_path(apr_uint64_t hash, apr_pool_t *pool)
+{
+	return apr_psprintf(pool, "%s/%02x/%08x%08x", svnfs_ctx.cache_dir,
+	                    (unsigned int)(hash & 0xff),
+	                    (unsigned int)(hash >> 32), (unsigned int)hash);
+}
+
+/*
+ * svnfs_store_find
+ *
+ * Looks a file up in the index.  Must be called with svnfs_cache_lock held.
+ *
+ * hash:   hash of the file
+ * insert: nonzero to return a free slot if the file is not there
+ * return: its slot, the free slot, or NULL
+ */
+static svnfs_store_slot_t *svnfs_store_find(apr_uint64_t hash, int insert)
+{
+	svnfs_store_slot_t *slot;
+	svnfs_store_slot_t *free_slot;
+	apr_uint32_t mask;
+	apr_uint32_t i;
+	apr_uint32_t n;
+
+	mask = svnfs_store_header->slots - 1;
+	free_slot = NULL;
+
+	/* The low byte picks the directory, so probe from the high word */
+	i = (apr_uint32_t)(hash >> 32) & mask;
+	for(n = 0; n < svnfs_store_header->slots; n++, i = (i + 1) & mask)
+	{
+		slot = &svnfs_store_slots[i];
+		if(slot->flags & SVNFS_SLOT_USED)
+		{
+			if(slot->hash == hash)
+				return slot;
+			continue;
+		}
+
+		if(!free_slot)
+			free_slot = slot;
+		if(!(slot->flags & SVNFS_SLOT_DEAD))
+			break;
+	}
+
+	return insert ? free_slot : NULL;
+}
+
+/*
+ * svnfs_store_drop
+ *
+ * Empties a slot in the index.  Must be called with svnfs_cache_lock held.
+ *
+ * slot: the slot, which must be in use
+ */
+static void svnfs_store_drop(svnfs_store_slot_t *slot)
+{
+	apr_uint32_t mask;
+	apr_uint32_t i;
+	apr_uint32_t n;
+
+	slot->flags = SVNFS_SLOT_DEAD;
+	svnfs_store_header->used -= slot->size;
+	svnfs_store_header->files--;
+
+	/* A tombstone only has to stay while some probe might pass over it on
+	 * the way to a slot in use, which none can once the next slot is empty;
+	 * nor then can any probe through the tombstones just before it */
+	mask = svnfs_store_header->slots - 1;
+	i = (apr_uint32_t)(slot - svnfs_store_slots);
+	if(svnfs_store_slots[(i + 1) & mask].flags
+	   & (SVNFS_SLOT_USED | SVNFS_SLOT_DEAD))
+		return;
+
+	for(n = 0; n < svnfs_store_header->slots
+	           && (svnfs_store_slots[i].flags
+	               & (SVNFS_SLOT_USED | SVNFS_SLOT_DEAD)) == SVNFS_SLOT_DEAD;
+	    n++, i = (i - 1) & mask)
+		svnfs_store_slots[i].flags = 0;
+}
+
+/*
+ * svnfs_store_check
+ *
+ * Computes the second hash of a file in the persistent store, which tells
+ * apart files whose keys share a hash.  It carries on hashing the key from
+ * where svnfs_store_hash left off, so that keys sharing the first hash are
+ * no more likely than any others to share the second.
+ *
+ * key:    key of the file in svnfs_cache_files
+ * hash:   its svnfs_store_hash
+ * return: the second hash
+ */
+static apr_uint64_t svnfs_store_check(const char *key, apr_uint64_t hash)
+{
+	return svnfs_store_fnv(hash, key, strlen(key));
+}
+
+/*
+ * svnfs_store_cold_slot
+ *
+ * Determines whether a slot describes a file kept by an earlier mount which
+ * this mount has not yet opened.  Must be called with svnfs_cache_lock
+ * held.
+ *
+ * slot:   the slot
+ * return: nonzero if it does, zero otherwise
+ */
+static int svnfs_store_cold_slot(svnfs_store_slot_t *slot)
+{
+	return (slot->flags & (SVNFS_SLOT_USED | SVNFS_SLOT_COMPLETE))
+	       == (SVNFS_SLOT_USED | SVNFS_SLOT_COMPLETE)
+	       && slot->generation != svnfs_store_header->generation;
+}
+
+int svnfs_store_open(apr_pool_t *pool)
+{
+	svnfs_store_header_t header;
+	apr_mmap_t *mmap;
+	apr_finfo_t finfo;
+	apr_uint64_t repos;
+	apr_uint32_t slots;
+	apr_size_t len;
+	apr_off_t size;
+	char *path;
+	int fresh;
+
+	if(apr_dir_make_recursive(svnfs_ctx.cache_dir, APR_OS_DEFAULT, pool)
+	   != APR_SUCCESS)
+	{
+		printf("Could not create cache directory \"%s\"\n",
+		       svnfs_ctx.cache_dir);
+		return -EIO;
+	}
+
+	path = apr_psprintf(pool, "%s/index", svnfs_ctx.cache_dir);
+	if(apr_file_open(&svnfs_store_file, path,
+	                 APR_CREATE | APR_READ | APR_WRITE | APR_BINARY,
+	                 APR_OS_DEFAULT, pool) != APR_SUCCESS)
+	{
+		printf("Could not open cache index \"%s\"\n", path);
+		return -EIO;
+	}
+
+	/* Two mounts sharing the directory would wreck each other's index */
+	if(apr_file_lock(svnfs_store_file,
+	                 APR_FLOCK_EXCLUSIVE | APR_FLOCK_NONBLOCK) != APR_SUCCESS)
+	{
+		printf("Cache directory \"%s\" is in use by another mount\n",
+		       svnfs_ctx.cache_dir);
+		apr_file_close(svnfs_store_file);
+		return -EBUSY;
+	}
+
+	/* Room for files averaging 16K, with the table at most half full */
+	for(slots = 4096; slots < (apr_uint32_t)svnfs_ctx.cache_size * 128
+	                  && slots < 0x40000000; slots <<= 1)
+		;
+
+	repos = svnfs_store_fnv(14695981039346656037ULL, svnfs_repository,
+	                        strlen(svnfs_repository));
+
+	memset(&header, 0, sizeof(header));
+	len = sizeof(header);
+	apr_file_read_full(svnfs_store_file, &header, len, &len);
+	if(apr_file_info_get(&finfo, APR_FINFO_SIZE, svnfs_store_file)
+	   != APR_SUCCESS)
+		finfo.size = 0;
+
+	/* An index that does not fit its header is not worth trusting */
+	fresh = header.magic != SVNFS_STORE_MAGIC
+	        || header.version != SVNFS_STORE_VERSION
+	        || header.repos != repos
+	        || header.slots == 0 || (header.slots & (header.slots - 1))
+	        || finfo.size != (apr_off_t)(sizeof(svnfs_store_header_t)
+	                         + (apr_off_t)header.slots
+	                           * sizeof(svnfs_store_slot_t));
+	if(!fresh)
+		slots = header.slots;
+
+	size = sizeof(svnfs_store_header_t)
+	       + (apr_off_t)slots * sizeof(svnfs_store_slot_t);
+	if(fresh)
+	{
+		svnfs_note("Starting a new cache index in \"%s\"\n",
+		           svnfs_ctx.cache_dir);
+		if(apr_file_trunc(svnfs_store_file, 0) != APR_SUCCESS
+		   || apr_file_trunc(svnfs_store_file, size) != APR_SUCCESS)
+		{
+			printf("Could not size cache index \"%s\"\n", path);
+			apr_file_close(svnfs_store_file);
+			return -EIO;
+		}
+	}
+
+	if(apr_mmap_create(&mmap, svnfs_store_file, 0, size,
+	                   APR_MMAP_READ | APR_MMAP_WRITE, pool) != APR_SUCCESS)
+	{
+		printf("Could not map cache index \"%s\"\n", path);
+		apr_file_close(svnfs_store_file);
+		return -EIO;
+	}
+
+	svnfs_store_header = mmap->mm;
+	svnfs_store_slots  = (svnfs_store_slot_t *)(svnfs_store_header + 1);
+
+	/* The magic goes last, so that an index cut short here is redone */
+	if(fresh)
+	{
+		memset(svnfs_store_header, 0, sizeof(svnfs_store_header_t));
+		svnfs_store_header->version = SVNFS_STORE_VERSION;
+		svnfs_store_header->slots   = slots;
+		svnfs_store_header->repos   = repos;
+		svnfs_store_header->magic   = SVNFS_STORE_MAGIC;
+	}
+
+	/* Nothing is read from the files themselves until they are opened */
+	svnfs_store_header->generation++;
+	svnfs_cache_used = svnfs_store_header->used;
+	svnfs_store_cold = svnfs_store_header->files > 0;
+	svnfs_store_unpin();
+
+	svnfs_note("Content cache: %lu files kept from earlier mounts\n",
+	           (unsigned long)svnfs_store_header->files);
+
+	return 0;
+}
+
+apr_uint64_t svnfs_store_hash(const char *key)
+{
+	apr_uint64_t hash;
+
+	/* The repository goes in too, in case the directory is ever reused */
+	hash = svnfs_store_fnv(14695981039346656037ULL, svnfs_repository,
+	                       strlen(svnfs_repository));
+
+	return svnfs_store_fnv(hash, key, strlen(key));
+}
+
+int svnfs_store_has(const char *key, apr_uint64_t hash)
+{
+	svnfs_store_slot_t *slot;
+
+	if(!svnfs_store_header)
+		return 0;
+
+	slot = svnfs_store_find(hash, 0);
+
+	return slot && svnfs_store_cold_slot(slot)
+	       && slot->check == svnfs_store_check(key, hash);
+}
+
+int svnfs_store_load(const char *key, svn_revnum_t rev, apr_uint64_t hash,
+                     svnfs_cache_t **cache, apr_pool_t *subpool)
+{
+	svnfs_store_slot_t *slot;
+	apr_uint64_t check;
+	apr_uint64_t checksum;
+	apr_uint64_t expected;
+	apr_off_t size;
+	apr_off_t expected_size;
+	char *cache_path;
+	int fd;
+	int ret;
+
+	check = svnfs_store_check(key, hash);
+
+	/* Stamping the slot keeps the scrubber and svnfs_store_evict off it */
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		slot = svnfs_store_find(hash, 0);
+		if(!slot || !svnfs_store_cold_slot(slot) || slot->check != check
+		   || slot->rev != rev)
+		{
+			apr_thread_mutex_unlock(svnfs_cache_lock);
+			return -ENOENT;
+		}
+		expected      = slot->checksum;
+		expected_size = slot->size;
+		slot->generation = svnfs_store_header->generation;
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	/* Move the file to a temporary name, so that from here on it is handled
+	 * exactly like a file just fetched */
+	ret = svnfs_store_mktemp(hash, &fd, &cache_path, subpool);
+	if(ret == 0)
+	{
+		close(fd);
+		if(rename(svnfs_store_path(hash, subpool), cache_path) != 0)
+			ret = -ENOENT;
+	}
+
+	if(ret == 0)
+		ret = svnfs_store_checksum(cache_path, &checksum, &size);
+
+	if(ret == 0 && (size != expected_size || checksum != expected))
+	{
+		printf("Discarding damaged copy of \"%s\"\n", key);
+		ret = -EIO;
+	}
+
+	/* Its bytes are counted again if it is admitted */
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		slot = svnfs_store_find(hash, 0);
+		if(slot && slot->check == check)
+		{
+			svnfs_cache_used -= slot->size;
+			svnfs_store_drop(slot);
+		}
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	fd = -1;
+	if(ret == 0 && (fd = open(cache_path, O_RDWR)) < 0)
+		ret = -EIO;
+
+	if(ret == 0)
+	{
+		*cache = svnfs_cache_new(key, rev, cache_path, fd, size, hash,
+		                         checksum);
+		if(!*cache)
+		{
+			close(fd);
+			ret = -ENOMEM;
+		}
+		else
+			svnfs_cache_unbuffer(*cache);
+	}
+
+	if(ret != 0)
+	{
+		apr_file_remove(cache_path, subpool);
+		return ret;
+	}
+
+	svnfs_note("Loaded \"%s\" from the cache directory\n", key);
+
+	return 0;
+}
+
+int svnfs_store_mktemp(apr_uint64_t hash, int *fd, char **path,
+                       apr_pool_t *subpool)
+{
+	char *dir;
+
+	dir = apr_psprintf(subpool, "%s/%02x", svnfs_ctx.cache_dir,
+	                   (unsigned int)(hash & 0xff));
+	apr_dir_make(dir, APR_OS_DEFAULT, subpool); /* Usually there already */
+
+	/* The generation tells the scrubber whether a temporary file may still
+	 * be in use or was left behind by an earlier mount */
+	*path = apr_psprintf(subpool, "%s/%08x%08x.%lu.XXXXXX", dir,
+	                     (unsigned int)(hash >> 32), (unsigned int)hash,
+	                     (unsigned long)svnfs_store_header->generation);
+
+	*fd = mkstemp(*path);
+	if(*fd < 0)
+	{
+		printf("Could not create file in \"%s\"\n", dir);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+int svnfs_store_checksum(const char *path, apr_uint64_t *checksum,
+                         apr_off_t *size)
+{
+	apr_pool_t *subpool;
+	apr_file_t *file;
+	apr_os_file_t fd;
+	apr_status_t status;
+	apr_size_t len;
+	char buf[64 * 1024];
+#ifdef SVNFS_HAVE_IO_URING
+	int ret;
+#endif
+
+	if(apr_pool_create(&subpool, NULL) != APR_SUCCESS)
+		return -ENOMEM;
+
+	if(apr_file_open(&file, path, APR_READ | APR_BINARY, APR_OS_DEFAULT,
+	                 subpool) != APR_SUCCESS)
+	{
+		apr_pool_destroy(subpool);
+		return -ENOENT;
+	}
+
+#ifdef SVNFS_HAVE_IO_URING
+	if(apr_os_file_get(&fd, file) == APR_SUCCESS)
+	{
+		ret = svnfs_uring_checksum(fd, checksum, size);
+		if(ret != -ENOSYS)
+		{
+			if(ret == 0 && svnfs_ctx.cache_io != SVNFS_IO_BUFFERED)
+				posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			apr_file_close(file);
+			apr_pool_destroy(subpool);
+			if(ret != 0)
+				printf("Could not read \"%s\"\n", path);
+			return ret;
+		}
+	}
+#endif
+
+	*checksum = 14695981039346656037ULL;
+	*size = 0;
+	do
+	{
+		len = sizeof(buf);
+		status = apr_file_read(file, buf, &len);
+		*checksum = svnfs_store_fnv(*checksum, buf, len);
+		*size += len;
+	}
+	while(status == APR_SUCCESS);
+
+	/* Checking a file is no reason to keep it in memory */
+	if(svnfs_ctx.cache_io != SVNFS_IO_BUFFERED
+	   && apr_os_file_get(&fd, file) == APR_SUCCESS)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+	apr_file_close(file);
+	apr_pool_destroy(subpool);
+
+	if(status != APR_EOF)
+	{
+		printf("Could not read \"%s\"\n", path);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+void svnfs_store_keep(svnfs_cache_t *cache)
+{
+	svnfs_store_slot_t *slot;
+	apr_uint64_t check;
+
+	if(!svnfs_store_header || !cache->hash)
+		return;
+	check = svnfs_store_check(cache->key, cache->hash);
+
+	/* Without a slot the file keeps its temporary name, so that the
+	 * scrubber leaves it alone until it is evicted */
+	slot = svnfs_store_find(cache->hash, 1);
+	if(!slot)
+	{
+		printf("Cache index is full; \"%s\" will not outlive this mount\n",
+		       cache->key);
+		return;
+	}
+
+	/* A file of this mount whose key shares the hash has the name already */
+	if((slot->flags & SVNFS_SLOT_USED) && slot->check != check
+	   && !svnfs_store_cold_slot(slot))
+	{
+		printf("\"%s\" shares its name in the cache directory and will not "
+		       "outlive this mount\n", cache->key);
+		return;
+	}
+
+	/* Otherwise a slot in use is an older copy of this file or of one whose
+	 * key shares the hash, and its file is about to be renamed over.  Until
+	 * then the slot names a file that is not there yet, which a later mount
+	 * would find missing and discard. */
+	if(slot->flags & SVNFS_SLOT_USED)
+	{
+		if(svnfs_store_cold_slot(slot))
+			svnfs_cache_used -= slot->size;
+		svnfs_store_drop(slot);
+	}
+
+	/* The flags go last, so that a slot is never seen half written */
+	slot->hash       = cache->hash;
+	slot->check      = check;
+	slot->rev        = cache->rev;
+	slot->size       = cache->size;
+	slot->checksum   = cache->checksum;
+	slot->generation = svnfs_store_header->generation;
+	slot->flags      = SVNFS_SLOT_USED | SVNFS_SLOT_COMPLETE;
+	if(cache->rule && cache->rule->pin)
+		slot->flags |= SVNFS_SLOT_PINNED;
+	svnfs_store_header->used += cache->size;
+	svnfs_store_header->files++;
+
+	cache->renaming = 1;
+	cache->refs++;
+}
+
+void svnfs_store_rename(svnfs_cache_t *cache)
+{
+	char *path;
+	char *name;
+	int renamed;
+
+	if(!cache->renaming)
+		return;
+
+	/* Dropping the generation and random suffix gives the permanent name,
+	 * which is never longer.  Nothing else changes the name meanwhile. */
+	renamed = 0;
+	path = strdup(cache->cache_path);
+	if(path)
+	{
+		name = strrchr(path, '/') + 1;
+		name[16] = '\0';
+		renamed = rename(cache->cache_path, path) == 0;
+		if(!renamed)
+			printf("Could not rename \"%s\"\n", cache->cache_path);
+	}
+
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		if(renamed)
+			strcpy(cache->cache_path, path);
+		else
+			svnfs_store_forget(cache);
+		cache->renaming = 0;
+		cache->refs--;
+		svnfs_cache_evict(); /* This may have been all that stood in the way */
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	free(path);
+}
+
+void svnfs_store_forget(svnfs_cache_t *cache)
+{
+	svnfs_store_slot_t *slot;
+
+	if(!svnfs_store_header || !cache->hash)
+		return;
+
+	slot = svnfs_store_find(cache->hash, 0);
+	if(slot && slot->check == svnfs_store_check(cache->key, cache->hash))
+		svnfs_store_drop(slot);
+}
+
+void svnfs_store_unpin(void)
+{
+	apr_uint32_t n;
+	int i;
+
+	if(!svnfs_store_header)
+		return;
+
+	for(i = 0; svnfs_rules && i < svnfs_rules->nelts; i++)
+		if(APR_ARRAY_IDX(svnfs_rules, i, svnfs_rule_t *)->pin)
+			return;
+
+	for(n = 0; n < svnfs_store_header->slots; n++)
+		svnfs_store_slots[n].flags &= ~SVNFS_SLOT_PINNED;
+}
+
+int svnfs_store_evict(void)
+{
+	svnfs_store_slot_t *slot;
+	apr_pool_t *subpool;
+	apr_uint32_t n;
+	int pinned;
+
+	if(!svnfs_store_header || !svnfs_store_cold)
+		return 0;
+
+	/* A cold file cannot be matched against the rules, its key being gone,
+	 * so the pin it was admitted under only holds while there is something
+	 * else to evict */
+	for(n = 0, pinned = 0; n < 2 * svnfs_store_header->slots; n++)
+	{
+		if(n == svnfs_store_header->slots)
+			pinned = 1;
+
+		slot = &svnfs_store_slots[svnfs_store_evict_next];
+		svnfs_store_evict_next = (svnfs_store_evict_next + 1)
+		                         & (svnfs_store_header->slots - 1);
+
+		if(!svnfs_store_cold_slot(slot)
+		   || (!pinned && (slot->flags & SVNFS_SLOT_PINNED)))
+			continue;
+
+		if(apr_pool_create(&subpool, NULL) != APR_SUCCESS)
+			return 0;
+		svnfs_note("Evicting revision %ld file kept by an earlier mount\n",
+		           (long)slot->rev);
+		apr_file_remove(svnfs_store_path(slot->hash, subpool), subpool);
+		apr_pool_destroy(subpool);
+
+		svnfs_cache_used -= slot->size;
+		svnfs_store_drop(slot);
+		return 1;
+	}
+
+	svnfs_store_cold = 0;
+	return 0;
+}
+
+/*
+ * svnfs_store_scrub_one
+ *
+ * Checks the next file kept by an earlier mount which this mount has not
+ * opened, and discards it if it is damaged or missing.
+ *
+ * return: nonzero if a file was checked, zero if there are none left
+ */
+static int svnfs_store_scrub_one(void)
+{
+	svnfs_store_slot_t *slot;
+	apr_pool_t *subpool;
+	apr_uint64_t hash;
+	apr_uint64_t checksum;
+	apr_uint64_t expected;
+	apr_off_t size;
+	apr_off_t expected_size;
+	apr_uint32_t n;
+	char *path;
+	int ret;
+
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		slot = NULL;
+		for(n = 0; n < svnfs_store_header->slots && !slot; n++)
+		{
+			slot = &svnfs_store_slots[svnfs_store_scrub_next];
+			svnfs_store_scrub_next = (svnfs_store_scrub_next + 1)
+			                         & (svnfs_store_header->slots - 1);
+			if(!svnfs_store_cold_slot(slot))
+				slot = NULL;
+		}
+
+		if(!slot)
+		{
+			apr_thread_mutex_unlock(svnfs_cache_lock);
+			return 0;
+		}
+
+		hash          = slot->hash;
+		expected      = slot->checksum;
+		expected_size = slot->size;
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	if(apr_pool_create(&subpool, NULL) != APR_SUCCESS)
+		return 0;
+	path = svnfs_store_path(hash, subpool);
+
+	ret = svnfs_store_checksum(path, &checksum, &size);
+	if(ret == 0 && size == expected_size && checksum == expected)
+	{
+		apr_pool_destroy(subpool);
+		return 1;
+	}
+
+	/* An open may have taken the file over in the meantime, in which case
+	 * it checks the file itself */
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		slot = svnfs_store_find(hash, 0);
+		if(slot && svnfs_store_cold_slot(slot) && slot->checksum == expected)
+		{
+			printf("Discarding damaged revision %ld file\n", (long)slot->rev);
+			apr_file_remove(path, subpool);
+			svnfs_cache_used -= slot->size;
+			svnfs_store_drop(slot);
+		}
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	apr_pool_destroy(subpool);
+	return 1;
+}
+
+/*
+ * svnfs_store_sweep
+ *
+ * Removes files from one subdirectory of the persistent store which the
+ * index knows nothing about: temporary files left by earlier mounts, and
+ * files whose slots were lost or discarded.
+ *
+ * shard: the subdirectory, by number
+ */
+static void svnfs_store_sweep(unsigned int shard)
+{
+	apr_pool_t *subpool;
+	apr_dir_t *dir;
+	apr_finfo_t finfo;
+	apr_uint64_t hash;
+	char hex[17];
+	char *dir_path;
+	char *end;
+	int keep;
+
+	if(apr_pool_create(&subpool, NULL) != APR_SUCCESS)
+		return;
+
+	dir_path = apr_psprintf(subpool, "%s/%02x", svnfs_ctx.cache_dir, shard);
+	if(apr_dir_open(&dir, dir_path, subpool) != APR_SUCCESS)
+	{
+		apr_pool_destroy(subpool);
+		return;
+	}
+
+	while(apr_dir_read(&finfo, APR_FINFO_NAME, dir) == APR_SUCCESS)
+	{
+		if(finfo.name[0] == '.')
+			continue;
+
+		keep = 0;
+		if(strlen(finfo.name) >= 16)
+		{
+			memcpy(hex, finfo.name, 16);
+			hex[16] = '\0';
+			hash = strtoull(hex, &end, 16);
+
+			/* A temporary file of this mount is a fetch in progress or an
+			 * entry on probation */
+			if(*end != '\0')
+				keep = 0;
+			else if(finfo.name[16] == '.')
+				keep = strtoul(finfo.name + 17, NULL, 10)
+				       == (unsigned long)svnfs_store_header->generation;
+			else if(finfo.name[16] == '\0')
+			{
+				apr_thread_mutex_lock(svnfs_cache_lock);
+					keep = svnfs_store_find(hash, 0) != NULL;
+				apr_thread_mutex_unlock(svnfs_cache_lock);
+			}
+		}
+
+		if(!keep)
+		{
+			svnfs_note("Sweeping up \"%s/%s\"\n", dir_path, finfo.name);
+			apr_file_remove(apr_pstrcat(subpool, dir_path, "/", finfo.name,
+			                            NULL), subpool);
+		}
+	}
+
+	apr_dir_close(dir);
+	apr_pool_destroy(subpool);
+}
+
+/*
+ * svnfs_store_thread
+ *
+ * The scrubber: every svnfs_ctx.scrub_interval seconds checks a few files
+ * kept by earlier mounts which this mount has not opened, and sweeps one
+ * subdirectory of the persistent store.  Files that are opened are checked
+ * then instead, so the scrubber only has to catch damage to cold files
+ * before it costs an open a wasted read.
+ *
+ * thread: the thread
+ * data:   unused
+ * return: never returns
+ */
+static void *svnfs_store_thread(apr_thread_t *thread, void *data)
+{
+	unsigned int shard;
+	int i;
+
+	for(shard = 0; ; shard = (shard + 1) % 256)
+	{
+		apr_sleep(apr_time_from_sec(svnfs_ctx.scrub_interval));
+
+		for(i = 0; i < SVNFS_SCRUB_BATCH; i++)
+			if(!svnfs_store_scrub_one())
+				break;
+
+		svnfs_store_sweep(shard);
+	}
+
+	return NULL;
+}
+
+/* END PERSISTENT STORE }}}1 */
+
+#ifdef SVNFS_HAVE_IO_URING
+/* ASYNCHRONOUS I/O {{{1 */
+
+/*
+ * svnfs_uring_reap
+ *
+ * Collects completed writes of an io_uring stream.
+ *
+ * u:    the stream
+ * wait: nonzero to wait for at least one completion if none is ready
+ */
+static void svnfs_uring_reap(svnfs_uring_t *u, int wait)
+{
+	struct io_uring_cqe *cqe;
+	uintptr_t i;
+	int ret;
+
+	while(u->inflight > 0)
+	{
+		ret = wait ? io_uring_wait_cqe(&u->ring, &cqe)
+		           : io_uring_peek_cqe(&u->ring, &cqe);
+		if(ret == -EINTR)
+			continue;
+		if(ret < 0)
+		{
+			if(wait && !u->error)
+				u->error = ret;
+			if(wait)
+				u->inflight = 0; /* Nothing more will come */
+			return;
+		}
+
+		/* Regular files are only ever written short when something is
+		 * wrong, such as the disk being full */
+		i = (uintptr_t)io_uring_cqe_get_data(cqe);
+		if(cqe->res < 0 && !u->error)
+			u->error = cqe->res;
+		else if(i < SVNFS_URING_DEPTH && cqe->res != u->busy[i] && !u->error)
+			u->error = -EIO;
+		if(i < SVNFS_URING_DEPTH)
+			u->busy[i] = 0;
+		io_uring_cqe_seen(&u->ring, cqe);
+		u->inflight--;
+		wait = 0;
+	}
+}
+
+/*
+ * svnfs_uring_sqe
+ *
+ * Gets a submission queue entry of an io_uring stream, waiting for writes
+ * to complete if the queue is full.
+ *
+ * u:      the stream
+ * return: the entry, or NULL on error
+ */
+static struct io_uring_sqe *svnfs_uring_sqe(svnfs_uring_t *u)
+{
+	struct io_uring_sqe *sqe;
+
+	while(!(sqe = io_uring_get_sqe(&u->ring)))
+	{
+		if(u->inflight == 0)
+			return NULL;
+		svnfs_uring_reap(u, 1);
+	}
+
+	return sqe;
+}
+
+/*
+ * svnfs_uring_flush
+ *
+ * Submits the write of the buffer being filled, if it holds anything, and
+ * moves on to the next buffer, waiting for it to be free.
+ *
+ * u: the stream
+ */
+static void svnfs_uring_flush(svnfs_uring_t *u)
+{
+	struct io_uring_sqe *sqe;
+
+	if(u->fill == 0)
+		return;
+
+	sqe = svnfs_uring_sqe(u);
+	if(!sqe)
+	{
+		u->error = -EIO;
+		return;
+	}
+	io_uring_prep_write(sqe, u->fd, u->base + u->current * SVNFS_URING_BUFSIZE,
+	                    u->fill, u->offset);
+	io_uring_sqe_set_data(sqe, (void *)(uintptr_t)u->current);
+	u->busy[u->current] = u->fill;
+	u->inflight++;
+	u->offset += u->fill;
+	u->fill = 0;
+	io_uring_submit(&u->ring);
+
+	u->current = (u->current + 1) % SVNFS_URING_DEPTH;
+	while(u->busy[u->current] && u->inflight > 0)
+		svnfs_uring_reap(u, 1);
+	u->busy[u->current] = 0;
+
+	/* Take whatever else has finished without blocking */
+	svnfs_uring_reap(u, 0);
+}
+
+/*
+ * svnfs_uring_write
+ *
+ * Copies file contents into the buffers of an io_uring stream, submitting
+ * each buffer as it fills.
+ *
+ * baton:  an svnfs_uring_t
+ * data:   the contents
+ * len:    pointer to the length of data; receives the length written
+ * return: SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+static svn_error_t *svnfs_uring_write(void *baton, const char *data,
+                                      apr_size_t *len)
+{
+	svnfs_uring_t *u = baton;
+	apr_size_t left;
+	apr_size_t n;
+
+	for(left = *len; left > 0 && !u->error; left -= n, data += n)
+	{
+		n = SVNFS_URING_BUFSIZE - u->fill;
+		if(n > left)
+			n = left;
+		memcpy(u->base + u->current * SVNFS_URING_BUFSIZE + u->fill, data, n);
+		u->fill += n;
+		if(u->fill == SVNFS_URING_BUFSIZE)
+			svnfs_uring_flush(u);
+	}
+
+	if(u->error)
+		return svn_error_wrap_apr(APR_FROM_OS_ERROR(-u->error),
+		                          "Could not write to cache file");
+
+	return SVN_NO_ERROR;
+}
+
+/*
+ * svnfs_uring_close
+ *
+ * Writes out what is left in the buffers of an io_uring stream and waits
+ * for the writes.  svnfs_cache_unbuffer starts writeback after that, just
+ * as for a file written any other way.
+ *
+ * baton:  an svnfs_uring_t
+ * return: SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+static svn_error_t *svnfs_uring_close(void *baton)
+{
+	svnfs_uring_t *u = baton;
+
+	svnfs_uring_flush(u);
+	while(u->inflight > 0)
+		svnfs_uring_reap(u, 1);
+
+	if(u->error)
+		return svn_error_wrap_apr(APR_FROM_OS_ERROR(-u->error),
+		                          "Could not write to cache file");
+
+	return SVN_NO_ERROR;
+}
+
+/*
+ * svnfs_uring_free
+ *
+ * Tears down the svnfs_uring_t of a thread which is exiting.
+ *
+ * data: the svnfs_uring_t
+ */
+static void svnfs_uring_free(void *data)
+{
+	svnfs_uring_t *u = data;
+
+	if(u->ready)
+	{
+		while(u->inflight > 0)
+			svnfs_uring_reap(u, 1);
+		io_uring_queue_exit(&u->ring);
+		free(u->base);
+	}
+	free(u);
+}
+
+/*
+ * svnfs_uring_get
+ *
+ * Finds the svnfs_uring_t of the calling thread, setting it up the first
+ * time.
+ *
+ * return: the svnfs_uring_t, or NULL if io_uring is unavailable
+ */
+static svnfs_uring_t *svnfs_uring_get(void)
+{
+	svnfs_uring_t *u;
+	void *data;
+	void *base;
+
+	if(apr_threadkey_private_get(&data, svnfs_uring_key) != APR_SUCCESS)
+		return NULL;
+	if(data)
+	{
+		u = data;
+		return u->ready ? u : NULL;
+	}
+
+	/* A thread where io_uring cannot be set up does not try again */
+	u = calloc(1, sizeof(*u));
+	if(!u)
+		return NULL;
+	if(apr_threadkey_private_set(u, svnfs_uring_key) != APR_SUCCESS)
+	{
+		free(u);
+		return NULL;
+	}
+
+	/* Aligned, so that the same buffers would do for direct I/O */
+	if(posix_memalign(&base, SVNFS_DIRECT_ALIGN,
+	                  SVNFS_URING_DEPTH * SVNFS_URING_BUFSIZE) != 0)
+		return NULL;
+	if(io_uring_queue_init(SVNFS_URING_DEPTH, &u->ring, 0) < 0)
+	{
+		free(base);
+		return NULL;
+	}
+	u->base = base;
+	u->ready = 1;
+
+	return u;
+}
+
+void svnfs_uring_drain(void)
+{
+	void *data;
+
+	if(apr_threadkey_private_get(&data, svnfs_uring_key) == APR_SUCCESS
+	   && data && ((svnfs_uring_t *)data)->ready)
+		while(((svnfs_uring_t *)data)->inflight > 0)
+			svnfs_uring_reap(data, 1);
+}
+
+svn_stream_t *svnfs_uring_stream(apr_file_t *file, apr_pool_t *pool)
+{
+	svnfs_uring_t *u;
+	svn_stream_t *stream;
+	apr_os_file_t fd;
+
+	u = svnfs_uring_get();
+	if(!u || apr_os_file_get(&fd, file) != APR_SUCCESS)
+		return svn_stream_from_aprfile(file, pool);
+
+	/* Writes left by a stream which failed still use the buffers */
+	while(u->inflight > 0)
+		svnfs_uring_reap(u, 1);
+	memset(u->busy, 0, sizeof(u->busy));
+	u->fd      = fd;
+	u->current = 0;
+	u->fill    = 0;
+	u->offset  = 0;
+	u->error   = 0;
+
+	stream = svn_stream_create(u, pool);
+	svn_stream_set_write(stream, svnfs_uring_write);
+	svn_stream_set_close(stream, svnfs_uring_close);
+
+	return stream;
+}
+
+int svnfs_uring_checksum(int fd, apr_uint64_t *checksum, apr_off_t *size)
+{
+	svnfs_uring_t *u;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	int res[SVNFS_URING_DEPTH];
+	apr_off_t offset;
+	void *base;
+	uintptr_t i;
+	int inflight;
+	int next;
+	int done;
+	int ret;
+
+	/* The thread's ring and buffers are free once any writes still in
+	 * flight from a failed fetch are done */
+	u = svnfs_uring_get();
+	if(!u)
+		return -ENOSYS;
+	while(u->inflight > 0)
+		svnfs_uring_reap(u, 1);
+	base = u->base;
+
+	/* Keep every buffer busy, but hash them in file order as they come in,
+	 * since the checksum depends on the order */
+	offset = 0;
+	inflight = 0;
+	for(i = 0; i < SVNFS_URING_DEPTH; i++)
+	{
+		sqe = io_uring_get_sqe(&u->ring);
+		io_uring_prep_read(sqe, fd, (char *)base + i * SVNFS_URING_BUFSIZE,
+		                   SVNFS_URING_BUFSIZE, offset);
+		io_uring_sqe_set_data(sqe, (void *)i);
+		res[i] = -EINPROGRESS;
+		offset += SVNFS_URING_BUFSIZE;
+		inflight++;
+	}
+	io_uring_submit(&u->ring);
+
+	*checksum = 14695981039346656037ULL;
+	*size = 0;
+	done = 0;
+	ret = 0;
+	for(next = 0; inflight > 0; next = (next + 1) % SVNFS_URING_DEPTH)
+	{
+		while(res[next] == -EINPROGRESS)
+		{
+			if(io_uring_wait_cqe(&u->ring, &cqe) < 0)
+			{
+				/* The kernel still owns the buffers, so they must leak,
+				 * and the thread goes without io_uring from now on */
+				io_uring_queue_exit(&u->ring);
+				u->ready = 0;
+				return -EIO;
+			}
+			i = (uintptr_t)io_uring_cqe_get_data(cqe);
+			res[i] = cqe->res;
+			io_uring_cqe_seen(&u->ring, cqe);
+			inflight--;
+		}
+
+		/* Past the end or an error, only drain what is left */
+		if(done)
+			continue;
+
+		if(res[next] < 0)
+		{
+			ret = res[next];
+			done = 1;
+			continue;
+		}
+
+		*checksum = svnfs_store_fnv(*checksum,
+		                            (char *)base + next * SVNFS_URING_BUFSIZE,
+		                            res[next]);
+		*size += res[next];
+		if(res[next] < SVNFS_URING_BUFSIZE)
+		{
+			done = 1;
+			continue;
+		}
+
+		sqe = io_uring_get_sqe(&u->ring);
+		io_uring_prep_read(sqe, fd, (char *)base + next * SVNFS_URING_BUFSIZE,
+		                   SVNFS_URING_BUFSIZE, offset);
+		io_uring_sqe_set_data(sqe, (void *)(uintptr_t)next);
+		res[next] = -EINPROGRESS;
+		offset += SVNFS_URING_BUFSIZE;
+		inflight++;
+		io_uring_submit(&u->ring);
+	}
+
+	return ret;
+}
+
+/* END ASYNCHRONOUS I/O }}}1 */
+#endif
+
+/* CACHE RULES {{{1 */
+
+/*
+ * svnfs_rule_revs
+ *
+ * Parses the revision part of a rule: N, N-M, N- or *.
+ *
+ * revs:   the text, which must be NUL-terminated after the revisions
+ * rule:   rule whose first_rev and last_rev to fill
+ * return: nonzero on success, zero if the text is malformed
+ */
+static int svnfs_rule_revs(const char *revs, svnfs_rule_t *rule)
+{
+	char *end;
+
+	if(strcmp(revs, "*") == 0)
+	{
+		rule->first_rev = 0;
+		rule->last_rev  = LONG_MAX;
+		return 1;
+	}
+
+	rule->first_rev = strtol(revs, &end, 10);
+	if(end == revs || rule->first_rev < 0)
+		return 0;
+
+	if(*end == '\0')
+	{
+		rule->last_rev = rule->first_rev;
+		return 1;
+	}
+
+	if(*end++ != '-')
+		return 0;
+
+	if(*end == '\0')
+	{
+		rule->last_rev = LONG_MAX;
+		return 1;
+	}
+
+	revs = end;
+	rule->last_rev = strtol(revs, &end, 10);
+
+	return end != revs && *end == '\0' && rule->last_rev >= rule->first_rev;
+}
+
+/*
+ * svnfs_rule_size
+ *
+ * Parses the size of a quota rule: a number of bytes, optionally followed by
+ * K, M or G.
+ *
+ * size:   the text
+ * rule:   rule whose quota to fill
+ * return: nonzero on success, zero if the text is malformed
+ */
+static int svnfs_rule_size(const char *size, svnfs_rule_t *rule)
+{
+	char *end;
+
+	rule->quota = apr_strtoi64(size, &end, 10);
+	if(end == size || rule->quota < 0)
+		return 0;
+
+	switch(*end)
+	{
+		case 'G': case 'g':
+			rule->quota *= 1024;
+			/* Fall through */
+		case 'M': case 'm':
+			rule->quota *= 1024;
+			/* Fall through */
+		case 'K': case 'k':
+			rule->quota *= 1024;
+			end++;
+			break;
+	}
+
+	return *end == '\0';
+}
+
+int svnfs_rule_parse(const char *text, apr_array_header_t **rules,
+                     apr_pool_t *pool)
+{
+	char *lines;
+	char *line;
+	char *line_state;
+	char *word_state;
+	char *verb;
+	char *spec;
+	char *size;
+	char *prefix;
+	svnfs_rule_t *rule;
+	apr_size_t len;
+
+	*rules = apr_array_make(pool, 4, sizeof(svnfs_rule_t *));
+	lines = apr_pstrdup(pool, text);
+
+	for(line = apr_strtok(lines, "\n", &line_state); line;
+	    line = apr_strtok(NULL, "\n", &line_state))
+	{
+		verb = apr_strtok(line, " \t\r", &word_state);
+		if(!verb || verb[0] == '#')
+			continue;
+
+		spec = apr_strtok(NULL, " \t\r", &word_state);
+		size = apr_strtok(NULL, " \t\r", &word_state);
+
+		rule = apr_pcalloc(pool, sizeof(*rule));
+		if(strcmp(verb, "pin") == 0 && spec && !size)
+			rule->pin = 1;
+		else if(strcmp(verb, "quota") == 0 && spec && size
+		        && svnfs_rule_size(size, rule))
+			rule->pin = 0;
+		else
+			goto malformed;
+
+		if(apr_strtok(NULL, " \t\r", &word_state) || spec[0] != '/')
+			goto malformed;
+
+		/* Split /REVS/PREFIX at the second slash */
+		prefix = strchr(spec + 1, '/');
+		if(prefix)
+		{
+			rule->prefix = apr_pstrdup(pool, prefix);
+			*prefix = '\0';
+		}
+		else
+		{
+			rule->prefix = "";
+		}
+		if(!svnfs_rule_revs(spec + 1, rule))
+			goto malformed;
+
+		len = strlen(rule->prefix);
+		while(len > 0 && rule->prefix[len - 1] == '/')
+			((char *)rule->prefix)[--len] = '\0';
+
+		*(svnfs_rule_t **)apr_array_push(*rules) = rule;
+		continue;
+
+	malformed:
+		printf("Malformed cache rule \"%s %s%s%s\"\n", verb,
+		       spec ? spec : "", size ? " " : "", size ? size : "");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+svnfs_rule_t *svnfs_rule_match(svn_revnum_t rev, const char *repos_path)
+{
+	svnfs_rule_t *rule;
+	apr_size_t len;
+	int i;
+
+	if(!svnfs_rules)
+		return NULL;
+
+	for(i = 0; i < svnfs_rules->nelts; i++)
+	{
+		rule = APR_ARRAY_IDX(svnfs_rules, i, svnfs_rule_t *);
+		if(rev < rule->first_rev || rev > rule->last_rev)
+			continue;
+
+		/* The prefix must match whole path components */
+		len = strlen(rule->prefix);
+		if(strncmp(repos_path, rule->prefix, len) == 0
+		   && (repos_path[len] == '/' || repos_path[len] == '\0'))
+			return rule;
+	}
+
+	return NULL;
+}
+
+int svnfs_rules_set(const char *text)
+{
+	apr_pool_t *new_pool;
+	apr_pool_t *old_pool;
+	apr_array_header_t *new_rules;
+	svnfs_rule_t *rule;
+	svnfs_cache_t *cache;
+	svnfs_cache_t *prev;
+
+	if(apr_pool_create(&new_pool, NULL) != APR_SUCCESS)
+		return -ENOMEM;
+
+	if(svnfs_rule_parse(text, &new_rules, new_pool) != 0)
+	{
+		apr_pool_destroy(new_pool);
+		return -EINVAL;
+	}
+
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		old_pool = svnfs_rules_pool;
+		svnfs_rules = new_rules;
+		svnfs_rules_pool = new_pool;
+
+		for(cache = svnfs_cache_head; cache; cache = cache->next)
+		{
+			cache->rule = svnfs_rule_match(cache->rev,
+			                               strchr(cache->key + 1, '/'));
+			if(cache->rule)
+			{
+				cache->rule->used += cache->size;
+				cache->rule->files++;
+			}
+		}
+
+		/* Bring every quota back within bounds, least recently used first */
+		for(cache = svnfs_cache_tail; cache; cache = prev)
+		{
+			prev = cache->prev;
+			rule = cache->rule;
+			if(rule && !rule->pin && rule->used > rule->quota
+			   && cache->refs == 0)
+				svnfs_cache_remove(cache);
+		}
+
+		svnfs_store_unpin();
+		svnfs_cache_evict();
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	if(old_pool)
+		apr_pool_destroy(old_pool);
+
+	return 0;
+}
+
+char *svnfs_rules_render(apr_pool_t *pool)
+{
+	svnfs_rule_t *rule;
+	svnfs_cache_t *cache;
+	apr_off_t other_used;
+	unsigned int other_files;
+	char *text;
+	char *revs;
+	int i;
+
+	text = "";
+	other_used = 0;
+	other_files = 0;
+
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		for(i = 0; svnfs_rules && i < svnfs_rules->nelts; i++)
+		{
+			rule = APR_ARRAY_IDX(svnfs_rules, i, svnfs_rule_t *);
+
+			if(rule->first_rev == 0 && rule->last_rev == LONG_MAX)
+				revs = "*";
+			else if(rule->first_rev == rule->last_rev)
+				revs = apr_psprintf(pool, "%ld", rule->first_rev);
+			else if(rule->last_rev == LONG_MAX)
+				revs = apr_psprintf(pool, "%ld-", rule->first_rev);
+			else
+				revs = apr_psprintf(pool, "%ld-%ld", rule->first_rev,
+				                    rule->last_rev);
+
+			text = apr_psprintf(pool, "%s# %" APR_OFF_T_FMT " bytes in %u "
+			                    "files\n", text, rule->used, rule->files);
+			if(rule->pin)
+				text = apr_psprintf(pool, "%spin /%s%s\n", text, revs,
+				                    rule->prefix);
+			else
+				text = apr_psprintf(pool, "%squota /%s%s %" APR_OFF_T_FMT
+				                    "\n", text, revs, rule->prefix,
+				                    rule->quota);
+		}
+
+		for(cache = svnfs_cache_head; cache; cache = cache->next)
+		{
+			if(!cache->rule)
+			{
+				other_used += cache->size;
+				other_files++;
+			}
+		}
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	return apr_psprintf(pool, "%s# %" APR_OFF_T_FMT " bytes in %u files under "
+	                    "no rule\n", text, other_used, other_files);
+}
+
+/* END CACHE RULES }}}1 */
+
+/* CONTROL FILES {{{1 */
+
+/*
+ * svnfs_ctl_append
+ *
+ * Appends text to the contents of an open control file.
+ *
+ * ctl:    the control file
+ * text:   text to append
+ * len:    length of text
+ * return: 0 on success, -ENOMEM on failure
+ */
+static int svnfs_ctl_append(svnfs_ctl_t *ctl, const char *text,
+                            apr_size_t len)
+{
+	apr_size_t size;
+	char *grown;
+
+	if(ctl->len + len + 1 > ctl->size)
+	{
+		for(size = ctl->size ? ctl->size : 4096; size < ctl->len + len + 1;
+		    size *= 2)
+			;
+		grown = realloc(ctl->buf, size);
+		if(!grown)
+			return -ENOMEM;
+		ctl->buf  = grown;
+		ctl->size = size;
+	}
+
+	memcpy(ctl->buf + ctl->len, text, len);
+	ctl->len += len;
+	ctl->buf[ctl->len] = '\0';
+
+	return 0;
+}
+
+/*
+ * svnfs_ctl_query
+ *
+ * Answers the query written to an open SVNFS_CTL_QUERY, replacing it with
+ * the answer.  The paths are taken a chunk at a time: all of a chunk's paths
+ * are expected up front, so that siblings share one listing of their
+ * parent, and then statted as one batch, so that the listings and stats
+ * still needed go to the repository together.  Must be called with
+ * ctl->lock held.
+ *
+ * ctl:    the control file
+ * return: 0 on success, -ENOMEM on failure
+ */
+static int svnfs_ctl_query(svnfs_ctl_t *ctl)
+{
+	svnfs_lib_stat_t *reqs;
+	apr_pool_t *subpool;
+	svn_revnum_t rev;
+	const char *repos_path;
+	char **lines;
+	char *question;
+	char *line;
+	char *next;
+	char *text;
+	char error[128];
+	int count;
+	int ret;
+	int i;
+
+	/* The answer goes where the question was */
+	question = ctl->buf;
+	ctl->buf  = NULL;
+	ctl->len  = 0;
+	ctl->size = 0;
+	ctl->dirty    = 0;
+	ctl->answered = 1;
+	if(!question)
+		return 0;
+
+	reqs  = malloc(SVNFS_QUERY_CHUNK * sizeof(*reqs));
+	lines = malloc(SVNFS_QUERY_CHUNK * sizeof(*lines));
+	if(!reqs || !lines || apr_pool_create(&subpool, NULL) != APR_SUCCESS)
+	{
+		free(reqs);
+		free(lines);
+		free(question);
+		return -ENOMEM;
+	}
+
+	ret  = 0;
+	next = question;
+	while(*next && ret == 0)
+	{
+		/* Gather a chunk of paths, warning the attribute cache of them */
+		for(count = 0; *next && count < SVNFS_QUERY_CHUNK; )
+		{
+			line = next;
+			next = strchr(line, '\n');
+			if(next)
+				*next++ = '\0';
+			else
+				next = line + strlen(line);
+			if(!*line)
+				continue;
+
+			lines[count] = line;
+			reqs[count++].path = apr_pstrcat(subpool,
+			                                 *line == '/' ? "" : "/", line,
+			                                 NULL);
+			if(svnfs_path_split(reqs[count - 1].path, &rev, &repos_path))
+				svnfs_attr_expect(repos_path, rev, subpool);
+		}
+
+		svnfs_lib_stat_many(reqs, count);
+
+		for(i = 0; i < count && ret == 0; i++)
+		{
+			if(reqs[i].result != 0)
+				text = apr_psprintf(subpool, "%s\terror\t%s\n", lines[i],
+				                    apr_strerror(APR_FROM_OS_ERROR(
+				                                 -reqs[i].result),
+				                                 error, sizeof(error)));
+			else
+				text = apr_psprintf(subpool, "%s\t%s\t%" APR_OFF_T_FMT
+				                    "\t%lu\t%lu\n", lines[i],
+				                    S_ISDIR(reqs[i].stbuf.st_mode)
+				                    ? "dir" : "file",
+				                    (apr_off_t)reqs[i].stbuf.st_size,
+				                    (unsigned long)reqs[i].stbuf.st_ino,
+				                    (unsigned long)reqs[i].stbuf.st_nlink);
+			ret = svnfs_ctl_append(ctl, text, strlen(text));
+		}
+
+		apr_pool_clear(subpool);
+	}
+
+	apr_pool_destroy(subpool);
+	free(reqs);
+	free(lines);
+	free(question);
+
+	return ret;
+}
+
+/*
+ * svnfs_ctl_stats
+ *
+ * Writes out the counters of the content cache, one "name value" pair to a
+ * line.
+ *
+ * pool:   pool from which to allocate the text
+ * return: the text
+ */
+static char *svnfs_ctl_stats(apr_pool_t *pool)
+{
+	char *text;
+
+	apr_thread_mutex_lock(svnfs_cache_lock);
+		text = apr_psprintf(pool,
+		                    "fetched_bytes %" APR_OFF_T_FMT "\n"
+		                    "fetched_files %u\n"
+		                    "cache_hits %u\n"
+		                    "cache_misses %u\n"
+		                    "cache_rejects %u\n"
+		                    "cache_bytes %" APR_OFF_T_FMT "\n"
+		                    "cache_files %u\n",
+		                    svnfs_cache_fetched, svnfs_cache_fetches,
+		                    svnfs_cache_hits, svnfs_cache_misses,
+		                    svnfs_cache_rejects, svnfs_cache_used,
+		                    apr_hash_count(svnfs_cache_files));
+	apr_thread_mutex_unlock(svnfs_cache_lock);
+
+	return text;
+}
+
+int svnfs_ctl_path(const char *path)
+{
+	return strcmp(path, SVNFS_CTL_RULES) == 0
+	       || strcmp(path, SVNFS_CTL_QUERY) == 0
+	       || strcmp(path, SVNFS_CTL_STATS) == 0;
+}
+
+int svnfs_ctl_open(const char *path, struct fuse_file_info *fi)
+{
+	svnfs_ctl_t *ctl;
+	apr_pool_t *subpool;
+	char *text;
+	int stats;
+
+	stats = strcmp(path, SVNFS_CTL_STATS) == 0;
+	if(stats && (fi->flags & O_ACCMODE) != O_RDONLY)
+		return -EACCES;
+
+	ctl = calloc(1, sizeof(*ctl));
+	if(!ctl)
+		return -ENOMEM;
+	if(apr_pool_create(&ctl->pool, NULL) != APR_SUCCESS)
+	{
+		free(ctl);
+		return -ENOMEM;
+	}
+	if(apr_thread_mutex_create(&ctl->lock, APR_THREAD_MUTEX_DEFAULT,
+	                           ctl->pool) != APR_SUCCESS)
+	{
+		apr_pool_destroy(ctl->pool);
+		free(ctl);
+		return -ENOMEM;
+	}
+	ctl->query = strcmp(path, SVNFS_CTL_QUERY) == 0;
+
+	if(!ctl->query && (fi->flags & O_ACCMODE) == O_RDONLY)
+	{
+		if(apr_pool_create(&subpool, NULL) != APR_SUCCESS)
+		{
+			apr_pool_destroy(ctl->pool);
+			free(ctl);
+			return -ENOMEM;
+		}
+		text = stats ? svnfs_ctl_stats(subpool) : svnfs_rules_render(subpool);
+		ctl->buf = strdup(text);
+		apr_pool_destroy(subpool);
+		if(!ctl->buf)
+		{
+			apr_pool_destroy(ctl->pool);
+			free(ctl);
+			return -ENOMEM;
+		}
+		ctl->len  = strlen(ctl->buf);
+		ctl->size = ctl->len + 1;
+	}
+
+	/* The contents are made up on open, so the size stat reports means
+	 * nothing; bypass the page cache */
+	fi->direct_io = 1;
+	fi->fh = (uint64_t)(uintptr_t)ctl;
+
+	return 0;
+}
+
+int svnfs_ctl_read(char *buf, size_t len, off_t offset,
+                   struct fuse_file_info *fi)
+{
+	svnfs_ctl_t *ctl = (svnfs_ctl_t *)(uintptr_t)fi->fh;
+	int ret;
+
+	/* Another reader of the same file may be answering the query, and then
+	 * this one waits for the answer */
+	apr_thread_mutex_lock(ctl->lock);
+		ret = 0;
+		if(ctl->query && !ctl->answered)
+		{
+			ret = svnfs_ctl_query(ctl);
+			ctl->origin = offset;
+		}
+
+		/* A writer reading on without seeking starts at the end of its
+		 * question, where the answer is served from; reading from before
+		 * there starts the answer over */
+		if(offset >= ctl->origin)
+			offset -= ctl->origin;
+
+		if(ret == 0 && offset < (off_t)ctl->len)
+		{
+			if(len > ctl->len - offset)
+				len = ctl->len - offset;
+			memcpy(buf, ctl->buf + offset, len);
+			ret = len;
+		}
+	apr_thread_mutex_unlock(ctl->lock);
+
+	return ret;
+}
+
+int svnfs_ctl_write(const char *buf, size_t len, off_t offset,
+                    struct fuse_file_info *fi)
+{
+	svnfs_ctl_t *ctl = (svnfs_ctl_t *)(uintptr_t)fi->fh;
+	apr_size_t size;
+	char *grown;
+
+	/* Control files are small, bar the manifests written to a query;
+	 * refuse anything silly */
+	if(offset < 0
+	   || offset + len > (ctl->query ? SVNFS_QUERY_MAX : 1024 * 1024))
+		return -EFBIG;
+
+	apr_thread_mutex_lock(ctl->lock);
+		/* Writing after the answer has been read asks a new question */
+		if(ctl->answered)
+		{
+			ctl->len = 0;
+			ctl->answered = 0;
+			ctl->origin = 0;
+		}
+
+		if(offset + len + 1 > ctl->size)
+		{
+			for(size = ctl->size ? ctl->size : 4096; size < offset + len + 1;
+			    size *= 2)
+				;
+			grown = realloc(ctl->buf, size);
+			if(!grown)
+			{
+				apr_thread_mutex_unlock(ctl->lock);
+				return -ENOMEM;
+			}
+			ctl->buf  = grown;
+			ctl->size = size;
+		}
+
+		if((apr_size_t)offset > ctl->len)
+			memset(ctl->buf + ctl->len, ' ', offset - ctl->len);
+		memcpy(ctl->buf + offset, buf, len);
+		if(offset + len > ctl->len)
+			ctl->len = offset + len;
+		ctl->buf[ctl->len] = '\0';
+		ctl->dirty = 1;
+	apr_thread_mutex_unlock(ctl->lock);
+
+	return len;
+}
+
+int svnfs_ctl_flush(struct fuse_file_info *fi)
+{
+	svnfs_ctl_t *ctl = (svnfs_ctl_t *)(uintptr_t)fi->fh;
+	int ret;
+
+	/* A query is answered when it is read, not when it is closed */
+	ret = 0;
+	apr_thread_mutex_lock(ctl->lock);
+		if(ctl->dirty && !ctl->query)
+		{
+			ctl->dirty = 0;
+			ret = svnfs_rules_set(ctl->buf ? ctl->buf : "");
+		}
+	apr_thread_mutex_unlock(ctl->lock);
+
+	return ret;
+}
+
+void svnfs_ctl_release(struct fuse_file_info *fi)
+{
+	svnfs_ctl_t *ctl = (svnfs_ctl_t *)(uintptr_t)fi->fh;
+
+	/* Nothing else can reach the file now, but a call may still be on its
+	 * way out */
+	apr_thread_mutex_lock(ctl->lock);
+		free(ctl->buf);
+	apr_thread_mutex_unlock(ctl->lock);
+
+	apr_pool_destroy(ctl->pool);
+	free(ctl);
+}
+
+/* END CONTROL FILES }}}1 */
+
+/* ATTRIBUTE CACHE {{{1 */
+
+/*
+ * svnfs_attr_put
+ *
+ * Adds an entry to one of the caches of a revision, or replaces one.  Must be
+ * called with svnfs_attr_lock held.
+ *
+ * attr_rev: the caches of the revision
+ * hash:     attr_rev->attrs or attr_rev->dirs
+ * key:      repository path of the entry
+ * val:      the svnfs_attr_t or svnfs_dir_t, allocated from attr_rev->pool
+ */
+static void svnfs_attr_put(svnfs_attr_rev_t *attr_rev, apr_hash_t *hash,
+                           const char *key, void *val)
+{
+	if(!apr_hash_get(hash, key, APR_HASH_KEY_STRING))
+	{
+		key = apr_pstrdup(attr_rev->pool, key);
+		attr_rev->entries++;
+		svnfs_attr_entries++;
+	}
+	apr_hash_set(hash, key, APR_HASH_KEY_STRING, val);
+}
+
+/*
+ * svnfs_attr_evict
+ *
+ * Throws away the caches of a revision.  Must be called with svnfs_attr_lock
+ * held.
+ *
+ * attr_rev: the caches of the revision, which must not be busy
+ */
+static void svnfs_attr_evict(svnfs_attr_rev_t *attr_rev)
+{
+	if(attr_rev->prev)
+		attr_rev->prev->next = attr_rev->next;
+	else
+		svnfs_attr_head = attr_rev->next;
+	if(attr_rev->next)
+		attr_rev->next->prev = attr_rev->prev;
+	else
+		svnfs_attr_tail = attr_rev->prev;
+
+	apr_hash_set(svnfs_attr_revs, &attr_rev->rev, sizeof(attr_rev->rev),
+	             NULL);
+	svnfs_attr_entries -= attr_rev->entries;
+	apr_pool_destroy(attr_rev->pool);
+}
+
+int svnfs_attr_get(const char *repos_path, svn_revnum_t rev,
+                   svnfs_attr_t *attr, apr_pool_t *subpool)
+{
+	char *parent_path;
+	const char *name;
+	svnfs_attr_rev_t *attr_rev;
+	svnfs_attr_t *cached;
+	svnfs_dir_t *dir;
+	svnfs_attr_t *new_attr;
+	svnfs_ra_op_t op;
+	svn_error_t *err;
+	int ret;
+	int list;
+	int gave_up;
+
+	memset(&op, 0, sizeof(op));
+
+	/* The revision root has no parent to list */
+	name = strrchr(repos_path, '/') + 1;
+	parent_path = NULL;
+	if(*name)
+		parent_path = (name - repos_path == 1)
+		              ? "/"
+		              : apr_pstrmemdup(subpool, repos_path,
+		                               name - repos_path - 1);
+
+	/* Set once a listing of the parent has failed in front of us, after
+	 * which we stat the path by itself rather than list again */
+	gave_up = 0;
+	for(;;)
+	{
+		dir = NULL;
+		list = 0;
+
+		apr_thread_mutex_lock(svnfs_attr_lock);
+			for(;;)
+			{
+				attr_rev = svnfs_attr_rev(rev);
+				cached = apr_hash_get(attr_rev->attrs, repos_path,
+				                      APR_HASH_KEY_STRING);
+				if(cached && (cached->fields & SVNFS_ATTR_FIELDS)
+				             == SVNFS_ATTR_FIELDS)
+				{
+					*attr = *cached;
+					apr_thread_mutex_unlock(svnfs_attr_lock);
+					return 0;
+				}
+
+				if(!parent_path)
+					break;
+
+				dir = svnfs_dir_get(parent_path, rev);
+				if(dir->children
+				   && !apr_hash_get(dir->children, name, APR_HASH_KEY_STRING))
+				{
+					/* The parent was listed and this wasn't in it */
+					*attr = svnfs_attr_none;
+					apr_thread_mutex_unlock(svnfs_attr_lock);
+					return 0;
+				}
+
+				if(dir->listing)
+				{
+					/* Someone is listing the parent; wait for the answer */
+					apr_thread_cond_wait(svnfs_attr_cond, svnfs_attr_lock);
+					gave_up = !dir->listing && !dir->children;
+					continue;
+				}
+
+				/* A directory that has been read is usually about to have
+				 * every child statted (ls -l, find), so seed them all */
+				dir->misses++;
+				if(svnfs_ctx.stat_batch > 0 && !dir->unlistable && !gave_up
+				   && (dir->children || dir->pending > 0
+				       || dir->misses >= svnfs_ctx.stat_batch))
+				{
+					dir->listing = 1;
+					list = 1;
+				}
+				else
+				{
+					dir->pending++;
+				}
+
+				/* Keep the directory from being evicted until we are done */
+				dir->attr_rev->busy++;
+				break;
+			}
+		apr_thread_mutex_unlock(svnfs_attr_lock);
+
+		if(!list)
+			break;
+
+		/* List the parent, then go around again to pick up the answer */
+		svnfs_note("Listing '%s@@%ld' for stat misses\n", parent_path, rev);
+		op.kind   = SVNFS_RA_DIR;
+		op.path   = parent_path;
+		op.rev    = rev;
+		op.fields = SVNFS_ATTR_FIELDS;
+		err = svnfs_ra_execute(&op, subpool);
+
+		apr_thread_mutex_lock(svnfs_attr_lock);
+			dir->listing = 0;
+			dir->attr_rev->busy--;
+			/* Only a listing that can never work is given up on; after
+			 * a timeout or a broken connection the misses start over */
+			if(err == SVN_NO_ERROR)
+				svnfs_dir_store(dir, parent_path, op.dirents,
+				                SVNFS_ATTR_FIELDS, subpool);
+			else if(svnfs_ra_missing(err))
+				dir->unlistable = 1;
+			else
+				dir->misses = 0;
+			apr_thread_cond_broadcast(svnfs_attr_cond);
+		apr_thread_mutex_unlock(svnfs_attr_lock);
+
+		if(err != SVN_NO_ERROR)
+		{
+			/* Fall back on statting this path by itself */
+			svn_handle_error2(err, stderr, FALSE, "svnfs: ");
+			svn_error_clear(err);
+			gave_up = 1;
+		}
+	}
+
+	svnfs_note("Attempting to stat '%s@@%ld'\n", repos_path, rev);
+	op.kind = SVNFS_RA_STAT;
+	op.path = repos_path;
+	op.rev  = rev;
+	err = svnfs_ra_execute(&op, subpool);
+
+	apr_thread_mutex_lock(svnfs_attr_lock);
+		if(dir)
+		{
+			dir->pending--;
+			dir->attr_rev->busy--;
+		}
+
+		if(err == SVN_NO_ERROR)
+		{
+			attr_rev = svnfs_attr_rev(rev);
+			new_attr = apr_hash_get(attr_rev->attrs, repos_path,
+			                        APR_HASH_KEY_STRING);
+			if(!op.dirent)
+			{
+				new_attr = &svnfs_attr_none;
+				svnfs_attr_put(attr_rev, attr_rev->attrs, repos_path,
+				               new_attr);
+			}
+			else
+			{
+				/* A partial entry is shared with the parent's listing, so
+				 * fill it in where it is rather than replacing it */
+				if(!new_attr || new_attr == &svnfs_attr_none)
+				{
+					new_attr = apr_palloc(attr_rev->pool, sizeof(*new_attr));
+					svnfs_attr_put(attr_rev, attr_rev->attrs, repos_path,
+					               new_attr);
+				}
+				new_attr->kind        = op.dirent->kind;
+				new_attr->size        = op.dirent->size;
+				new_attr->created_rev = op.dirent->created_rev;
+				new_attr->fields      = SVNFS_ATTR_FIELDS;
+			}
+			*attr = *new_attr;
+		}
+	apr_thread_mutex_unlock(svnfs_attr_lock);
+
+	if(err != SVN_NO_ERROR)
+	{
+		svn_handle_error2(err, stderr, FALSE, "svnfs: ");
+		ret = svnfs_ra_errno(err, -EPIPE);
+		svn_error_clear(err);
+		return ret;
+	}
+
+	return 0;
+}
+
+void svnfs_attr_expect(const char *repos_path, svn_revnum_t rev,
+                       apr_pool_t *subpool)
+{
+	char *parent_path;
+	const char *name;
+	svnfs_attr_rev_t *attr_rev;
+	svnfs_attr_t *attr;
+	svnfs_dir_t *dir;
+
+	/* The revision root has no parent to list */
+	name = strrchr(repos_path, '/') + 1;
+	if(!*name)
+		return;
+	parent_path = (name - repos_path == 1)
+	              ? "/"
+	              : apr_pstrmemdup(subpool, repos_path, name - repos_path - 1);
+
+	apr_thread_mutex_lock(svnfs_attr_lock);
+		attr_rev = svnfs_attr_rev(rev);
+		attr = apr_hash_get(attr_rev->attrs, repos_path, APR_HASH_KEY_STRING);
+		if(!attr || (attr->fields & SVNFS_ATTR_FIELDS) != SVNFS_ATTR_FIELDS)
+		{
+			dir = svnfs_dir_get(parent_path, rev);
+			dir->misses++;
+		}
+	apr_thread_mutex_unlock(svnfs_attr_lock);
+}
+
+svnfs_attr_rev_t *svnfs_attr_rev(svn_revnum_t rev)
+{
+	svnfs_attr_rev_t *attr_rev;
+	svnfs_attr_rev_t *victim;
+	svnfs_attr_rev_t *prev;
+	apr_pool_t *rev_pool;
+
+	attr_rev = apr_hash_get(svnfs_attr_revs, &rev, sizeof(rev));
+	if(!attr_rev)
+	{
+		if(apr_pool_create(&rev_pool, NULL) != APR_SUCCESS)
+			abort();
+		attr_rev = apr_pcalloc(rev_pool, sizeof(*attr_rev));
+		attr_rev->rev   = rev;
+		attr_rev->pool  = rev_pool;
+		attr_rev->attrs = apr_hash_make(rev_pool);
+		attr_rev->dirs  = apr_hash_make(rev_pool);
+		apr_hash_set(svnfs_attr_revs, &attr_rev->rev, sizeof(attr_rev->rev),
+		             attr_rev);
+	}
+	else if(attr_rev != svnfs_attr_head)
+	{
+		/* Unlink it, to be put back at the head */
+		attr_rev->prev->next = attr_rev->next;
+		if(attr_rev->next)
+			attr_rev->next->prev = attr_rev->prev;
+		else
+			svnfs_attr_tail = attr_rev->prev;
+	}
+
+	if(attr_rev != svnfs_attr_head)
+	{
+		attr_rev->prev = NULL;
+		attr_rev->next = svnfs_attr_head;
+		if(svnfs_attr_head)
+			svnfs_attr_head->prev = attr_rev;
+		svnfs_attr_head = attr_rev;
+		if(!svnfs_attr_tail)
+			svnfs_attr_tail = attr_rev;
+	}
+
+	/* Make room from the least recently used end, sparing revisions that
+	 * someone is still using */
+	for(victim = svnfs_attr_tail;
+	    victim && svnfs_attr_entries > (apr_size_t)svnfs_ctx.attr_size * 1000;
+	    victim = prev)
+	{
+		prev = victim->prev;
+		if(victim != attr_rev && !victim->busy)
+			svnfs_attr_evict(victim);
+	}
+
+	return attr_rev;
+}
+
+svnfs_dir_t *svnfs_dir_get(const char *repos_path, svn_revnum_t rev)
+{
+	svnfs_attr_rev_t *attr_rev;
+	svnfs_dir_t *dir;
+
+	attr_rev = svnfs_attr_rev(rev);
+	dir = apr_hash_get(attr_rev->dirs, repos_path, APR_HASH_KEY_STRING);
+	if(!dir)
+	{
+		dir = apr_pcalloc(attr_rev->pool, sizeof(*dir));
+		dir->attr_rev = attr_rev;
+		svnfs_attr_put(attr_rev, attr_rev->dirs, repos_path, dir);
+	}
+
+	return dir;
+}
+
+void svnfs_dir_store(svnfs_dir_t *dir, const char *repos_path,
+                     apr_hash_t *dirents, apr_uint32_t fields,
+                     apr_pool_t *pool)
+{
+	svnfs_attr_rev_t *attr_rev = dir->attr_rev;
+	apr_hash_index_t *iter;
+	const char *name;
+	svn_dirent_t *dirent;
+	svnfs_attr_t *attr;
+	char *key;
+
+	/* Avoid a doubled slash for children of the revision root */
+	if(strcmp(repos_path, "/") == 0)
+		repos_path = "";
+
+	if(!dir->children)
+		dir->children = apr_hash_make(attr_rev->pool);
+
+	for(iter = apr_hash_first(pool, dirents); iter;
+	    iter = apr_hash_next(iter))
+	{
+		apr_hash_this(iter, (const void **)(&name), NULL, (void **)(&dirent));
+
+		/* Share one svnfs_attr_t between the listing and the attribute
+		 * cache, so that filling in more fields later updates both */
+		attr = apr_hash_get(dir->children, name, APR_HASH_KEY_STRING);
+		if(!attr)
+		{
+			key = apr_psprintf(pool, "%s/%s", repos_path, name);
+			attr = apr_hash_get(attr_rev->attrs, key, APR_HASH_KEY_STRING);
+			if(!attr || attr == &svnfs_attr_none)
+			{
+				attr = apr_pcalloc(attr_rev->pool, sizeof(*attr));
+				svnfs_attr_put(attr_rev, attr_rev->attrs, key, attr);
+			}
+			apr_hash_set(dir->children, apr_pstrdup(attr_rev->pool, name),
+			             APR_HASH_KEY_STRING, attr);
+		}
+
+		if(fields & SVN_DIRENT_KIND)
+			attr->kind = dirent->kind;
+		if(fields & SVN_DIRENT_SIZE)
+			attr->size = dirent->size;
+		if(fields & SVN_DIRENT_CREATED_REV)
+			attr->created_rev = dirent->created_rev;
+		attr->fields |= fields;
+	}
+
+	dir->fields |= fields;
+}
+
+void svnfs_attr_fill(struct stat *stbuf, const char *repos_path,
+                     const svnfs_attr_t *attr)
+{
+	stbuf->st_size    = attr->size;
+	stbuf->st_blocks  = (attr->size + 511) / 512;
+	stbuf->st_blksize = SVNFS_BLKSIZE;
+	stbuf->st_ino  = svnfs_ino(repos_path, attr->created_rev);
+	switch(attr->kind)
+	{
+		case svn_node_file:
+			stbuf->st_mode  = S_IFREG | 0644;
+			stbuf->st_nlink = 1;
+			break;
+		case svn_node_dir:
+			/* We do not count subdirectories, so report the minimum, as
+			 * file systems without link counts do */
+			stbuf->st_mode  = S_IFDIR | 0755;
+			stbuf->st_nlink = 2;
+			break;
+		default:
+			stbuf->st_mode  = S_IFREG | 0000;
+			stbuf->st_nlink = 1;
+			break;
+	}
+}
+
+/* END ATTRIBUTE CACHE }}}1 */
+
+/* REPOSITORY ACCESS {{{1 */
+
+svn_error_t *svnfs_ra_open(svn_ra_session_t **session, apr_pool_t *pool)
+{
+	return svn_ra_open2(session, svnfs_repository, svnfs_ra_callbacks, NULL,
+	                    svnfs_ra_config, pool);
+}
+
+/*
+ * svnfs_ra_due
+ *
+ * Works out when a request must be answered by, given the time it has spent
+ * throttled so far; a background fetch crawling along at the rate limit is
+ * not the stalled transfer its deadline is there to catch.
+ *
+ * call:   the request
+ * return: the deadline, or 0 for none
+ */
+static apr_time_t svnfs_ra_due(svnfs_ra_call_t *call)
+{
+	if(!call->deadline)
+		return 0;
+
+	return call->deadline
+	       + (apr_time_t)apr_atomic_read32(&call->throttled) * 1000;
+}
+
+/*
+ * svnfs_ra_cancel
+ *
+ * The cancellation callback of every session.  Looks up the request the
+ * calling thread is running, and cancels it if nobody wants its answer any
+ * more or it has passed its deadline.
+ *
+ * baton:  unused
+ * return: SVN_NO_ERROR to carry on, or an SVN_ERR_CANCELLED or APR_TIMEUP
+ *         error to stop
+ */
+static svn_error_t *svnfs_ra_cancel(void *baton)
+{
+	void *data;
+	svnfs_ra_call_t *call;
+
+	if(apr_threadkey_private_get(&data, svnfs_ra_call_key) != APR_SUCCESS)
+		return SVN_NO_ERROR;
+	call = data;
+
+	if(!call)
+		return SVN_NO_ERROR;
+
+	if(apr_atomic_read32(&call->cancelled))
+		return svn_error_create(SVN_ERR_CANCELLED, NULL,
+		                        "Request answered elsewhere");
+
+	if(call->deadline && apr_time_now() > svnfs_ra_due(call))
+		return svn_error_create(APR_TIMEUP, NULL, "Request took too long");
+
+	return SVN_NO_ERROR;
+}
+
+/*
+ * svnfs_bucket_refill
+ *
+ * Tops up a token bucket for the time since it was last topped up.  Must be
+ * called with svnfs_bucket_lock held.
+ *
+ * bucket: the bucket
+ * now:    the current time
+ */
+static void svnfs_bucket_refill(svnfs_bucket_t *bucket, apr_time_t now)
+{
+	bucket->tokens += bucket->rate * (now - bucket->stamp) / APR_USEC_PER_SEC;
+	if(bucket->tokens > bucket->rate)
+		bucket->tokens = bucket->rate;
+	bucket->stamp = now;
+}
+
+/*
+ * svnfs_bucket_wait
+ *
+ * Works out how long a bucket needs to get out of debt.  Must be called with
+ * svnfs_bucket_lock held.
+ *
+ * bucket: the bucket, which has just been topped up
+ * return: microseconds to wait, or 0 if tokens may be taken now
+ */
+static apr_interval_time_t svnfs_bucket_wait(const svnfs_bucket_t *bucket)
+{
+	if(bucket->rate <= 0 || bucket->tokens >= 0)
+		return 0;
+
+	return -bucket->tokens * APR_USEC_PER_SEC / bucket->rate + 1;
+}
+
+/*
+ * svnfs_bucket_take
+ *
+ * Takes tokens from a bucket, letting it go into debt by up to a second's
+ * worth.  Must be called with svnfs_bucket_lock held.
+ *
+ * bucket: the bucket
+ * len:    number of tokens
+ */
+static void svnfs_bucket_take(svnfs_bucket_t *bucket, apr_size_t len)
+{
+	if(bucket->rate <= 0)
+		return;
+
+	bucket->tokens -= len;
+	if(bucket->tokens < -bucket->rate)
+		bucket->tokens = -bucket->rate;
+}
+
+/*
+ * svnfs_throttle_baton_t
+ *
+ * Baton for svnfs_throttle_write and svnfs_throttle_close.
+ */
+typedef struct svnfs_throttle_baton_t
+{
+	/* Stream to which the contents are passed on */
+	svn_stream_t *stream;
+
+	/* The request streaming the contents */
+	svnfs_ra_op_t *op;
+} svnfs_throttle_baton_t;
+
+/*
+ * svnfs_throttle_write
+ *
+ * Writes file contents through to the underlying stream at the rate the
+ * token buckets allow.  Demand requests, and background requests someone
+ * has marked urgent, are charged to the mount bucket but never wait.
+ *
+ * baton:  an svnfs_throttle_baton_t
+ * data:   the contents
+ * len:    pointer to the length of data; receives the length written
+ * return: SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+static svn_error_t *svnfs_throttle_write(void *baton, const char *data,
+                                         apr_size_t *len)
+{
+	svnfs_throttle_baton_t *tb = baton;
+	apr_interval_time_t wait;
+	apr_interval_time_t background_wait;
+	svnfs_ra_call_t *call;
+	apr_time_t now;
+	void *key_data;
+	int exempt;
+
+	call = NULL;
+	if(apr_threadkey_private_get(&key_data, svnfs_ra_call_key) == APR_SUCCESS)
+		call = key_data;
+
+	for(;;)
+	{
+		apr_thread_mutex_lock(svnfs_bucket_lock);
+			/* The flag belongs to the caller, which clears the pointer
+			 * under this lock if it stops waiting */
+			exempt = tb->op->priority == SVNFS_RA_DEMAND
+			         || (tb->op->urgent && apr_atomic_read32(tb->op->urgent));
+
+			now = apr_time_now();
+			svnfs_bucket_refill(&svnfs_bucket_mount, now);
+			svnfs_bucket_refill(&svnfs_bucket_background, now);
+
+			wait = 0;
+			if(!exempt)
+			{
+				wait = svnfs_bucket_wait(&svnfs_bucket_mount);
+				background_wait = svnfs_bucket_wait(&svnfs_bucket_background);
+				if(background_wait > wait)
+					wait = background_wait;
+			}
+
+			if(wait == 0)
+			{
+				svnfs_bucket_take(&svnfs_bucket_mount, *len);
+				if(!exempt)
+					svnfs_bucket_take(&svnfs_bucket_background, *len);
+			}
+		apr_thread_mutex_unlock(svnfs_bucket_lock);
+
+		if(wait == 0)
+			break;
+
+		/* Sleep in short steps, so that being made urgent, cancelled or
+		 * timed out takes effect promptly */
+		if(wait > apr_time_from_sec(1))
+			wait = apr_time_from_sec(1);
+		apr_sleep(wait);
+
+		/* Time spent waiting for the rate limit is not the server's */
+		if(call)
+			apr_atomic_add32(&call->throttled, (apr_uint32_t)(wait / 1000));
+		SVN_ERR(svnfs_ra_cancel(NULL));
+	}
+
+	return svn_stream_write(tb->stream, data, len);
+}
+
+/*
+ * svnfs_throttle_close
+ *
+ * Closes the underlying stream.
+ *
+ * baton:  an svnfs_throttle_baton_t
+ * return: SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+static svn_error_t *svnfs_throttle_close(void *baton)
+{
+	svnfs_throttle_baton_t *tb = baton;
+
+	return svn_stream_close(tb->stream);
+}
+
+/*
+ * svnfs_sink_baton_t
+ *
+ * Baton for svnfs_sink_write and svnfs_sink_close.
+ */
+typedef struct svnfs_sink_baton_t
+{
+	/* Stream to which the contents are passed on */
+	svn_stream_t *stream;
+
+	/* The request streaming the contents */
+	svnfs_ra_op_t *op;
+
+	/* Bytes written by this attempt, and their checksum */
+	apr_off_t written;
+	apr_uint64_t checksum;
+} svnfs_sink_baton_t;
+
+/*
+ * svnfs_sink_write
+ *
+ * Writes file contents through to the underlying stream, hashing them on
+ * the way if the request wants their checksum, and telling anyone reading
+ * the file as it arrives how far it has got.  An attempt that follows a
+ * failed one writes the same contents over those already there, so progress
+ * only counts once it passes the earlier attempt.
+ *
+ * baton:  an svnfs_sink_baton_t
+ * data:   the contents
+ * len:    pointer to the length of data; receives the length written
+ * return: SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+static svn_error_t *svnfs_sink_write(void *baton, const char *data,
+                                     apr_size_t *len)
+{
+	svnfs_sink_baton_t *pb = baton;
+	svnfs_ra_op_t *op = pb->op;
+
+	SVN_ERR(svn_stream_write(pb->stream, data, len));
+	pb->written += *len;
+	if(op->hashed)
+		pb->checksum = svnfs_store_fnv(pb->checksum, data, *len);
+
+	if(!op->streamed)
+		return SVN_NO_ERROR;
+
+	if(!op->progress_lock)
+	{
+		op->progress = pb->written;
+		return SVN_NO_ERROR;
+	}
+
+	apr_thread_mutex_lock(op->progress_lock);
+		if(pb->written > op->progress)
+		{
+			op->progress = pb->written;
+			apr_thread_cond_broadcast(op->progress_cond);
+		}
+	apr_thread_mutex_unlock(op->progress_lock);
+
+	return SVN_NO_ERROR;
+}
+
+/*
+ * svnfs_sink_close
+ *
+ * Closes the underlying stream, and hands the checksum of what was written
+ * to the request once the last of it is known to be there.
+ *
+ * baton:  an svnfs_sink_baton_t
+ * return: SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+static svn_error_t *svnfs_sink_close(void *baton)
+{
+	svnfs_sink_baton_t *pb = baton;
+
+	SVN_ERR(svn_stream_close(pb->stream));
+	pb->op->checksum = pb->checksum;
+
+	return SVN_NO_ERROR;
+}
+
+/*
+ * svnfs_ra_run
+ *
+ * Makes a single attempt at a repository request.
+ *
+ * session: the session on which to make the request
+ * op:      the request
+ * pool:    pool from which results are allocated
+ * return:  SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+static svn_error_t *svnfs_ra_run(svn_ra_session_t *session, svnfs_ra_op_t *op,
+                                 apr_pool_t *pool)
+{
+	apr_array_header_t *log_paths;
+	svnfs_throttle_baton_t *tb;
+	svnfs_sink_baton_t *pb;
+	svn_stream_t *stream;
+	apr_off_t offset;
+	apr_status_t apr_err;
+
+	switch(op->kind)
+	{
+		case SVNFS_RA_LATEST:
+			return svn_ra_get_latest_revnum(session, &op->latest, pool);
+
+		case SVNFS_RA_STAT:
+			return svn_ra_stat(session, op->path, op->rev, &op->dirent, pool);
+
+		case SVNFS_RA_DIR:
+			return svn_ra_get_dir2(session, &op->dirents, NULL, NULL, op->path,
+			                       op->rev, op->fields, pool);
+
+		case SVNFS_RA_FILE:
+			/* Throw away whatever an earlier attempt managed to write,
+			 * unless someone may be reading it, once it has stopped
+			 * writing */
+#ifdef SVNFS_HAVE_IO_URING
+			svnfs_uring_drain();
+#endif
+			offset = 0;
+			apr_err = APR_SUCCESS;
+			if(!op->streamed)
+				apr_err = apr_file_trunc(op->file, 0);
+			if(apr_err == APR_SUCCESS)
+				apr_err = apr_file_seek(op->file, APR_SET, &offset);
+			if(apr_err != APR_SUCCESS)
+				return svn_error_wrap_apr(apr_err, "Could not truncate file");
+
+			/* Writes through io_uring land out of order, so the contents
+			 * would not be readable up to the progress made */
+#ifdef SVNFS_HAVE_IO_URING
+			if(!op->streamed)
+				stream = svnfs_uring_stream(op->file, pool);
+			else
+#endif
+			stream = svn_stream_from_aprfile(op->file, pool);
+			if(op->streamed || op->hashed)
+			{
+				pb = apr_pcalloc(pool, sizeof(*pb));
+				pb->stream   = stream;
+				pb->op       = op;
+				pb->checksum = 14695981039346656037ULL;
+				stream = svn_stream_create(pb, pool);
+				svn_stream_set_write(stream, svnfs_sink_write);
+				svn_stream_set_close(stream, svnfs_sink_close);
+			}
+			if(svnfs_bucket_mount.rate > 0
+			   || (op->priority == SVNFS_RA_BACKGROUND
+			       && svnfs_bucket_background.rate > 0))
+			{
+				tb = apr_palloc(pool, sizeof(*tb));
+				tb->stream = stream;
+				tb->op     = op;
+				stream = svn_stream_create(tb, pool);
+				svn_stream_set_write(stream, svnfs_throttle_write);
+				svn_stream_set_close(stream, svnfs_throttle_close);
+			}
+			SVN_ERR(svn_ra_get_file(session, op->path, op->rev, stream, NULL,
+			                        NULL, pool));
+			return svn_stream_close(stream);
+
+		case SVNFS_RA_LOG:
+			log_paths = apr_array_make(pool, 1, sizeof(const char *));
+			*(const char **)apr_array_push(log_paths) = op->path;
+			return svn_ra_get_log(session, log_paths, op->rev, op->end_rev, 0,
+			                      TRUE, FALSE, op->receiver, op->receiver_baton,
+			                      pool);
+	}
+
+	return svn_error_create(SVN_ERR_INCORRECT_PARAMS, NULL,
+	                        "Unknown repository request");
+}
+
+/*
+ * svnfs_ra_broken
+ *
+ * Determines whether an error means the connection to the repository broke,
+ * as opposed to the request itself being bad.
+ *
+ * err:    the error
+ * return: nonzero if reopening the session may help, zero otherwise
+ */
+static int svnfs_ra_broken(svn_error_t *err)
+{
+	for(; err; err = err->child)
+	{
+		switch(err->apr_err)
+		{
+			case SVN_ERR_RA_SVN_CONNECTION_CLOSED:
+			case SVN_ERR_RA_SVN_IO_ERROR:
+			case SVN_ERR_RA_DAV_SOCK_INIT:
+			case SVN_ERR_RA_DAV_REQUEST_FAILED:
+				return 1;
+		}
+
+		if(APR_STATUS_IS_ECONNRESET(err->apr_err)
+		   || APR_STATUS_IS_ECONNREFUSED(err->apr_err)
+		   || APR_STATUS_IS_ETIMEDOUT(err->apr_err)
+		   || APR_STATUS_IS_EPIPE(err->apr_err)
+		   || APR_STATUS_IS_EOF(err->apr_err))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * svnfs_ra_backoff
+ *
+ * Sleeps before a retry.  The delay is drawn uniformly from zero up to
+ * svnfs_ctx.ra_backoff milliseconds doubled once per earlier retry, capped
+ * at ten seconds, so that many threads hitting the same outage do not all
+ * come back at once.  Never sleeps past the request's deadline.
+ *
+ * attempt:  number of attempts that have failed so far, less one
+ * deadline: time past which not to sleep, or 0 for none
+ */
+static void svnfs_ra_backoff(int attempt, apr_time_t deadline)
+{
+	apr_interval_time_t limit;
+	apr_uint32_t seed;
+
+	limit = (apr_interval_time_t)svnfs_ctx.ra_backoff * 1000;
+	while(attempt-- > 0 && limit < apr_time_from_sec(10))
+		limit *= 2;
+	if(limit > apr_time_from_sec(10))
+		limit = apr_time_from_sec(10);
+	if(limit <= 0)
+		return;
+
+	/* Any per-thread variation will do; this is not for security */
+	seed = (apr_uint32_t)apr_time_now() ^ (apr_uint32_t)(uintptr_t)&seed;
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	if(deadline && limit > deadline - apr_time_now())
+		limit = deadline - apr_time_now();
+	if(limit <= 0)
+		return;
+
+	apr_sleep(seed % limit);
+}
+
+/*
+ * svnfs_ra_reconnect
+ *
+ * Replaces a connection's session with a freshly opened one.  Also opens the
+ * session in the first place.  The caches are left alone; they describe the
+ * repository, not the session.
+ *
+ * conn:   the connection
+ * return: SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+static svn_error_t *svnfs_ra_reconnect(svnfs_ra_conn_t *conn)
+{
+	apr_pool_t *new_pool;
+	svn_ra_session_t *new_session;
+	apr_status_t apr_err;
+	svn_error_t *err;
+
+	if(conn->session)
+		printf("Reopening %s session after %u failures\n", conn->name,
+		       apr_atomic_read32(&svnfs_ra_failures));
+	else
+		svnfs_note("Opening %s session\n", conn->name);
+
+	apr_err = apr_pool_create(&new_pool, NULL);
+	if(apr_err != APR_SUCCESS)
+		return svn_error_wrap_apr(apr_err, "Could not create pool");
+
+	err = svnfs_ra_open(&new_session, new_pool);
+	if(err != SVN_NO_ERROR)
+	{
+		apr_pool_destroy(new_pool);
+		return err;
+	}
+
+	if(conn->pool)
+		apr_pool_destroy(conn->pool);
+	conn->pool = new_pool;
+	conn->session = new_session;
+
+	return SVN_NO_ERROR;
+}
+
+/*
+ * svnfs_ra_abandoned
+ *
+ * Determines whether a request was stopped by svnfs_ra_cancel, in which case
+ * the session it ran on is part way through an answer.
+ *
+ * err:    the error
+ * return: nonzero if the request was cancelled or timed out, zero otherwise
+ */
+static int svnfs_ra_abandoned(svn_error_t *err)
+{
+	for(; err; err = err->child)
+		if(err->apr_err == SVN_ERR_CANCELLED
+		   || APR_STATUS_IS_TIMEUP(err->apr_err))
+			return 1;
+
+	return 0;
+}
+
+int svnfs_ra_missing(svn_error_t *err)
+{
+	for(; err; err = err->child)
+		switch(err->apr_err)
+		{
+			case SVN_ERR_FS_NOT_FOUND:
+			case SVN_ERR_FS_NOT_DIRECTORY:
+			case SVN_ERR_FS_NO_SUCH_REVISION:
+			case SVN_ERR_RA_DAV_PATH_NOT_FOUND:
+				return 1;
+		}
+
+	return 0;
+}
+
+int svnfs_ra_errno(svn_error_t *err, int fallback)
+{
+	for(; err; err = err->child)
+		if(APR_STATUS_IS_TIMEUP(err->apr_err))
+			return -ETIMEDOUT;
+
+	return fallback;
+}
+
+/*
+ * svnfs_ra_deadline
+ *
+ * Works out when a request must be answered by.
+ *
+ * kind:   the kind of request
+ * return: the deadline, or 0 if the request may take as long as it likes
+ */
+static apr_time_t svnfs_ra_deadline(svnfs_ra_kind_t kind)
+{
+	int timeout;
+
+	switch(kind)
+	{
+		case SVNFS_RA_FILE:
+			timeout = svnfs_ctx.timeout_file;
+			break;
+		case SVNFS_RA_LOG:
+			timeout = svnfs_ctx.timeout_log;
+			break;
+		default:
+			timeout = svnfs_ctx.timeout_meta;
+			break;
+	}
+
+	if(timeout <= 0)
+		return 0;
+
+	return apr_time_now() + apr_time_from_sec(timeout);
+}
+
+/*
+ * svnfs_ra_retry
+ *
+ * Runs a request on a connection's session, reopening the session and
+ * retrying if the connection breaks, until the request's deadline.  A request
+ * that is cancelled part way through leaves the session in an unknown state,
+ * so the session is reopened then too.
+ *
+ * conn:   the connection
+ * op:     the request
+ * call:   cancellation state and deadline for the request
+ * pool:   pool from which results are allocated
+ * return: SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+static svn_error_t *svnfs_ra_retry(svnfs_ra_conn_t *conn, svnfs_ra_op_t *op,
+                                   svnfs_ra_call_t *call, apr_pool_t *pool)
+{
+	svn_error_t *err;
+	svn_error_t *reconnect_err;
+	int attempt;
+
+	for(attempt = 0; ; attempt++)
+	{
+		if(!conn->session)
+		{
+			/* Not opened yet; that is not a failed attempt */
+			SVN_ERR(svnfs_ra_reconnect(conn));
+			attempt--;
+			continue;
+		}
+
+		apr_threadkey_private_set(call, svnfs_ra_call_key);
+		err = svnfs_ra_run(conn->session, op, pool);
+		apr_threadkey_private_set(NULL, svnfs_ra_call_key);
+
+		if(err == SVN_NO_ERROR)
+		{
+			apr_atomic_set32(&svnfs_ra_failures, 0);
+			return SVN_NO_ERROR;
+		}
+
+		if(svnfs_ra_abandoned(err))
+		{
+			reconnect_err = svnfs_ra_reconnect(conn);
+			if(reconnect_err != SVN_NO_ERROR)
+			{
+				svn_handle_error2(reconnect_err, stderr, FALSE, "svnfs: ");
+				svn_error_clear(reconnect_err);
+			}
+			return err;
+		}
+
+		if(!svnfs_ra_broken(err))
+			return err;
+
+		apr_atomic_inc32(&svnfs_ra_failures);
+		if(attempt >= svnfs_ctx.ra_retries)
+			return err;
+		if(call->deadline && apr_time_now() >= svnfs_ra_due(call))
+			return svn_error_create(APR_TIMEUP, err, "Request took too long");
+
+		svn_handle_error2(err, stderr, FALSE, "svnfs: ");
+		svn_error_clear(err);
+
+		svnfs_ra_backoff(attempt, svnfs_ra_due(call));
+
+		/* If this fails, the next attempt fails too and we come back here */
+		reconnect_err = svnfs_ra_reconnect(conn);
+		if(reconnect_err != SVN_NO_ERROR)
+		{
+			svn_handle_error2(reconnect_err, stderr, FALSE, "svnfs: ");
+			svn_error_clear(reconnect_err);
+		}
+	}
+}
+
+/*
+ * svnfs_ra_dequeue
+ *
+ * Takes the next request an I/O thread should run off the queues: the
+ * oldest demand request, or failing that the oldest background request if
+ * fewer than svnfs_ra_background_limit threads are running those already.
+ * Must be called with svnfs_ra_queue_lock held.
+ *
+ * return: the request, or NULL if there is none to run
+ */
+static svnfs_ra_job_t *svnfs_ra_dequeue(void)
+{
+	svnfs_ra_job_t *job;
+
+	if(svnfs_ra_demand_head)
+	{
+		job = svnfs_ra_demand_head;
+		svnfs_ra_demand_head = job->next;
+		if(!svnfs_ra_demand_head)
+			svnfs_ra_demand_tail = NULL;
+		return job;
+	}
+
+	if(svnfs_ra_background_head
+	   && svnfs_ra_background_busy < svnfs_ra_background_limit)
+	{
+		job = svnfs_ra_background_head;
+		svnfs_ra_background_head = job->next;
+		if(!svnfs_ra_background_head)
+			svnfs_ra_background_tail = NULL;
+		svnfs_ra_background_busy++;
+		return job;
+	}
+
+	return NULL;
+}
+
+/*
+ * svnfs_ra_release
+ *
+ * Drops a reference to a job, freeing it with the last one.
+ *
+ * job: the job
+ */
+static void svnfs_ra_release(svnfs_ra_job_t *job)
+{
+	apr_os_file_t fd;
+	int last;
+
+	apr_thread_mutex_lock(job->lock);
+		last = (--job->refs == 0);
+	apr_thread_mutex_unlock(job->lock);
+
+	if(!last)
+		return;
+
+	/* A result nobody collected */
+	svn_error_clear(job->err);
+
+	/* Whatever was streaming to the descriptor is cleaned up with the pool,
+	 * so close it only afterwards */
+	fd = job->fd;
+	apr_pool_destroy(job->pool);
+	if(fd >= 0)
+		close(fd);
+}
+
+/*
+ * svnfs_ra_receive
+ *
+ * svn_log_message_receiver_t that passes log messages on to the receiver of
+ * the caller's request, as long as the caller is still waiting for it.
  *
- * Subversion repository access session.
+ * baton:  the svnfs_ra_job_t
+ * return: what the caller's receiver returns, or an SVN_ERR_CANCELLED error
+ *         once the caller has gone
  */
-svn_ra_session_t *svnfs_ra_session;
+static svn_error_t *svnfs_ra_receive(void *baton, apr_hash_t *changed_paths,
+                                     svn_revnum_t revision,
+                                     const char *author, const char *date,
+                                     const char *message, apr_pool_t *pool)
+{
+	svnfs_ra_job_t *job = baton;
+	svn_error_t *err;
 
-/* 
- * svnfs_ra_session_lock
+	apr_thread_mutex_lock(job->lock);
+		if(job->caller)
+			err = job->caller->receiver(job->caller->receiver_baton,
+			                            changed_paths, revision, author,
+			                            date, message, pool);
+		else
+			err = svn_error_create(SVN_ERR_CANCELLED, NULL,
+			                       "Nobody is waiting for the log");
+	apr_thread_mutex_unlock(job->lock);
+
+	return err;
+}
+
+/*
+ * svnfs_ra_copy
+ *
+ * Copies the results of one request into another.
  *
- * Lock used to prevent other operations during read.  "Writers" are actually
- * read() operations, which require mutually exclusive access to the
- * repository; any other operation is a "reader".
+ * op:   the request to copy into
+ * from: the request to copy from
+ * pool: pool from which to allocate the copies
  */
-apr_thread_rwlock_t *svnfs_ra_session_lock;
+static void svnfs_ra_copy(svnfs_ra_op_t *op, const svnfs_ra_op_t *from,
+                          apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+	const void *name;
+	void *dirent;
 
-/* 
- * svnfs_cache_files
+	switch(op->kind)
+	{
+		case SVNFS_RA_LATEST:
+			op->latest = from->latest;
+			break;
+
+		case SVNFS_RA_STAT:
+			op->dirent = from->dirent ? svn_dirent_dup(from->dirent, pool)
+			                          : NULL;
+			break;
+
+		case SVNFS_RA_DIR:
+			op->dirents = apr_hash_make(pool);
+			for(hi = apr_hash_first(pool, from->dirents); hi;
+			    hi = apr_hash_next(hi))
+			{
+				apr_hash_this(hi, &name, NULL, &dirent);
+				apr_hash_set(op->dirents, apr_pstrdup(pool, name),
+				             APR_HASH_KEY_STRING,
+				             svn_dirent_dup(dirent, pool));
+			}
+			break;
+
+		case SVNFS_RA_FILE:
+			/* The contents themselves went straight to the caller */
+			op->checksum = from->checksum;
+			break;
+
+		default:
+			/* The log messages went straight to the caller */
+			break;
+	}
+}
+
+/*
+ * svnfs_ra_thread
  *
- * An apr_hash_t that maps paths in the filesystems to temporary files on disk
- * that contain the contents of the represented files.  For example, the path
- * /1/foo might map to "/tmp/svnfs.7jalg2G", a file which contains the contents
- * of the repository file "/foo" at revision 1.
+ * An I/O thread: runs requests from the queues on a session of its own, one
+ * at a time, and hands each result back to the thread waiting for it.
+ *
+ * thread: the thread
+ * data:   the svnfs_ra_conn_t the thread owns
+ * return: never returns
  */
-static apr_hash_t *svnfs_cache_files;
+static void *svnfs_ra_thread(apr_thread_t *thread, void *data)
+{
+	svnfs_ra_conn_t *conn = data;
+	svnfs_ra_job_t *job;
+	svnfs_ra_class_t priority;
+	svn_error_t *err;
+	int abandoned;
+
+	apr_thread_mutex_lock(svnfs_ra_queue_lock);
+	for(;;)
+	{
+		job = svnfs_ra_dequeue();
+		if(!job)
+		{
+			apr_thread_cond_wait(svnfs_ra_queue_cond, svnfs_ra_queue_lock);
+			continue;
+		}
+		apr_thread_mutex_unlock(svnfs_ra_queue_lock);
+
+		apr_thread_mutex_lock(job->lock);
+			abandoned = (job->caller == NULL);
+		apr_thread_mutex_unlock(job->lock);
+
+		/* Time spent queued counts against the deadline, and a request
+		 * given up on while queued need not be sent at all */
+		if(abandoned || apr_atomic_read32(&job->call.cancelled))
+			err = svn_error_create(SVN_ERR_CANCELLED, NULL,
+			                       "Request cancelled while queued");
+		else if(job->call.deadline && apr_time_now() >= job->call.deadline)
+			err = svn_error_create(APR_TIMEUP, NULL,
+			                       "Request timed out while queued");
+		else
+			err = svnfs_ra_retry(conn, &job->op, &job->call, job->pool);
+
+		priority = job->op.priority;
+		apr_thread_mutex_lock(job->lock);
+			job->err  = err;
+			job->done = 1;
+			apr_thread_cond_broadcast(job->cond);
+		apr_thread_mutex_unlock(job->lock);
+		svnfs_ra_release(job);
+
+		apr_thread_mutex_lock(svnfs_ra_queue_lock);
+		if(priority == SVNFS_RA_BACKGROUND)
+		{
+			/* Another background request may run now */
+			svnfs_ra_background_busy--;
+			apr_thread_cond_broadcast(svnfs_ra_queue_cond);
+		}
+	}
+
+	return NULL;
+}
 
 /*
- * svnfs_opts
+ * svnfs_ra_post
  *
- * Flags and parameters passable to SVNFS on the command line.  There are no
- * named parameters as yet, but the first unnamed parameter must be the URL of
- * the repository, and the second must be the mountpoint.
+ * Queues a copy of a request for the I/O threads, without waiting for it.
+ *
+ * op:     the request, which must stay put until svnfs_ra_wait returns
+ * return: the job, of which the caller holds a reference, or NULL on error
  */
-#define SVNFS_OPT(t, o, v) { t, offsetof(struct svnfs_context_t, o), v }
-static struct fuse_opt svnfs_opts[] = 
+static svnfs_ra_job_t *svnfs_ra_post(svnfs_ra_op_t *op)
 {
-	FUSE_OPT_END
-};
+	apr_pool_t *job_pool;
+	svnfs_ra_job_t *job;
+	svnfs_ra_job_t **head;
+	svnfs_ra_job_t **tail;
+	apr_os_file_t fd;
+
+	if(apr_pool_create(&job_pool, NULL) != APR_SUCCESS)
+		return NULL;
+
+	job = apr_pcalloc(job_pool, sizeof(*job));
+	job->op     = *op;
+	job->pool   = job_pool;
+	job->fd     = -1;
+	job->caller = op;
+	job->refs   = 2;
+	job->call.deadline = svnfs_ra_deadline(op->kind);
+	if(op->path)
+		job->op.path = apr_pstrdup(job_pool, op->path);
+
+	if(apr_thread_mutex_create(&job->lock, APR_THREAD_MUTEX_DEFAULT,
+	                           job_pool) != APR_SUCCESS
+	   || apr_thread_cond_create(&job->cond, job_pool) != APR_SUCCESS)
+	{
+		apr_pool_destroy(job_pool);
+		return NULL;
+	}
+
+	if(op->kind == SVNFS_RA_LOG)
+	{
+		job->op.receiver       = svnfs_ra_receive;
+		job->op.receiver_baton = job;
+	}
+
+	job->op.progress_lock = job->lock;
+	job->op.progress_cond = job->cond;
+
+	/* The caller closes its descriptor if it stops waiting, and the number
+	 * could be reused for another file before the I/O thread notices */
+	if(op->kind == SVNFS_RA_FILE)
+	{
+		if(apr_os_file_get(&fd, op->file) != APR_SUCCESS
+		   || (job->fd = dup(fd)) < 0
+		   || apr_os_file_put(&job->op.file, &job->fd, APR_READ | APR_WRITE,
+		                      job_pool) != APR_SUCCESS)
+		{
+			if(job->fd >= 0)
+				close(job->fd);
+			apr_pool_destroy(job_pool);
+			return NULL;
+		}
+	}
+
+	if(op->priority == SVNFS_RA_BACKGROUND)
+	{
+		head = &svnfs_ra_background_head;
+		tail = &svnfs_ra_background_tail;
+	}
+	else
+	{
+		head = &svnfs_ra_demand_head;
+		tail = &svnfs_ra_demand_tail;
+	}
+
+	apr_thread_mutex_lock(svnfs_ra_queue_lock);
+		if(*tail)
+			(*tail)->next = job;
+		else
+			*head = job;
+		*tail = job;
+		apr_thread_cond_signal(svnfs_ra_queue_cond);
+	apr_thread_mutex_unlock(svnfs_ra_queue_lock);
+
+	return job;
+}
 
 /*
- * svnfs_fuse_operations
+ * svnfs_ra_wait
  *
- * The FUSE operations SVNFS implements.
+ * Waits for a job to be done, but not past its deadline, whether or not the
+ * I/O thread running it has noticed, nor once a stop flag is set.  Whoever
+ * sets the flag must then signal the job's condition under its lock, and
+ * cancels the job if it no longer wants it.  A job that is not done by its
+ * deadline is cancelled.
+ * Drops the caller's reference to the job either way.
+ *
+ * job:    the job
+ * op:     the request the job was posted for, into which results are copied
+ * stop:   flag that ends the wait early, or NULL
+ * pool:   pool from which to allocate the results
+ * return: SVN_NO_ERROR on success or if stopped, in which case op has no
+ *         results, or an svn_error_t* on failure
  */
-static struct fuse_operations svnfs_fuse_operations =
+static svn_error_t *svnfs_ra_wait(svnfs_ra_job_t *job, svnfs_ra_op_t *op,
+                                  volatile apr_uint32_t *stop,
+                                  apr_pool_t *pool)
 {
-	.getattr = svnfs_fuse_getattr,
-	.read    = svnfs_fuse_read,
-	.open    = svnfs_fuse_open,
-	.readdir = svnfs_fuse_readdir
-};
+	apr_time_t now;
+	apr_time_t due;
+	svn_error_t *err;
+	int stopped;
+	int done;
 
-/* }}} END STATIC GLOBALS */
-
-/* FUSE OPERATIONS {{{1 */
+	stopped = 0;
+	apr_thread_mutex_lock(job->lock);
+		while(!job->done)
+		{
+			if(stop && apr_atomic_read32(stop))
+			{
+				stopped = 1;
+				break;
+			}
 
-int svnfs_fuse_getattr(const char *path, struct stat *stbuf)
+			if(!job->call.deadline)
+			{
+				apr_thread_cond_wait(job->cond, job->lock);
+				continue;
+			}
+
+			/* The deadline moves back while the request is throttled */
+			now = apr_time_now();
+			due = svnfs_ra_due(&job->call);
+			if(now >= due)
+				break;
+			apr_thread_cond_timedwait(job->cond, job->lock, due - now);
+		}
+
+		done = job->done;
+		err = NULL;
+		if(done)
+		{
+			err = job->err;
+			job->err = NULL;
+			svnfs_ra_copy(op, &job->op, pool);
+		}
+		job->caller = NULL;
+	apr_thread_mutex_unlock(job->lock);
+
+	if(!done)
+	{
+		/* The urgent flag is the caller's too */
+		apr_thread_mutex_lock(svnfs_bucket_lock);
+			job->op.urgent = NULL;
+		apr_thread_mutex_unlock(svnfs_bucket_lock);
+
+		/* Cancelling a request part way through costs its session, which
+		 * is only worth it once the deadline has passed anyway */
+		if(!stopped)
+		{
+			apr_atomic_set32(&job->call.cancelled, 1);
+			err = svn_error_create(APR_TIMEUP, NULL, "Request took too long");
+		}
+	}
+
+	svnfs_ra_release(job);
+
+	return err;
+}
+
+/*
+ * svnfs_ra_submit
+ *
+ * Queues a request for the I/O threads and waits for its result, but not
+ * past its deadline.  Before the threads are started, the request is run on
+ * svnfs_ra_main instead.
+ *
+ * op:     the request
+ * pool:   pool from which results are allocated
+ * return: SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+static svn_error_t *svnfs_ra_submit(svnfs_ra_op_t *op, apr_pool_t *pool)
 {
-	svn_revnum_t rev;
-	char *repos_path;
-	svn_dirent_t *dirent;
+	svnfs_ra_call_t call;
+	svnfs_ra_job_t *job;
+	apr_time_t now;
 	svn_error_t *err;
 
-	memset(stbuf, 0, sizeof(struct stat));
-	if(strcmp(path, "/") == 0)
+	if(!svnfs_ra_started)
 	{
-		stbuf->st_mode = S_IFDIR | 0755;
-		return 0;
+		memset(&call, 0, sizeof(call));
+		call.deadline = svnfs_ra_deadline(op->kind);
+
+		/* Waiting for the session counts against the deadline too */
+		apr_thread_mutex_lock(svnfs_ra_main_lock);
+			while(svnfs_ra_main_busy)
+			{
+				if(!call.deadline)
+				{
+					apr_thread_cond_wait(svnfs_ra_main_cond,
+					                     svnfs_ra_main_lock);
+					continue;
+				}
+
+				now = apr_time_now();
+				if(now >= call.deadline)
+				{
+					apr_thread_mutex_unlock(svnfs_ra_main_lock);
+					return svn_error_create(APR_TIMEUP, NULL,
+					                        "Timed out waiting for session");
+				}
+				apr_thread_cond_timedwait(svnfs_ra_main_cond,
+				                          svnfs_ra_main_lock,
+				                          call.deadline - now);
+			}
+			svnfs_ra_main_busy = 1;
+		apr_thread_mutex_unlock(svnfs_ra_main_lock);
+
+		err = svnfs_ra_retry(&svnfs_ra_main, op, &call, pool);
+
+		apr_thread_mutex_lock(svnfs_ra_main_lock);
+			svnfs_ra_main_busy = 0;
+			apr_thread_cond_signal(svnfs_ra_main_cond);
+		apr_thread_mutex_unlock(svnfs_ra_main_lock);
+
+		return err;
 	}
 
-	if(!svnfs_path_split(path, &rev, &repos_path))
-		return -ENOENT;
+	job = svnfs_ra_post(op);
+	if(!job)
+		return svn_error_create(APR_ENOMEM, NULL, "Could not queue request");
 
-	SVNFS_LOCK_READ;
-		printf("Attempting to stat '%s@@%ld'\n", repos_path, rev);
-		err = svn_ra_stat(svnfs_ra_session, repos_path, rev, &dirent, pool);
-	SVNFS_UNLOCK;
+	return svnfs_ra_wait(job, op, NULL, pool);
+}
 
-	if(err != SVN_NO_ERROR)
+/*
+ * svnfs_ra_start
+ *
+ * Starts the I/O threads, the first of which takes over svnfs_ra_main.
+ * Only called by svnfs_fuse_init(), since threads do not survive libfuse
+ * forking into the background.
+ *
+ * pool: pool to allocate the threads and their connections from
+ */
+static void svnfs_ra_start(apr_pool_t *pool)
+{
+	svnfs_ra_conn_t *conn;
+	apr_thread_t *thread;
+	int started;
+	int i;
+
+	if(apr_thread_mutex_create(&svnfs_ra_queue_lock, APR_THREAD_MUTEX_DEFAULT,
+	                           pool) != APR_SUCCESS
+	   || apr_thread_cond_create(&svnfs_ra_queue_cond, pool) != APR_SUCCESS)
 	{
-		svn_handle_error2(err, stderr, FALSE, "svnfs: ");
-		svn_error_clear(err);
-		return -EPIPE;
+		printf("Could not set up the request queue\n");
+		return;
 	}
 
-	stbuf->st_size = dirent->size;
-	switch(dirent->kind)
+	/* A throttled background fetch holds its thread for a long time, so
+	 * keep one free for demand requests, unless there is only the one */
+	svnfs_ra_background_limit = svnfs_ctx.ra_threads > 1
+	                            ? svnfs_ctx.ra_threads - 1 : 1;
+
+	started = 0;
+	for(i = 0; i < svnfs_ctx.ra_threads; i++)
 	{
-		case svn_node_file:
-			stbuf->st_mode = S_IFREG | 0644;
-			break;
-		case svn_node_dir:
-			stbuf->st_mode = S_IFDIR | 0755;
-			break;
-		default:
-			stbuf->st_mode = S_IFREG | 0000;
+		if(i == 0)
+			conn = &svnfs_ra_main;
+		else
+		{
+			conn = apr_pcalloc(pool, sizeof(*conn));
+			conn->name = apr_psprintf(pool, "I/O %d", i);
+		}
+
+		if(apr_thread_create(&thread, NULL, svnfs_ra_thread, conn, pool)
+		   != APR_SUCCESS)
 			break;
+		started++;
 	}
 
-	return 0;
+	if(started < svnfs_ctx.ra_threads)
+		printf("Could only start %d of %d I/O threads\n", started,
+		       svnfs_ctx.ra_threads);
+
+	if(started > 0)
+		svnfs_ra_started = 1;
 }
 
-int svnfs_fuse_open(const char *path, struct fuse_file_info *fi)
+/*
+ * svnfs_hedge_compare
+ *
+ * Orders latencies for qsort.
+ */
+static int svnfs_hedge_compare(const void *a, const void *b)
 {
-	char *cache_path;
-	char *repos_path;
-	svn_revnum_t rev;
-	const char *temp_dir;
-	apr_file_t *cache_file;
-	svn_stream_t *cache_stream;
+	apr_interval_time_t x = *(const apr_interval_time_t *)a;
+	apr_interval_time_t y = *(const apr_interval_time_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * svnfs_hedge_sample
+ *
+ * Records how long a STAT or DIR request took, and every so often
+ * recomputes svnfs_hedge_delay from the recent samples.  Must be called with
+ * svnfs_hedge_lock held.
+ *
+ * latency: time from sending the request to its answer
+ */
+static void svnfs_hedge_sample(apr_interval_time_t latency)
+{
+	apr_interval_time_t sorted[SVNFS_HEDGE_SAMPLES];
+	apr_size_t count;
+	apr_size_t rank;
+
+	svnfs_hedge_samples[svnfs_hedge_nsamples % SVNFS_HEDGE_SAMPLES] = latency;
+	svnfs_hedge_nsamples++;
+
+	/* Don't hedge anything until there is enough history to say what slow
+	 * is, and don't sort on every request */
+	if(svnfs_hedge_nsamples < SVNFS_HEDGE_SAMPLES / 4
+	   || svnfs_hedge_nsamples % 16 != 0)
+		return;
+
+	count = svnfs_hedge_nsamples < SVNFS_HEDGE_SAMPLES
+	        ? svnfs_hedge_nsamples : SVNFS_HEDGE_SAMPLES;
+	memcpy(sorted, svnfs_hedge_samples, count * sizeof(*sorted));
+	qsort(sorted, count, sizeof(*sorted), svnfs_hedge_compare);
+
+	rank = count * svnfs_ctx.hedge / 100;
+	if(rank >= count)
+		rank = count - 1;
+	svnfs_hedge_delay = sorted[rank] > 0 ? sorted[rank] : 1;
+}
+
+/*
+ * svnfs_hedge_release
+ *
+ * Drops a reference to a hedged request, freeing it with the last one.  Must
+ * be called with svnfs_hedge_lock held.
+ *
+ * hedge: the request
+ */
+static void svnfs_hedge_release(svnfs_hedge_t *hedge)
+{
+	if(--hedge->refs == 0)
+	{
+		svnfs_ra_release(hedge->primary);
+		apr_pool_destroy(hedge->pool);
+	}
+}
+
+/*
+ * svnfs_hedge_run
+ *
+ * Sends a duplicate request on the hedge session, opening the session first
+ * if need be.  Only called from the hedge thread, which owns the session.
+ *
+ * hedge:  the request
+ * return: SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+static svn_error_t *svnfs_hedge_run(svnfs_hedge_t *hedge)
+{
+	svn_error_t *err;
+
+	if(!svnfs_hedge_session)
+	{
+		if(apr_pool_create(&svnfs_hedge_pool, NULL) != APR_SUCCESS)
+			return svn_error_create(APR_ENOMEM, NULL, "Could not create pool");
+		err = svnfs_ra_open(&svnfs_hedge_session, svnfs_hedge_pool);
+		if(err != SVN_NO_ERROR)
+		{
+			apr_pool_destroy(svnfs_hedge_pool);
+			svnfs_hedge_session = NULL;
+			return err;
+		}
+	}
+
+	apr_threadkey_private_set(&hedge->hedge, svnfs_ra_call_key);
+	err = svnfs_ra_run(svnfs_hedge_session, &hedge->op, hedge->pool);
+	apr_threadkey_private_set(NULL, svnfs_ra_call_key);
+
+	/* Start afresh next time if the session broke or was left part way
+	 * through an answer */
+	if(err != SVN_NO_ERROR && (svnfs_ra_abandoned(err) || svnfs_ra_broken(err)))
+	{
+		apr_pool_destroy(svnfs_hedge_pool);
+		svnfs_hedge_session = NULL;
+	}
+
+	return err;
+}
+
+/*
+ * svnfs_hedge_thread
+ *
+ * Waits for queued requests to fall due, and duplicates each that does on
+ * the hedge session as long as the budget allows.  Duplicates are sent one
+ * at a time, which also bounds the extra load on the server.
+ *
+ * thread: the thread
+ * data:   unused
+ * return: never returns
+ */
+static void *svnfs_hedge_thread(apr_thread_t *thread, void *data)
+{
+	svnfs_hedge_t **link;
+	svnfs_hedge_t **first;
+	svnfs_hedge_t *hedge;
+	apr_time_t now;
+	svn_error_t *err;
+
+	apr_thread_mutex_lock(svnfs_hedge_lock);
+	for(;;)
+	{
+		first = NULL;
+		for(link = &svnfs_hedge_queue; *link; link = &(*link)->next)
+			if(!first || (*link)->due < (*first)->due)
+				first = link;
+
+		if(!first)
+		{
+			apr_thread_cond_wait(svnfs_hedge_cond, svnfs_hedge_lock);
+			continue;
+		}
+
+		now = apr_time_now();
+		if((*first)->due > now)
+		{
+			apr_thread_cond_timedwait(svnfs_hedge_cond, svnfs_hedge_lock,
+			                          (*first)->due - now);
+			continue;
+		}
+
+		hedge = *first;
+		*first = hedge->next;
+		hedge->queued = 0;
+
+		if(svnfs_hedge_credit < 100)
+		{
+			svnfs_hedge_release(hedge);
+			continue;
+		}
+		svnfs_hedge_credit -= 100;
+		apr_thread_mutex_unlock(svnfs_hedge_lock);
+
+		svnfs_note("Hedging slow request for '%s@@%ld'\n", hedge->op.path,
+		           hedge->op.rev);
+		err = svnfs_hedge_run(hedge);
+
+		apr_thread_mutex_lock(svnfs_hedge_lock);
+		if(err == SVN_NO_ERROR && !hedge->done)
+		{
+			/* Wake the caller, and cancel the original so that it gives up
+			 * its I/O thread; the thread reopens its session itself */
+			hedge->done = 1;
+			apr_atomic_set32(&hedge->hedge_won, 1);
+			apr_atomic_set32(&hedge->primary->call.cancelled, 1);
+			apr_thread_mutex_lock(hedge->primary->lock);
+				apr_thread_cond_signal(hedge->primary->cond);
+			apr_thread_mutex_unlock(hedge->primary->lock);
+		}
+		svn_error_clear(err);
+		svnfs_hedge_release(hedge);
+	}
+
+	return NULL;
+}
+
+/*
+ * svnfs_hedge_execute
+ *
+ * Runs a STAT or DIR request on an I/O thread, with a duplicate queued
+ * for the hedge thread in case it turns out to be slow.  The first answer
+ * is returned and the other request is cancelled, or taken off the queue
+ * if it was never sent.  The thread running the loser reopens its session
+ * before its next request, so no caller waits for that.
+ *
+ * op:     the request
+ * pool:   pool from which results are allocated
+ * return: SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+static svn_error_t *svnfs_hedge_execute(svnfs_ra_op_t *op, apr_pool_t *pool)
+{
+	svnfs_hedge_t *hedge;
+	svnfs_hedge_t **link;
+	apr_pool_t *hedge_pool;
+	svnfs_ra_job_t *job;
+	apr_time_t start;
 	svn_error_t *err;
 
-	if(!svnfs_path_split(path, &rev, &repos_path))
-	{
-		printf("Attempted to open malformed path \"%s\"\n", path);
-		return -ENOENT;
-	}
+	hedge = NULL;
+	start = apr_time_now();
+	job = svnfs_ra_post(op);
+	if(!job)
+		return svn_error_create(APR_ENOMEM, NULL, "Could not queue request");
+
+	apr_thread_mutex_lock(svnfs_hedge_lock);
+		/* Every request earns a fraction of a duplicate, and a duplicate
+		 * costs 100; a quiet spell can bank up to ten */
+		svnfs_hedge_credit += svnfs_ctx.hedge_budget;
+		if(svnfs_hedge_credit > 1000)
+			svnfs_hedge_credit = 1000;
+
+		if(svnfs_hedge_delay > 0 && svnfs_hedge_credit >= 100
+		   && apr_pool_create(&hedge_pool, NULL) == APR_SUCCESS)
+		{
+			hedge = apr_pcalloc(hedge_pool, sizeof(*hedge));
+			hedge->op      = *op;
+			hedge->op.path = apr_pstrdup(hedge_pool, op->path);
+			hedge->pool    = hedge_pool;
+			hedge->due     = start + svnfs_hedge_delay;
+			hedge->primary = job;
+			hedge->queued  = 1;
+			hedge->refs    = 2;
+			hedge->next    = svnfs_hedge_queue;
+			svnfs_hedge_queue = hedge;
+			hedge->hedge.deadline = job->call.deadline;
+
+			apr_thread_mutex_lock(job->lock);
+				job->refs++;
+			apr_thread_mutex_unlock(job->lock);
+
+			apr_thread_cond_signal(svnfs_hedge_cond);
+		}
+	apr_thread_mutex_unlock(svnfs_hedge_lock);
+
+	/* Whichever answer comes first wins */
+	err = svnfs_ra_wait(job, op, hedge ? &hedge->hedge_won : NULL,
+	                    pool);
+
+	apr_thread_mutex_lock(svnfs_hedge_lock);
+		svnfs_hedge_sample(apr_time_now() - start);
+
+		if(hedge && apr_atomic_read32(&hedge->hedge_won))
+		{
+			svn_error_clear(err);
+			err = SVN_NO_ERROR;
+			svnfs_ra_copy(op, &hedge->op, pool);
+		}
+		else if(hedge)
+		{
+			/* A duplicate already sent is cancelled, freeing the hedge
+			 * thread for the next slow request */
+			hedge->done = 1;
+			apr_atomic_set32(&hedge->hedge.cancelled, 1);
+			if(hedge->queued)
+			{
+				for(link = &svnfs_hedge_queue; *link != hedge;
+				    link = &(*link)->next)
+					;
+				*link = hedge->next;
+				hedge->queued = 0;
+				svnfs_hedge_release(hedge);
+			}
+		}
+
+		if(hedge)
+			svnfs_hedge_release(hedge);
+	apr_thread_mutex_unlock(svnfs_hedge_lock);
+
+	return err;
+}
+
+svn_error_t *svnfs_ra_execute(svnfs_ra_op_t *op, apr_pool_t *pool)
+{
+	if(svnfs_ra_started && svnfs_hedge_started
+	   && op->priority == SVNFS_RA_DEMAND
+	   && (op->kind == SVNFS_RA_STAT || op->kind == SVNFS_RA_DIR))
+		return svnfs_hedge_execute(op, pool);
+
+	return svnfs_ra_submit(op, pool);
+}
+
+svnfs_ra_job_t *svnfs_ra_begin(svnfs_ra_op_t *op)
+{
+	if(!svnfs_ra_started)
+		return NULL;
+
+	return svnfs_ra_post(op);
+}
+
+int svnfs_ra_await(svnfs_ra_job_t *job, apr_off_t offset)
+{
+	apr_time_t now;
+	apr_time_t due;
+	int ret;
+
+	apr_thread_mutex_lock(job->lock);
+		while(!job->done && job->op.progress < offset)
+		{
+			if(!job->call.deadline)
+			{
+				apr_thread_cond_wait(job->cond, job->lock);
+				continue;
+			}
 
-	/* Verify that we have a cache of the data */
-	cache_path = apr_hash_get(svnfs_cache_files, path, APR_HASH_KEY_STRING);
-	if(!cache_path)
-	{
-		/* CACHE MISS */
-		printf("Cache miss on path \"%s\"\n", path);
+			now = apr_time_now();
+			due = svnfs_ra_due(&job->call);
+			if(now >= due)
+				break;
+			apr_thread_cond_timedwait(job->cond, job->lock, due - now);
+		}
 
-		if(apr_temp_dir_get(&temp_dir, pool) != APR_SUCCESS)
+		ret = 0;
+		if(job->op.progress < offset)
 		{
-			printf("Could not retrieve temporary directory\n");
-			return -ENOMEM;
+			if(!job->done)
+				ret = -ETIMEDOUT;
+			else if(job->err)
+				ret = svnfs_ra_errno(job->err, -EIO);
 		}
+	apr_thread_mutex_unlock(job->lock);
 
-		cache_path = apr_psprintf(pool, "%s/svnfs.XXXXXX", temp_dir);
+	return ret;
+}
 
-		SVNFS_LOCK_WRITE;
-			/* This stuff happens in a mutex because svn_ra_get_file is not
-			 * thread-safe, and because we can't afford to have another
-			 * thread take over between apr_file_mktemp and us actually
-			 * writing the data. */
+int svnfs_ra_failed(svnfs_ra_job_t *job)
+{
+	int failed;
 
-			/* We want our temporary file to persist after this read */
-			if(apr_file_mktemp(&cache_file, cache_path, 
-				               APR_CREATE | APR_EXCL | APR_WRITE, pool)
-			   != APR_SUCCESS)
-			{
-				SVNFS_UNLOCK;
-				printf("Could not create temp file\n");
-				return -ENOMEM;
-			}
+	apr_thread_mutex_lock(job->lock);
+		failed = job->done && job->err;
+	apr_thread_mutex_unlock(job->lock);
 
-			cache_stream = svn_stream_from_aprfile(cache_file, pool);
+	return failed;
+}
 
-			err = svn_ra_get_file(svnfs_ra_session, repos_path, rev,
-			                      cache_stream, NULL, NULL, pool);
-			if(err != SVN_NO_ERROR)
-			{
-				SVNFS_UNLOCK;
-				printf("Could not get %s@%ld\n", repos_path, rev);
-				svn_error_clear(err);
-				return -ENOENT;
-			}
+int svnfs_ra_end(svnfs_ra_job_t *job)
+{
+	int whole;
 
-			err = svn_stream_close(cache_stream);
-			if(err != SVN_NO_ERROR)
-			{
-				SVNFS_UNLOCK;
-				printf("Could not close stream\n");
-				svn_error_clear(err);
-				return -EIO;
-			}
+	apr_thread_mutex_lock(job->lock);
+		whole = job->done && !job->err;
+		job->caller = NULL;
+	apr_thread_mutex_unlock(job->lock);
 
-			if(apr_file_close(cache_file) != APR_SUCCESS)
-			{
-				SVNFS_UNLOCK;
-				printf("Could not close temp file\n");
-				return -EIO;
-			}
+	if(!whole)
+		apr_atomic_set32(&job->call.cancelled, 1);
+	svnfs_ra_release(job);
 
-			apr_hash_set(svnfs_cache_files, path, APR_HASH_KEY_STRING,
-			             cache_path);
+	return whole;
+}
 
-		SVNFS_UNLOCK;
-	}
+/* END REPOSITORY ACCESS }}}1 */
 
-	return 0;
-}
+/* HEAD TRACKING {{{1 */
 
-int svnfs_fuse_read(const char *path, char *buf, size_t len, off_t offset,
-                    struct fuse_file_info *fi)
+/*
+ * svnfs_head_changed_since
+ *
+ * Determines whether a path, or any directory above it, changed in a revision
+ * younger than since.  Must be called with svnfs_head_lock held.
+ *
+ * repos_path: the repository path to check
+ * since:      the revision at which the caller last saw the path
+ * return:     nonzero if the path may have changed, zero otherwise
+ */
+static int svnfs_head_changed_since(const char *repos_path, svn_revnum_t since)
 {
-	char *cache_path;
-	apr_file_t *cache_file;
-	apr_status_t read_err;
-	apr_size_t bytes_read;
-	apr_off_t my_offset;
+	char buf[1024];
+	apr_size_t len;
+	svn_revnum_t *changed;
 
-	cache_path = apr_hash_get(svnfs_cache_files, path, APR_HASH_KEY_STRING);
-	if(!cache_path)
-	{
-		printf("Could not find cache for \"%s\"\n", path);
-		return -EIO;
-	}
+	len = strlen(repos_path);
+	if(len >= sizeof(buf))
+		return 1; /* Be conservative rather than truncate */
+	memcpy(buf, repos_path, len + 1);
 
-	if(apr_file_open(&cache_file, cache_path, APR_READ, APR_OS_DEFAULT, pool)
-	   != APR_SUCCESS)
+	for(;;)
 	{
-		printf("Could not open temporary file \"%s\"\n", cache_path);
-		return -EIO;
-	}
+		changed = apr_hash_get(svnfs_head_changes, buf, len);
+		if(changed && *changed > since)
+			return 1;
 
-	my_offset = offset;
-	if(apr_file_seek(cache_file, APR_SET, &my_offset) != APR_SUCCESS)
-	{
-		apr_file_close(cache_file);
-		printf("Could not seek to requested location\n");
-		return -EIO;
-	}
+		if(len <= 1)
+			return 0;
 
-	read_err = apr_file_read_full(cache_file, buf, len, &bytes_read);
-	if(read_err != APR_SUCCESS && read_err != APR_EOF)
-	{
-		apr_file_close(cache_file);
-		printf("Failed to read from cache file\n");
-		return -EIO;
+		/* Strip the last component, but never the leading slash */
+		while(len > 0 && buf[len - 1] != '/')
+			len--;
+		if(len > 1)
+			len--;
+		buf[len] = '\0';
 	}
+}
 
-	if(apr_file_close(cache_file) != APR_SUCCESS)
-	{
-		printf("Failed to close cache file\n");
-		return -EIO;
-	}
+int svnfs_head_keep_cache(const char *repos_path, svn_revnum_t rev)
+{
+	svn_revnum_t *opened;
+	int keep;
 
-	return bytes_read;
+	apr_thread_mutex_lock(svnfs_head_lock);
+		opened = apr_hash_get(svnfs_head_opens, repos_path,
+		                      APR_HASH_KEY_STRING);
+		if(!opened)
+		{
+			/* First open, so the kernel has nothing cached to keep, unless
+			 * an older open has been pruned, which we cannot tell apart */
+			opened = apr_palloc(svnfs_head_pool, sizeof(*opened));
+			apr_hash_set(svnfs_head_opens,
+			             apr_pstrdup(svnfs_head_pool, repos_path),
+			             APR_HASH_KEY_STRING, opened);
+			keep = !SVN_IS_VALID_REVNUM(svnfs_head_floor);
+		}
+		else
+		{
+			keep = !svnfs_head_changed_since(repos_path, *opened);
+		}
+		*opened = rev;
+	apr_thread_mutex_unlock(svnfs_head_lock);
+
+	return keep;
 }
 
-int svnfs_fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                       off_t offset, struct fuse_file_info *fi)
+/*
+ * svnfs_head_log_receiver
+ *
+ * svn_log_message_receiver_t that records the paths changed by each revision
+ * in an apr_hash_t (the baton), mapping session-relative paths to the
+ * revision in which they changed.  A change at or above the session root
+ * (such as a replacement of the branch we are mounted on) is recorded as a
+ * change to "/", which invalidates everything.
+ */
+static svn_error_t *svnfs_head_log_receiver(void *baton,
+                                            apr_hash_t *changed_paths,
+                                            svn_revnum_t revision,
+                                            const char *author,
+                                            const char *date,
+                                            const char *message,
+                                            apr_pool_t *pool)
 {
-	svn_error_t *err;
-	svn_revnum_t rev;
-	char *repos_path;
-
-	apr_hash_t *dirents;
+	apr_hash_t *changes = baton;
+	apr_pool_t *changes_pool;
 	apr_hash_index_t *iter;
-	char *cur_dir;
+	apr_size_t prefix_len;
+	apr_size_t path_len;
+	const char *changed_path;
+	svn_revnum_t *changed_rev;
 
-	if(strcmp(path, "/") == 0)
+	if(!changed_paths)
+		return SVN_NO_ERROR;
+
+	changes_pool = apr_hash_pool_get(changes);
+	prefix_len = strlen(svnfs_repos_prefix);
+
+	for(iter = apr_hash_first(pool, changed_paths); iter;
+	    iter = apr_hash_next(iter))
 	{
-		SVNFS_LOCK_READ;
-			err = svn_ra_get_latest_revnum(svnfs_ra_session, &rev, pool);
-		SVNFS_UNLOCK;
+		apr_hash_this(iter, (const void **)(&changed_path), NULL, NULL);
+		path_len = strlen(changed_path);
 
-		if(err != SVN_NO_ERROR)
+		if(strncmp(changed_path, svnfs_repos_prefix, prefix_len) == 0
+		   && changed_path[prefix_len] == '/')
 		{
-			svn_handle_error2(err, stderr, FALSE, "svnfs: ");
-			svn_error_clear(err);
-			return -EPIPE;
+			/* Below the session root */
+			changed_path += prefix_len;
+		}
+		else if(strncmp(svnfs_repos_prefix, changed_path, path_len) == 0
+		        && (svnfs_repos_prefix[path_len] == '/'
+		            || svnfs_repos_prefix[path_len] == '\0'))
+		{
+			/* At or above the session root */
+			changed_path = "/";
+		}
+		else
+		{
+			/* Elsewhere in the repository */
+			continue;
 		}
 
-		filler(buf, ".", NULL, 0);
-		filler(buf, "..", NULL, 0);
-
-		while(rev > 0)
-			filler(buf, apr_itoa(pool, rev--), NULL, 0);
-
-		return 0;
+		changed_rev = apr_palloc(changes_pool, sizeof(*changed_rev));
+		*changed_rev = revision;
+		apr_hash_set(changes, apr_pstrdup(changes_pool, changed_path),
+		             APR_HASH_KEY_STRING, changed_rev);
 	}
 
-	if(!svnfs_path_split(path, &rev, &repos_path))
-		return -ENOENT; /* Invalid path */
+	return SVN_NO_ERROR;
+}
 
-	filler(buf, ".", NULL, 0);
-	filler(buf, "..", NULL, 0);
+/*
+ * svnfs_head_prune
+ *
+ * Forgets the changes and opens older than SVNFS_HEAD_WINDOW revisions before
+ * youngest, by copying the rest into a fresh svnfs_head_pool.  An open at or
+ * after the new floor can only be invalidated by a change after it, so the
+ * changes at or before the floor are no longer needed either.  Must be called
+ * with svnfs_head_lock held.
+ *
+ * youngest: the new youngest revision
+ */
+static void svnfs_head_prune(svn_revnum_t youngest)
+{
+	apr_pool_t *new_pool;
+	apr_hash_t *changes;
+	apr_hash_t *opens;
+	apr_hash_index_t *iter;
+	const char *path;
+	svn_revnum_t *rev;
+	svn_revnum_t *copy;
+	svn_revnum_t floor;
 
-	SVNFS_LOCK_READ;
-		printf("Attempting to get '%s@@%ld'...\n", repos_path, rev);
-		err = svn_ra_get_dir(svnfs_ra_session, repos_path, rev, &dirents, NULL,
-	                         NULL, pool);
-	SVNFS_UNLOCK;
+	floor = youngest - SVNFS_HEAD_WINDOW;
+	if(floor <= 0 || (SVN_IS_VALID_REVNUM(svnfs_head_floor)
+	                  && floor - svnfs_head_floor < SVNFS_HEAD_WINDOW))
+		return;
 
-	if(err != SVN_NO_ERROR)
+	if(apr_pool_create(&new_pool, NULL) != APR_SUCCESS)
+		return;
+	changes = apr_hash_make(new_pool);
+	opens = apr_hash_make(new_pool);
+
+	for(iter = apr_hash_first(new_pool, svnfs_head_changes); iter;
+	    iter = apr_hash_next(iter))
 	{
-		svn_handle_error2(err, stderr, FALSE, "svnfs: ");
-		svn_error_clear(err);
-		return -EPIPE;
+		apr_hash_this(iter, (const void **)(&path), NULL, (void **)(&rev));
+		if(*rev <= floor)
+			continue;
+		copy = apr_pmemdup(new_pool, rev, sizeof(*rev));
+		apr_hash_set(changes, apr_pstrdup(new_pool, path), APR_HASH_KEY_STRING,
+		             copy);
 	}
 
-	for(iter = apr_hash_first(pool, dirents); iter;
+	for(iter = apr_hash_first(new_pool, svnfs_head_opens); iter;
 	    iter = apr_hash_next(iter))
 	{
-		apr_hash_this(iter, (const void **)(&cur_dir), NULL, NULL);
-		filler(buf, cur_dir, NULL, 0);
+		apr_hash_this(iter, (const void **)(&path), NULL, (void **)(&rev));
+		if(*rev < floor)
+			continue;
+		copy = apr_pmemdup(new_pool, rev, sizeof(*rev));
+		apr_hash_set(opens, apr_pstrdup(new_pool, path), APR_HASH_KEY_STRING,
+		             copy);
 	}
 
-	return 0;
+	svnfs_note("Pruned /HEAD history before %ld: %u changes and %u opens "
+	           "kept\n", floor, apr_hash_count(changes),
+	           apr_hash_count(opens));
+
+	apr_pool_destroy(svnfs_head_pool);
+	svnfs_head_pool = new_pool;
+	svnfs_head_changes = changes;
+	svnfs_head_opens = opens;
+	svnfs_head_floor = floor;
 }
 
-/* }}}1 END FUSE OPERATIONS */
-
-/* HELPER OPERATIONS {{{1 */
+/*
+ * svnfs_head_update
+ *
+ * Moves /HEAD to youngest, recording every path changed in the revisions in
+ * between so that svnfs_head_keep_cache can tell which kernel caches are
+ * stale.
+ *
+ * youngest: the new youngest revision
+ * pool:     pool for temporary allocations
+ * return:   SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+static svn_error_t *svnfs_head_update(svn_revnum_t youngest, apr_pool_t *pool)
+{
+	svn_revnum_t oldest;
+	svnfs_ra_op_t op;
+	apr_hash_t *changes;
+	apr_hash_index_t *iter;
+	const char *changed_path;
+	svn_revnum_t *changed_rev;
+	svn_revnum_t *head_changed_rev;
 
-int svnfs_path_split(const char *path, svn_revnum_t *rev,
-                           char **repos_path)
+	apr_thread_mutex_lock(svnfs_head_lock);
+		oldest = svnfs_head_rev + 1;
+	apr_thread_mutex_unlock(svnfs_head_lock);
+
+	if(youngest < oldest)
+		return SVN_NO_ERROR;
+
+	svnfs_note("HEAD moved to %ld, fetching changes since %ld\n", youngest,
+	           oldest - 1);
+
+	changes = apr_hash_make(pool);
+
+	memset(&op, 0, sizeof(op));
+	op.kind           = SVNFS_RA_LOG;
+	op.priority       = SVNFS_RA_BACKGROUND;
+	op.path           = "";
+	op.rev            = oldest;
+	op.end_rev        = youngest;
+	op.receiver       = svnfs_head_log_receiver;
+	op.receiver_baton = changes;
+	SVN_ERR(svnfs_ra_execute(&op, pool));
+
+	apr_thread_mutex_lock(svnfs_head_lock);
+		for(iter = apr_hash_first(pool, changes); iter;
+		    iter = apr_hash_next(iter))
+		{
+			apr_hash_this(iter, (const void **)(&changed_path), NULL,
+			              (void **)(&changed_rev));
+
+			head_changed_rev = apr_hash_get(svnfs_head_changes, changed_path,
+			                                APR_HASH_KEY_STRING);
+			if(!head_changed_rev)
+			{
+				head_changed_rev = apr_palloc(svnfs_head_pool,
+				                              sizeof(*head_changed_rev));
+				apr_hash_set(svnfs_head_changes,
+				             apr_pstrdup(svnfs_head_pool, changed_path),
+				             APR_HASH_KEY_STRING, head_changed_rev);
+			}
+			*head_changed_rev = *changed_rev;
+		}
+
+		svnfs_head_rev = youngest;
+		svnfs_head_prune(youngest);
+	apr_thread_mutex_unlock(svnfs_head_lock);
+
+	return SVN_NO_ERROR;
+}
+
+/*
+ * svnfs_head_thread
+ *
+ * Thread body which polls the repository every svnfs_ctx.head_poll seconds
+ * and moves /HEAD forward when a new revision appears.
+ *
+ * thread: the running thread
+ * data:   unused
+ * return: never returns
+ */
+static void *svnfs_head_thread(apr_thread_t *thread, void *data)
 {
-	printf("Splitting directory %s\n", path);
+	apr_pool_t *iterpool;
+	svnfs_ra_op_t op;
+	svn_revnum_t head;
+	svn_error_t *err;
 
-	/* Verify we have a path */
-	if(path[0] != '/')
-	{
-		printf("First character not /\n");
-		return 0;
-	}
+	if(apr_pool_create(&iterpool, NULL) != APR_SUCCESS)
+		return NULL;
 
-	/* Special case: root */
-	if(path[1] == '\0')
+	for(;;)
 	{
-		printf("Cannot split root directory\n");
-		return 0;
-	}
+		apr_sleep(apr_time_from_sec(svnfs_ctx.head_poll));
+		apr_pool_clear(iterpool);
 
-	*rev = strtol(path + 1, repos_path, 10);
-	if(*rev == 0) /* See if we had an error */
-	{
-		if(*repos_path == path + 1) /* No revision specified */
+		memset(&op, 0, sizeof(op));
+		op.kind     = SVNFS_RA_LATEST;
+		op.priority = SVNFS_RA_BACKGROUND;
+		err = svnfs_ra_execute(&op, iterpool);
+
+		if(err == SVN_NO_ERROR)
 		{
-			printf("No revision specified\n");
-			return 0;
+			apr_thread_mutex_lock(svnfs_head_lock);
+				head = svnfs_head_rev;
+			apr_thread_mutex_unlock(svnfs_head_lock);
+
+			if(op.latest <= head)
+				continue;
+
+			err = svnfs_head_update(op.latest, iterpool);
 		}
-		else if (*repos_path[0] != '/') /* Invalid character in revision */
+
+		if(err != SVN_NO_ERROR)
 		{
-			printf("Invalid character in revision\n");
-			return 0;
+			svn_handle_error2(err, stderr, FALSE, "svnfs: ");
+			svn_error_clear(err);
 		}
 	}
 
-	if(*repos_path[0] == '\0') /* Path specified revision root */
-		*repos_path = "/";
+	return NULL;
+}
 
-	return 1;
+void *svnfs_fuse_init(void)
+{
+	apr_thread_t *head_thread;
+	apr_thread_t *hedge_thread;
+	apr_thread_t *store_thread;
+
+	svnfs_ra_start(pool);
+
+	/* Only now, after libfuse has forked into the background, can we take
+	 * a lock on the cache directory that holds for the life of the mount */
+	if(svnfs_ctx.cache_dir && svnfs_store_open(pool) != 0)
+		printf("Falling back to temporary files for the content cache\n");
+
+	if(svnfs_store_header && svnfs_ctx.scrub_interval > 0
+	   && apr_thread_create(&store_thread, NULL, svnfs_store_thread, NULL,
+	                        pool) != APR_SUCCESS)
+		printf("Could not start cache scrubbing thread\n");
+
+	if(svnfs_ctx.head_poll > 0
+	   && apr_thread_create(&head_thread, NULL, svnfs_head_thread, NULL, pool)
+	      != APR_SUCCESS)
+		printf("Could not start /HEAD tracking thread\n");
+
+	if(svnfs_ctx.hedge > 0 && svnfs_ctx.hedge_budget > 0)
+	{
+		if(apr_thread_create(&hedge_thread, NULL, svnfs_hedge_thread, NULL,
+		                     pool) == APR_SUCCESS)
+			svnfs_hedge_started = 1;
+		else
+			printf("Could not start hedging thread\n");
+	}
+
+	return NULL;
 }
 
-/* END HELPER OPERATIONS }}}1 */
+/* END HEAD TRACKING }}}1 */
 
 /* MAIN OPERATIONS {{{1 */
 
 /*
  * svnfs_opt_proc
  *
- * Parses parameters one at a time.  Since there are currently no flags
- * available, this function simply tries to fill svnfs_ctx->repository and
- * svnfs_ctx->mount_point.
+ * Parses parameters one at a time.  Unnamed parameters fill svnfs_repository
+ * and svnfs_mountpoint; -o reject and -o reject_probes add to the set of
+ * rejected names; -o pin and -o quota add to svnfs_rules_text.
  *
  * data:    user data provided by caller
  * arg:     the argument being processed
@@ -411,6 +6967,10 @@ int svnfs_path_split(const char *path, svn_revnum_t *rev,
 static int svnfs_opt_proc(void *data, const char *arg, int key,
                    struct fuse_args *outargs)
 {
+	char *rule;
+	char *size;
+	int i;
+
 	switch(key)
 	{
 		case FUSE_OPT_KEY_NONOPT:
@@ -429,6 +6989,27 @@ static int svnfs_opt_proc(void *data, const char *arg, int key,
 				return -1;
 			}
 			break;
+		case SVNFS_KEY_REJECT:
+			svnfs_reject_add(arg + strlen("reject="));
+			return 0;
+		case SVNFS_KEY_REJECT_PROBES:
+			for(i = 0; svnfs_probe_names[i]; i++)
+				svnfs_reject_add(svnfs_probe_names[i]);
+			return 0;
+		case SVNFS_KEY_PIN:
+			svnfs_rules_text = apr_pstrcat(pool, svnfs_rules_text, "pin ",
+			                               arg + strlen("pin="), "\n", NULL);
+			return 0;
+		case SVNFS_KEY_QUOTA:
+			/* The size follows the last colon */
+			rule = apr_pstrdup(pool, arg + strlen("quota="));
+			size = strrchr(rule, ':');
+			if(!size)
+				return -1;
+			*size = ' ';
+			svnfs_rules_text = apr_pstrcat(pool, svnfs_rules_text, "quota ",
+			                               rule, "\n", NULL);
+			return 0;
 		default:
 			return 1;
 	}
@@ -444,23 +7025,269 @@ static int svnfs_opt_proc(void *data, const char *arg, int key,
 svn_error_t *svnfs_svn_init(void)
 {
 	apr_array_header_t *auth_objs;
-	svn_ra_callbacks2_t *callbacks;
+	svn_config_t *servers;
 	svn_auth_provider_object_t *simple_provider;
+	const char *repos_root;
+	char *prefix;
+	apr_size_t prefix_len;
 
-	SVN_ERR(svn_ra_create_callbacks(&callbacks, pool));
+	SVN_ERR(svn_ra_initialize(pool));
+
+	/* Have the HTTP layer give up on a silent connection rather than wait on
+	 * it forever; the cancellation callback only runs when data arrives */
+	SVN_ERR(svn_config_get_config(&svnfs_ra_config, NULL, pool));
+	servers = apr_hash_get(svnfs_ra_config, SVN_CONFIG_CATEGORY_SERVERS,
+	                       APR_HASH_KEY_STRING);
+	if(servers && svnfs_ctx.timeout_meta > 0)
+		svn_config_set(servers, SVN_CONFIG_SECTION_GLOBAL,
+		               SVN_CONFIG_OPTION_HTTP_TIMEOUT,
+		               apr_itoa(pool, svnfs_ctx.timeout_meta));
+	SVN_ERR(svn_ra_create_callbacks(&svnfs_ra_callbacks, pool));
+	svnfs_ra_callbacks->cancel_func = svnfs_ra_cancel;
 
 	/* Auth stuff */
-	auth_objs = apr_array_make(pool, 0, 0);
-	*(void **)apr_array_push(auth_objs) = simple_provider;
-	svn_auth_open(&callbacks->auth_baton, auth_objs, pool);
+	auth_objs = apr_array_make(pool, 1, sizeof(svn_auth_provider_object_t *));
+	svn_client_get_simple_provider(&simple_provider, pool);
+	*(svn_auth_provider_object_t **)apr_array_push(auth_objs) = simple_provider;
+	svn_auth_open(&svnfs_ra_callbacks->auth_baton, auth_objs, pool);
+
+	/* Open the connection.  The session gets a pool of its own so that it
+	 * can be thrown away and reopened if the connection breaks. */
+	if(apr_pool_create(&svnfs_ra_main.pool, NULL) != APR_SUCCESS)
+		return svn_error_create(APR_ENOMEM, NULL, "Could not create pool");
+	SVN_ERR(svnfs_ra_open(&svnfs_ra_main.session, svnfs_ra_main.pool));
 
-	/* Open the connection */
-	SVN_ERR(svn_ra_open2(&svnfs_ra_session, svnfs_repository, callbacks, NULL,
-	        NULL, pool));
+	/* Work out where the session is rooted within the repository */
+	SVN_ERR(svn_ra_get_repos_root(svnfs_ra_main.session, &repos_root, pool));
+	prefix = apr_pstrdup(pool, svn_path_uri_decode(svnfs_repository
+	                                               + strlen(repos_root), pool));
+	prefix_len = strlen(prefix);
+	while(prefix_len > 0 && prefix[prefix_len - 1] == '/')
+		prefix[--prefix_len] = '\0';
+	svnfs_repos_prefix = prefix;
+
+	/* /HEAD starts out at whatever is youngest right now */
+	SVN_ERR(svn_ra_get_latest_revnum(svnfs_ra_main.session, &svnfs_head_rev, pool));
 
 	return SVN_NO_ERROR;
 }
 
+/*
+ * svnfs_defaults
+ *
+ * Sets every option to its default, ready for svnfs_opt_proc.
+ */
+static void svnfs_defaults(void)
+{
+	svnfs_repository = NULL;
+	svnfs_mountpoint = NULL;
+	svnfs_ctx.head_poll = 10;
+	svnfs_ctx.stat_batch = 4;
+	svnfs_ctx.cache_size = 1024;
+	svnfs_ctx.attr_size = 256;
+	svnfs_ctx.scan_size = 16;
+	svnfs_ctx.admit_lfu = 1;
+	svnfs_ctx.ra_retries = 5;
+	svnfs_ctx.ra_backoff = 100;
+	svnfs_ctx.ra_threads = 4;
+	svnfs_ctx.hedge = 95;
+	svnfs_ctx.hedge_budget = 5;
+	svnfs_ctx.timeout_meta = 30;
+	svnfs_ctx.timeout_file = 600;
+	svnfs_ctx.timeout_log = 120;
+	svnfs_ctx.background_uid = -1;
+	svnfs_ctx.scrub_interval = 60;
+	svnfs_ctx.cache_io = SVNFS_IO_DONTNEED;
+	svnfs_rules_text = "";
+	svnfs_reject_names = apr_hash_make(pool);
+	svnfs_reject_globs = apr_array_make(pool, 0, sizeof(const char *));
+}
+
+/*
+ * svnfs_setup
+ *
+ * Sets up the caches and their locks once the options have been parsed.
+ * Nothing here talks to the repository, which is left to svnfs_svn_init, or
+ * starts a thread, which waits for svnfs_fuse_init.
+ *
+ * return: 0 on success, or -1 on error
+ */
+static int svnfs_setup(void)
+{
+	struct stat st;
+	struct rlimit limit;
+	const char *temp_dir;
+
+	/* The files of the content cache have no names, but they still live
+	 * somewhere, and in a shared temporary directory someone else could
+	 * have got there first */
+	if(!svnfs_ctx.cache_root)
+	{
+		if(apr_temp_dir_get(&temp_dir, pool) != APR_SUCCESS)
+			return -1;
+		svnfs_ctx.cache_root = apr_psprintf(pool, "%s/svnfs.%lu", temp_dir,
+		                                    (unsigned long)getuid());
+	}
+	apr_dir_make(svnfs_ctx.cache_root, APR_UREAD | APR_UWRITE | APR_UEXECUTE,
+	             pool);
+	if(lstat(svnfs_ctx.cache_root, &st) != 0 || !S_ISDIR(st.st_mode)
+	   || st.st_uid != getuid() || (st.st_mode & 077))
+	{
+		printf("Cache root \"%s\" is not a private directory\n",
+		       svnfs_ctx.cache_root);
+		return -1;
+	}
+
+	/* Every content cache entry in use holds its file open, so take all the
+	 * descriptors we are allowed and leave some over for everything else */
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		if(limit.rlim_cur < limit.rlim_max)
+		{
+			limit.rlim_cur = limit.rlim_max;
+			if(setrlimit(RLIMIT_NOFILE, &limit) != 0)
+				getrlimit(RLIMIT_NOFILE, &limit);
+		}
+		if(limit.rlim_cur != RLIM_INFINITY)
+		{
+			svnfs_cache_fd_limit = limit.rlim_cur > 1024
+			                       ? limit.rlim_cur - 256 : limit.rlim_cur / 2;
+			if(svnfs_cache_fd_limit < 256)
+				printf("Only %lu descriptors allowed; the content cache "
+				       "will keep at most %u files open\n",
+				       (unsigned long)limit.rlim_cur, svnfs_cache_fd_limit);
+		}
+	}
+
+	/* svnfs_ra_cancel needs this as soon as the first session is open */
+	if(apr_threadkey_private_create(&svnfs_ra_call_key, NULL, pool)
+	   != APR_SUCCESS)
+		return -1;
+#ifdef SVNFS_HAVE_IO_URING
+	if(apr_threadkey_private_create(&svnfs_uring_key, svnfs_uring_free, pool)
+	   != APR_SUCCESS)
+		return -1;
+#endif
+
+	if(apr_thread_mutex_create(&svnfs_ra_main_lock, APR_THREAD_MUTEX_DEFAULT,
+	                           pool) != APR_SUCCESS
+	   || apr_thread_cond_create(&svnfs_ra_main_cond, pool) != APR_SUCCESS)
+		return -1;
+	if(apr_thread_mutex_create(&svnfs_bucket_lock, APR_THREAD_MUTEX_DEFAULT,
+	                           pool) != APR_SUCCESS)
+		return -1;
+	svnfs_bucket_mount.rate = (apr_int64_t)svnfs_ctx.rate_limit * 1024;
+	svnfs_bucket_mount.tokens = svnfs_bucket_mount.rate;
+	svnfs_bucket_mount.stamp = apr_time_now();
+	svnfs_bucket_background.rate = (apr_int64_t)svnfs_ctx.rate_background * 1024;
+	svnfs_bucket_background.tokens = svnfs_bucket_background.rate;
+	svnfs_bucket_background.stamp = svnfs_bucket_mount.stamp;
+	if(apr_thread_mutex_create(&svnfs_hedge_lock, APR_THREAD_MUTEX_DEFAULT,
+	                           pool) != APR_SUCCESS)
+		return -1;
+	if(apr_thread_cond_create(&svnfs_hedge_cond, pool) != APR_SUCCESS)
+		return -1;
+	
+	if(svnfs_ctx.arena > 0
+	   && svnfs_arena_init((apr_size_t)svnfs_ctx.arena * 1024 * 1024,
+	                       svnfs_ctx.arena_hugetlb, pool) != 0)
+		return -1;
+
+	svnfs_cache_files = apr_hash_make(pool);
+	svnfs_cache_fills = apr_hash_make(pool);
+	svnfs_cache_probation = apr_hash_make(pool);
+	svnfs_cache_ghosts = apr_hash_make(pool);
+	if(apr_thread_mutex_create(&svnfs_cache_lock, APR_THREAD_MUTEX_DEFAULT,
+	                           pool) != APR_SUCCESS)
+		return -1;
+	if(apr_thread_cond_create(&svnfs_cache_cond, pool) != APR_SUCCESS)
+		return -1;
+	if(svnfs_rules_set(svnfs_rules_text) != 0)
+		return -1;
+
+	if(apr_thread_mutex_create(&svnfs_attr_lock, APR_THREAD_MUTEX_DEFAULT,
+	                           pool) != APR_SUCCESS)
+		return -1;
+	if(apr_thread_cond_create(&svnfs_attr_cond, pool) != APR_SUCCESS)
+		return -1;
+	if(apr_pool_create(&svnfs_attr_pool, NULL) != APR_SUCCESS)
+		return -1;
+	svnfs_attr_revs = apr_hash_make(svnfs_attr_pool);
+
+	if(apr_thread_mutex_create(&svnfs_head_lock, APR_THREAD_MUTEX_DEFAULT,
+	                           pool) != APR_SUCCESS)
+		return -1;
+	if(apr_pool_create(&svnfs_head_pool, NULL) != APR_SUCCESS)
+		return -1;
+	svnfs_head_changes = apr_hash_make(svnfs_head_pool);
+	svnfs_head_opens = apr_hash_make(svnfs_head_pool);
+
+	return 0;
+}
+
+/*
+ * svnfs_lib_parse
+ *
+ * Starts APR and parses options for svnfs_lib_init and svnfs_local_init.
+ *
+ * argc:   number of arguments
+ * argv:   the arguments, starting with a program name
+ * return: 0 on success, or -1 on error
+ */
+static int svnfs_lib_parse(int argc, char **argv)
+{
+	struct fuse_args args;
+
+	if(apr_initialize() != APR_SUCCESS)
+		return -1;
+
+	if(atexit(apr_terminate) != 0)
+		return -1;
+
+	if(apr_pool_create(&pool, NULL) != APR_SUCCESS)
+		return -1;
+
+	args.argc      = argc;
+	args.argv      = argv;
+	args.allocated = 0;
+	svnfs_defaults();
+	if(fuse_opt_parse(&args, &svnfs_ctx, svnfs_opts, svnfs_opt_proc) != 0)
+		return -1;
+	fuse_opt_free_args(&args);
+
+	return 0;
+}
+
+int svnfs_lib_init(int argc, char **argv)
+{
+	if(svnfs_lib_parse(argc, argv) != 0)
+		return -1;
+
+	if(!svnfs_repository || svnfs_mountpoint)
+		return -1;
+
+	if(svnfs_setup() != 0)
+		return -1;
+
+	if(svnfs_svn_init() != SVN_NO_ERROR)
+		return -1;
+
+	/* There is no fork to wait for here */
+	svnfs_fuse_init();
+	svnfs_lib_start();
+
+	return 0;
+}
+
+int svnfs_local_init(int argc, char **argv)
+{
+	if(svnfs_lib_parse(argc, argv) != 0)
+		return -1;
+
+	return svnfs_setup();
+}
+
+#ifndef SVNFS_LIBRARY
 int main(int argc, char **argv)
 {
 	struct fuse_args args;
@@ -482,24 +7309,26 @@ int main(int argc, char **argv)
 	args.argc      = argc;
 	args.argv      = argv;
 	args.allocated = 0;
-	svnfs_repository = NULL;
-	svnfs_mountpoint = NULL;
-	if(fuse_opt_parse(&args, NULL, svnfs_opts, svnfs_opt_proc) != 0)
+	svnfs_defaults();
+	if(fuse_opt_parse(&args, &svnfs_ctx, svnfs_opts, svnfs_opt_proc) != 0)
 		return EXIT_FAILURE;
 
 	if(!svnfs_repository || !svnfs_mountpoint)
 		return EXIT_FAILURE;
 
+	if(svnfs_setup() != 0)
+		return EXIT_FAILURE;
+
 	if(svnfs_svn_init() != SVN_NO_ERROR)
 		return EXIT_FAILURE;
 
-	if(apr_thread_rwlock_create(&svnfs_ra_session_lock, pool) != APR_SUCCESS)
+	/* Report the inode numbers from svnfs_ino rather than libfuse's own */
+	if(fuse_opt_add_arg(&args, "-ouse_ino") != 0)
 		return EXIT_FAILURE;
-	
-	svnfs_cache_files = apr_hash_make(pool);
 
 	return fuse_main(args.argc, args.argv, &svnfs_fuse_operations);
 }
+#endif /* SVNFS_LIBRARY */
 
 /* }}} END MAIN OPERATIONS */
 
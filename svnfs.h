@@ -11,79 +11,1750 @@
 #define FUSE_USE_VERSION 25
 
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <apr_hash.h>
+#include <apr_tables.h>
+#include <apr_time.h>
 #include <svn_types.h>
 #include <svn_string.h>
 #include <fuse.h>
 
+#include "libsvnfs.h"
+
+#ifdef SVNFS_HAVE_IO_URING
+#include <liburing.h>
+#include <svn_io.h>
+#endif
+
 /* STRUCTURES {{{1 */
 
-/* 
- * svnfs_cache_file_t
+/*
+ * SVNFS_BLKSIZE
+ *
+ * The I/O size we advertise through st_blksize and statfs.  Every read is a
+ * round trip through the kernel, so readers that size their buffers from
+ * st_blksize should use big ones.
+ */
+#define SVNFS_BLKSIZE (128 * 1024)
+
+/*
+ * SVNFS_GHOST_SIZE
+ *
+ * How many large files fetched on probation are remembered, so that a second
+ * access admits them to the content cache.
+ */
+#define SVNFS_GHOST_SIZE 4096
+
+/*
+ * SVNFS_SKETCH_DEPTH, SVNFS_SKETCH_WIDTH
+ *
+ * Dimensions of the Count-Min sketch which estimates how often each file is
+ * opened.  Every SVNFS_SKETCH_WIDTH * 8 opens all its counts are halved, so
+ * that it reflects recent popularity rather than all time.
+ */
+#define SVNFS_SKETCH_DEPTH 4
+#define SVNFS_SKETCH_WIDTH 8192
+
+/*
+ * SVNFS_ARENA_MIN, SVNFS_ARENA_CLASSES, SVNFS_ARENA_SLAB
+ *
+ * Size classes of the memory arena, doubling from SVNFS_ARENA_MIN bytes,
+ * and the size of the slabs each class carves from the region at a time.
+ * Larger allocations come from the heap.
+ */
+#define SVNFS_ARENA_MIN 32
+#define SVNFS_ARENA_CLASSES 8
+#define SVNFS_ARENA_SLAB (64 * 1024)
+
+/*
+ * SVNFS_HEAD_WINDOW
+ *
+ * How many revisions back the /HEAD tracker remembers which paths changed
+ * and were opened.  Once /HEAD has moved twice this far, anything older is
+ * forgotten, and files last opened before then lose their kernel cache on
+ * the next open.
+ */
+#define SVNFS_HEAD_WINDOW 1000
+
+/*
+ * svnfs_rule_t
+ *
+ * A content cache policy rule, matching entries by revision range and path
+ * prefix.  Pin rules keep their entries from ever being evicted; quota rules
+ * cap the bytes their entries may take up between them.  An entry is
+ * governed by the first rule it matches.
+ */
+typedef struct svnfs_rule_t
+{
+	/* Nonzero for a pin rule, zero for a quota rule */
+	int pin;
+
+	/* Revisions matched, inclusive */
+	svn_revnum_t first_rev;
+	svn_revnum_t last_rev;
+
+	/* Repository path prefix matched, without a trailing slash ("" matches
+	 * everything) */
+	const char *prefix;
+
+	/* Most bytes the matched entries may take up (quota rules only) */
+	apr_off_t quota;
+
+	/* Bytes and number of entries currently matched.  Protected by
+	 * svnfs_cache_lock. */
+	apr_off_t used;
+	unsigned int files;
+} svnfs_rule_t;
+
+/*
+ * SVNFS_CTL_DIR, SVNFS_CTL_RULES, SVNFS_CTL_QUERY, SVNFS_CTL_STATS
+ *
+ * The directory holding svnfs's control files, the file through which the
+ * content cache rules are read and replaced, the file through which the
+ * attributes of many paths are asked for at once, and the read-only file
+ * of the content cache's counters.
+ */
+#define SVNFS_CTL_DIR "/.svnfs"
+#define SVNFS_CTL_RULES SVNFS_CTL_DIR "/rules"
+#define SVNFS_CTL_QUERY SVNFS_CTL_DIR "/query"
+#define SVNFS_CTL_STATS SVNFS_CTL_DIR "/stats"
+
+/*
+ * SVNFS_QUERY_MAX, SVNFS_QUERY_CHUNK
+ *
+ * The most that may be written to SVNFS_CTL_QUERY in one go, which is room
+ * for a manifest of a million paths, and how many of its paths are statted
+ * together as one batch.
+ */
+#define SVNFS_QUERY_MAX (64 * 1024 * 1024)
+#define SVNFS_QUERY_CHUNK 4096
+
+/*
+ * svnfs_ctl_t
+ *
+ * An open control file: what a reader sees, or what a writer has written
+ * so far.  Threads may share an open file, so everything after lock is
+ * protected by it.
+ */
+typedef struct svnfs_ctl_t
+{
+	/* Pool from which lock is allocated, freed with the file */
+	apr_pool_t *pool;
+	apr_thread_mutex_t *lock;
+
+	/* Contents, heap-allocated */
+	char *buf;
+
+	/* Length of the contents, and size of buf */
+	apr_size_t len;
+	apr_size_t size;
+
+	/* Nonzero if written to since last applied */
+	int dirty;
+
+	/* Nonzero for SVNFS_CTL_QUERY, and nonzero once buf holds the answer
+	 * rather than the question */
+	int query;
+	int answered;
+
+	/* Offset in the file at which the answer starts: that of the read which
+	 * asked for it */
+	off_t origin;
+} svnfs_ctl_t;
+
+/* 
+ * svnfs_cache_file_t
+ *
+ * A mapping between a filename, a revision, and the name of a temporary file
+ * on disk used for caching purposes.  Entries are kept on a list in order of
+ * use, so that the least recently used can be evicted when the cache grows
+ * past svnfs_ctx.cache_size.
+ */
+typedef struct svnfs_cache_t
+{
+	/* Revision for which this file is cached */
+	svn_revnum_t rev;
+
+	/* Filename on disk of cached file, or "" if it has none because it
+	 * was unlinked as soon as it was created */
+	char *cache_path;
+
+	/* Descriptor of the cached file, or -1 once svnfs_cache_evict has closed
+	 * it to stay within the limit on descriptors.  Only files with a name
+	 * are closed, and only while refs is 0.  Protected by svnfs_cache_lock
+	 * while it may be -1. */
+	int fd;
+
+	/* Nonzero if fd was opened for direct I/O */
+	int direct;
+
+	/* Key of this entry in svnfs_cache_files */
+	char *key;
+
+	/* Size of the cached file in bytes */
+	apr_off_t size;
+
+	/* Hash identifying the entry in the persistent store, and checksum of
+	 * its contents; both 0 unless svnfs_ctx.cache_dir is set */
+	apr_uint64_t hash;
+	apr_uint64_t checksum;
+
+	/* Number of open file handles using this entry; it may not be evicted
+	 * while this is nonzero */
+	int refs;
+
+	/* The rule governing this entry, or NULL.  Protected by
+	 * svnfs_cache_lock. */
+	svnfs_rule_t *rule;
+
+	/* Nonzero if this entry is on probation: it is shared only by the
+	 * handles opened while it is, and is not in svnfs_cache_files */
+	int probation;
+
+	/* Offset just past the furthest read so far, and whether any read has
+	 * strayed from it; only kept for entries on probation.  Protected by
+	 * svnfs_cache_lock. */
+	apr_off_t next_offset;
+	int random;
+
+	/* For an entry on probation which is read while its contents arrive,
+	 * the fetch, of which the entry holds a reference; NULL otherwise.  Set
+	 * before the entry is handed out and only cleared once no handle is
+	 * left. */
+	struct svnfs_ra_job_t *fill;
+
+	/* Nonzero from when an admitted entry is recorded in the index until
+	 * svnfs_store_rename has given its file the permanent name, during
+	 * which the entry holds a reference of its own.  Protected by
+	 * svnfs_cache_lock. */
+	int renaming;
+
+	/* Neighbours on the LRU list; prev is more recently used */
+	struct svnfs_cache_t *prev;
+	struct svnfs_cache_t *next;
+} svnfs_cache_t;
+
+/*
+ * svnfs_cache_io_t
+ *
+ * Ways of reading and writing the files of the content cache.  Everything
+ * read through svnfs is kept in the page cache by the kernel as svnfs's own
+ * file, so also keeping the cached file there holds it in memory twice.
+ */
+typedef enum svnfs_cache_io_t
+{
+	/* Through the page cache, as any other file */
+	SVNFS_IO_BUFFERED,
+
+	/* Through the page cache, dropping the pages once filled or read */
+	SVNFS_IO_DONTNEED,
+
+	/* Around the page cache, with O_DIRECT */
+	SVNFS_IO_DIRECT
+} svnfs_cache_io_t;
+
+/*
+ * SVNFS_DIRECT_ALIGN
+ *
+ * Alignment of the offsets, lengths and buffers of direct I/O.
+ */
+#define SVNFS_DIRECT_ALIGN 4096
+
+#ifdef SVNFS_HAVE_IO_URING
+/*
+ * SVNFS_URING_DEPTH, SVNFS_URING_BUFSIZE
+ *
+ * Number and size of the buffers which io_uring fills and checksums keep in
+ * flight at once.
+ */
+#define SVNFS_URING_DEPTH 8
+#define SVNFS_URING_BUFSIZE (128 * 1024)
+
+/*
+ * svnfs_uring_t
+ *
+ * The io_uring instance and buffers of one thread, which writes a stream of
+ * file contents into a cached file as they arrive, so that the thread
+ * receiving them never waits for the disk unless every buffer is still
+ * being written.  A thread fetches one file at a time, so each fetch and
+ * checksum it makes reuses them.
+ */
+typedef struct svnfs_uring_t
+{
+	struct io_uring ring;
+
+	/* Nonzero once ring and base are set up */
+	int ready;
+
+	/* The file written to */
+	int fd;
+
+	/* SVNFS_URING_DEPTH buffers in one allocation, and which of them have
+	 * writes in flight */
+	char *base;
+	int busy[SVNFS_URING_DEPTH];
+	int inflight;
+
+	/* The buffer being filled, how much of it is, and the offset in the
+	 * file at which it goes */
+	int current;
+	apr_size_t fill;
+	apr_off_t offset;
+
+	/* The first error a write completed with, as -errno, or 0 */
+	int error;
+} svnfs_uring_t;
+#endif
+
+/*
+ * SVNFS_STORE_MAGIC, SVNFS_STORE_VERSION
+ *
+ * Identify the index file of a persistent content cache and the layout of
+ * its records.  An index with anything else in its header is thrown away.
+ */
+#define SVNFS_STORE_MAGIC 0x3158444953464e53ULL /* "SNFSIDX1" */
+#define SVNFS_STORE_VERSION 2
+
+/*
+ * SVNFS_SLOT_USED, SVNFS_SLOT_DEAD, SVNFS_SLOT_COMPLETE, SVNFS_SLOT_PINNED
+ *
+ * Flags of a persistent store slot: it describes a file, or used to (and
+ * must not end a probe); the file was fetched in full and its checksum
+ * recorded; the file was pinned when it was last admitted, and no rule
+ * has dropped every pin since.
+ */
+#define SVNFS_SLOT_USED     0x1
+#define SVNFS_SLOT_DEAD     0x2
+#define SVNFS_SLOT_COMPLETE 0x4
+#define SVNFS_SLOT_PINNED   0x8
+
+/*
+ * SVNFS_SCRUB_BATCH
+ *
+ * How many entries left over from earlier mounts the scrubber verifies each
+ * time it wakes.
+ */
+#define SVNFS_SCRUB_BATCH 16
+
+/*
+ * svnfs_store_header_t
+ *
+ * The start of the index file of a persistent content cache, which is
+ * followed by an open-addressed table of svnfs_store_slot_t.  The index is
+ * mapped into memory as it stands, so that a mount is ready in the same time
+ * however much is cached.
+ */
+typedef struct svnfs_store_header_t
+{
+	/* SVNFS_STORE_MAGIC and SVNFS_STORE_VERSION */
+	apr_uint64_t magic;
+	apr_uint32_t version;
+
+	/* Number of slots in the table, a power of two */
+	apr_uint32_t slots;
+
+	/* Hash of the repository URL the cache belongs to */
+	apr_uint64_t repos;
+
+	/* Incremented by every mount; slots stamped with the current value have
+	 * been checked by this mount */
+	apr_uint64_t generation;
+
+	/* Bytes and number of complete files described by the table */
+	apr_int64_t used;
+	apr_uint64_t files;
+
+	apr_uint64_t reserved[2];
+} svnfs_store_header_t;
+
+/*
+ * svnfs_store_slot_t
+ *
+ * A record in the index of a persistent content cache.  The file it
+ * describes is named after the hash, in a subdirectory named after the
+ * hash's low byte.
+ */
+typedef struct svnfs_store_slot_t
+{
+	/* Hash of the repository URL and cache key */
+	apr_uint64_t hash;
+
+	/* Second hash of the cache key, which tells apart keys that share the
+	 * first; see svnfs_store_check */
+	apr_uint64_t check;
+
+	/* Revision of the file */
+	apr_int64_t rev;
+
+	/* Size and checksum of the file's contents */
+	apr_int64_t size;
+	apr_uint64_t checksum;
+
+	/* Generation of the mount which last checked the file */
+	apr_uint64_t generation;
+
+	/* SVNFS_SLOT_* flags */
+	apr_uint32_t flags;
+	apr_uint32_t reserved;
+} svnfs_store_slot_t;
+
+/*
+ * svnfs_attr_t
+ *
+ * The attributes of a node at a particular revision, as cached by
+ * svnfs_attr_get.  Nodes which do not exist are cached with kind svn_node_none.
+ */
+typedef struct svnfs_attr_t
+{
+	/* Kind of node, or svn_node_none if it does not exist */
+	svn_node_kind_t kind;
+
+	/* Size in bytes, if a file */
+	svn_filesize_t size;
+
+	/* Revision in which the node last changed */
+	svn_revnum_t created_rev;
+
+	/* Which of the above are known, as a mask of SVN_DIRENT_* flags */
+	apr_uint32_t fields;
+} svnfs_attr_t;
+
+/*
+ * SVNFS_ATTR_FIELDS
+ *
+ * The SVN_DIRENT_* fields an svnfs_attr_t must have for getattr to use it.
+ */
+#define SVNFS_ATTR_FIELDS \
+	(SVN_DIRENT_KIND | SVN_DIRENT_SIZE | SVN_DIRENT_CREATED_REV)
+
+/*
+ * svnfs_attr_rev_t
+ *
+ * The attribute and directory caches of one revision.  Revisions are evicted
+ * whole, least recently used first, once the caches of all of them hold more
+ * than svnfs_ctx.attr_size thousand entries, so that everything cached about
+ * a revision is allocated from its own pool.
+ */
+typedef struct svnfs_attr_rev_t
+{
+	/* The revision */
+	svn_revnum_t rev;
+
+	/* Pool from which everything below is allocated */
+	apr_pool_t *pool;
+
+	/* Maps repository paths to their svnfs_attr_t */
+	apr_hash_t *attrs;
+
+	/* Maps repository paths of directories to their svnfs_dir_t */
+	apr_hash_t *dirs;
+
+	/* Number of entries in attrs and dirs */
+	unsigned int entries;
+
+	/* Number of threads using a svnfs_dir_t of this revision without
+	 * holding svnfs_attr_lock; the revision is not evicted while nonzero */
+	int busy;
+
+	/* Neighbours in the LRU list, most recently used first */
+	struct svnfs_attr_rev_t *prev;
+	struct svnfs_attr_rev_t *next;
+} svnfs_attr_rev_t;
+
+/*
+ * svnfs_dir_t
+ *
+ * What we know about a directory at a particular revision: how often stats of
+ * its children have missed the attribute cache, and, once it has been listed,
+ * its children.
+ */
+typedef struct svnfs_dir_t
+{
+	/* The caches of the directory's revision */
+	svnfs_attr_rev_t *attr_rev;
+
+	/* Maps the names of the children to their svnfs_attr_t, or NULL if the
+	 * directory has not been listed yet */
+	apr_hash_t *children;
+
+	/* The SVN_DIRENT_* fields known for every child */
+	apr_uint32_t fields;
+
+	/* Number of child stats that have missed the attribute cache */
+	int misses;
+
+	/* Number of svn_ra_stat calls on children currently in flight */
+	int pending;
+
+	/* Nonzero while some thread is listing the directory */
+	int listing;
+
+	/* Nonzero if listing failed because the directory is not there in this
+	 * revision, so we should stop trying */
+	int unlistable;
+} svnfs_dir_t;
+
+/*
+ * svnfs_ra_kind_t
+ *
+ * The kinds of repository request svnfs makes.  All of them are reads, so
+ * any of them may be repeated if the connection breaks part way through.
+ */
+typedef enum svnfs_ra_kind_t
+{
+	SVNFS_RA_LATEST, /* svn_ra_get_latest_revnum */
+	SVNFS_RA_STAT,   /* svn_ra_stat */
+	SVNFS_RA_DIR,    /* svn_ra_get_dir2 */
+	SVNFS_RA_FILE,   /* svn_ra_get_file */
+	SVNFS_RA_LOG     /* svn_ra_get_log */
+} svnfs_ra_kind_t;
+
+/*
+ * svnfs_ra_class_t
+ *
+ * Priority classes of repository request.  Demand requests are made on
+ * behalf of someone waiting on the mount and are never throttled; background
+ * requests (warmers, the /HEAD tracker) only run once no demand request is
+ * waiting, never on the last free I/O thread unless there is only one, and
+ * are held to the configured rates.
+ */
+typedef enum svnfs_ra_class_t
+{
+	SVNFS_RA_DEMAND,
+	SVNFS_RA_BACKGROUND
+} svnfs_ra_class_t;
+
+/*
+ * svnfs_ra_op_t
+ *
+ * A repository request, as run by svnfs_ra_execute.  The caller fills in the
+ * kind and the arguments that kind uses; svnfs_ra_execute fills in the
+ * results.
+ */
+typedef struct svnfs_ra_op_t
+{
+	/* Which request to make */
+	svnfs_ra_kind_t kind;
+
+	/* Priority class of the request */
+	svnfs_ra_class_t priority;
+
+	/* If not NULL, set to nonzero by someone who needs a background
+	 * request's answer now, which lifts its throttling (FILE) */
+	volatile apr_uint32_t *urgent;
+
+	/* Session-relative path (STAT, DIR, FILE, LOG) */
+	const char *path;
+
+	/* Revision (STAT, DIR, FILE), or the first revision (LOG) */
+	svn_revnum_t rev;
+
+	/* The last revision (LOG) */
+	svn_revnum_t end_rev;
+
+	/* SVN_DIRENT_* fields to ask for (DIR) */
+	apr_uint32_t fields;
+
+	/* File to which the contents are written (FILE); it is truncated before
+	 * each attempt */
+	apr_file_t *file;
+
+	/* Receiver for log messages (LOG); it may see a revision more than once
+	 * if the request is retried */
+	svn_log_message_receiver_t receiver;
+	void *receiver_baton;
+
+	/* Nonzero to have the checksum of the contents worked out as they are
+	 * written (FILE) */
+	int hashed;
+
+	/* Nonzero to have the contents written in order, and counted in
+	 * progress as they land, so that they can be read before the request is
+	 * done (FILE).  A retry then writes over what is there instead of
+	 * truncating it, since it writes the same contents. */
+	int streamed;
+
+	/* Mutex under which progress is updated, and condition broadcast when
+	 * it is (FILE, if streamed); set by svnfs_ra_post */
+	apr_thread_mutex_t *progress_lock;
+	apr_thread_cond_t *progress_cond;
+
+	/* RESULTS */
+
+	/* The youngest revision (LATEST) */
+	svn_revnum_t latest;
+
+	/* The node, or NULL if it does not exist (STAT) */
+	svn_dirent_t *dirent;
+
+	/* The listing (DIR) */
+	apr_hash_t *dirents;
+
+	/* Bytes at the start of the file known to be written (FILE, if
+	 * streamed) */
+	apr_off_t progress;
+
+	/* Checksum of the contents, as svnfs_store_checksum would compute it
+	 * (FILE, if hashed) */
+	apr_uint64_t checksum;
+} svnfs_ra_op_t;
+
+/*
+ * svnfs_ra_conn_t
+ *
+ * A session to the repository together with what is needed to replace it
+ * when it breaks.  Used by one thread at a time: each I/O thread owns its
+ * own, so that a request never waits behind another for a session.
+ */
+typedef struct svnfs_ra_conn_t
+{
+	/* The session, or NULL until first used */
+	svn_ra_session_t *session;
+
+	/* Pool from which the session is allocated; destroyed along with it
+	 * when the session is reopened */
+	apr_pool_t *pool;
+
+	/* Name used in messages */
+	const char *name;
+} svnfs_ra_conn_t;
+
+/*
+ * svnfs_bucket_t
+ *
+ * A token bucket limiting the rate at which file contents are streamed from
+ * the repository.  Tokens are bytes; the bucket holds at most one second's
+ * worth, and may go into debt by as much.  Protected by svnfs_bucket_lock.
+ */
+typedef struct svnfs_bucket_t
+{
+	/* Bytes per second, or 0 for no limit */
+	apr_int64_t rate;
+
+	/* Bytes that may be streamed before waiting */
+	apr_int64_t tokens;
+
+	/* When tokens was last topped up */
+	apr_time_t stamp;
+} svnfs_bucket_t;
+
+/*
+ * svnfs_ra_call_t
+ *
+ * One attempt at a repository request, as seen by svnfs_ra_cancel while the
+ * request is running.
+ */
+typedef struct svnfs_ra_call_t
+{
+	/* Set once nobody wants the answer any more */
+	volatile apr_uint32_t cancelled;
+
+	/* Time by which the request must have been answered, or 0 for none */
+	apr_time_t deadline;
+
+	/* Milliseconds spent held back by the rate limits, which push the
+	 * deadline back by as much; see svnfs_ra_due */
+	volatile apr_uint32_t throttled;
+} svnfs_ra_call_t;
+
+/*
+ * svnfs_ra_job_t
+ *
+ * A request queued for an I/O thread.  The I/O thread runs a copy of the
+ * request, writing to a descriptor and allocating results from a pool of the
+ * job's own, so that a caller that stops waiting at the deadline can go
+ * while the request finishes or is cancelled.  Allocated from its own pool,
+ * which is destroyed when the last reference is dropped.
+ */
+typedef struct svnfs_ra_job_t
+{
+	/* Copy of the request, as run by the I/O thread.  Its urgent pointer
+	 * is only read or cleared with svnfs_bucket_lock held. */
+	svnfs_ra_op_t op;
+
+	/* Cancellation state and deadline of the request */
+	svnfs_ra_call_t call;
+
+	/* Pool holding this structure and the results */
+	apr_pool_t *pool;
+
+	/* Duplicate of the caller's descriptor which op.file wraps (FILE), or
+	 * -1; closed with the last reference */
+	apr_os_file_t fd;
+
+	/* Next request in the same queue; protected by svnfs_ra_queue_lock */
+	struct svnfs_ra_job_t *next;
+
+	/* Mutex protecting the members below and the progress of op, and
+	 * condition broadcast when the request is done or makes progress */
+	apr_thread_mutex_t *lock;
+	apr_thread_cond_t *cond;
+
+	/* The caller's request, whose receiver is passed the log messages
+	 * (LOG), or NULL once the caller has stopped waiting; only the LOG
+	 * receiver looks past whether it is NULL */
+	svnfs_ra_op_t *caller;
+
+	/* The result, and nonzero once it is there */
+	svn_error_t *err;
+	int done;
+
+	/* The caller and the I/O thread each hold a reference, as does a
+	 * hedge of the request */
+	int refs;
+} svnfs_ra_job_t;
+
+/*
+ * SVNFS_HEDGE_SAMPLES
+ *
+ * How many of the most recent STAT and DIR latencies the hedging threshold is
+ * computed from.
+ */
+#define SVNFS_HEDGE_SAMPLES 256
+
+/*
+ * svnfs_hedge_t
+ *
+ * A STAT or DIR request which the hedge thread will duplicate on the hedge
+ * session if it has not been answered by the time it falls due.  Allocated
+ * from its own pool, which is destroyed when the last reference is dropped.
+ * Everything but op, hedge_won and the cancellation state of the duplicate
+ * is protected by svnfs_hedge_lock.
+ */
+typedef struct svnfs_hedge_t
+{
+	/* Copy of the request, into which the duplicate's results are stored */
+	svnfs_ra_op_t op;
+
+	/* Pool holding this structure and the duplicate's results */
+	apr_pool_t *pool;
+
+	/* When to send the duplicate */
+	apr_time_t due;
+
+	/* The original request, of which a reference is held, and the
+	 * duplicate */
+	svnfs_ra_job_t *primary;
+	svnfs_ra_call_t hedge;
+
+	/* Nonzero while on svnfs_hedge_queue */
+	int queued;
+
+	/* Nonzero once either request has answered */
+	int done;
+
+	/* Nonzero if the duplicate answered first; ends the caller's wait for
+	 * the original, which is cancelled */
+	volatile apr_uint32_t hedge_won;
+
+	/* The caller and the hedge thread each hold a reference */
+	int refs;
+
+	/* Next on svnfs_hedge_queue */
+	struct svnfs_hedge_t *next;
+} svnfs_hedge_t;
+
+/*
+ * svnfs_context_t
+ *
+ * Options that may be given on the command line with -o.  See svnfs_opts in
+ * svnfs.c for the names under which each field is parsed.
+ */
+typedef struct svnfs_context_t
+{
+	/* Seconds between checks for a new youngest revision; 0 disables /HEAD
+	 * tracking after mount */
+	int head_poll;
+
+	/* Number of stat misses under one directory after which the whole
+	 * directory is listed instead; 0 disables listing on stat misses */
+	int stat_batch;
+
+	/* Capacity of the content cache, in megabytes */
+	int cache_size;
+
+	/* Capacity of the attribute and directory caches, in thousands of
+	 * entries */
+	int attr_size;
+
+	/* Files of at least this many megabytes are not admitted to the content
+	 * cache on first access unless read out of order; 0 admits everything */
+	int scan_size;
+
+	/* Nonzero to admit a file to a full content cache only if it has been
+	 * opened more often lately than the file it would push out */
+	int admit_lfu;
+
+	/* Number of times a request that failed because the connection broke is
+	 * retried on a fresh session */
+	int ra_retries;
+
+	/* Milliseconds to wait before the first retry; each further retry waits
+	 * up to twice as long as the one before */
+	int ra_backoff;
+
+	/* Number of I/O threads running repository requests */
+	int ra_threads;
+
+	/* Percentile of recent STAT and DIR latencies after which a request is
+	 * duplicated on a second session; 0 disables hedging */
+	int hedge;
+
+	/* Duplicates allowed, as a percentage of STAT and DIR requests */
+	int hedge_budget;
+
+	/* Seconds within which LATEST, STAT and DIR requests, FILE requests and
+	 * LOG requests respectively must be answered; 0 for no limit.  The first
+	 * is also the socket timeout. */
+	int timeout_meta;
+	int timeout_file;
+	int timeout_log;
+
+	/* Kilobytes per second of file contents streamed by the whole mount, and
+	 * by background requests; 0 for no limit.  Demand requests count
+	 * against the first but never wait on it. */
+	int rate_limit;
+	int rate_background;
+
+	/* Opens by this user are background requests; -1 for none */
+	int background_uid;
+
+	/* Directory in which the content cache is kept across mounts, or NULL
+	 * to use temporary files */
+	char *cache_dir;
+
+	/* Directory under which the temporary files are created, if cache_dir
+	 * is not given */
+	char *cache_root;
+
+	/* How cached files are read and written, an svnfs_cache_io_t */
+	int cache_io;
+
+	/* Megabytes reserved for the memory arena; 0 for none */
+	int arena;
+
+	/* Nonzero to back the arena with reserved rather than transparent huge
+	 * pages */
+	int arena_hugetlb;
+
+	/* Seconds between checks of files cached by earlier mounts; 0 disables
+	 * the scrubber */
+	int scrub_interval;
+
+	/* Nonzero to leave out the notes svnfs_note prints */
+	int quiet;
+} svnfs_context_t;
+
+/*
+ * svnfs_path_t
+ *
+ * A path under the mount, split by svnfs_path_parse at the end of its
+ * revision component.
+ */
+typedef struct svnfs_path_t
+{
+	/* Nonzero if the revision component was HEAD */
+	int head;
+
+	/* The revision named, or SVN_INVALID_REVNUM for HEAD */
+	svn_revnum_t rev;
+
+	/* The rest of the path: empty for the revision root, and otherwise
+	 * starting with a slash */
+	const char *rest;
+} svnfs_path_t;
+
+/* }}}1 END STRUCTURES */
+
+/* HELPER OPERATIONS {{{1 */
+
+/*
+ * svnfs_note
+ *
+ * Prints a note on the ordinary course of events, such as a cache miss or
+ * eviction, to standard output unless svnfs_ctx.quiet is set.  Errors and
+ * warnings are printed regardless.
+ *
+ * format: printf format of the note
+ */
+void svnfs_note(const char *format, ...)
+	__attribute__((format(printf, 1, 2)));
+
+/*
+ * svnfs_path_parse
+ *
+ * Parses the revision at the start of a path of the form /{revision}/path...
+ * without allocating, locking or logging anything.  The revision is either
+ * HEAD or a decimal number with no sign or leading zeros that fits in a
+ * svn_revnum_t; anything else is refused.
+ *
+ * path:   the path to be parsed
+ * view:   filled in with what was found; view->rest points into path
+ * return: nonzero on success, zero on failure
+ */
+int svnfs_path_parse(const char *path, svnfs_path_t *view);
+
+/*
+ * svnfs_path_split
+ *
+ * Splits a path of the form /{revision}/path... into a svn_revnum_t and the
+ * repository path below it, resolving /HEAD to the youngest revision seen.
+ *
+ * path:       the path to be split
+ * rev:        pointer to svn_revnum_t to receive revision number
+ * repos_path: pointer to receive repository path to file, which points into
+ *             path, or is "/" for the revision root
+ * return:     nonzero on success, zero on failure
+ */
+int svnfs_path_split(const char *path, svn_revnum_t *rev,
+                     const char **repos_path);
+
+/*
+ * svnfs_attr_get
+ *
+ * Looks up the attributes of a node, asking the repository on a cache miss.
+ * Misses under a directory are coalesced: once svnfs_ctx.stat_batch of them
+ * have occurred, or whenever another stat of a sibling is already in flight,
+ * the parent directory is listed with a single svn_ra_get_dir2 and all of its
+ * children are answered from that listing.  The same happens on the first
+ * miss under a directory that has already been read, since its children are
+ * then usually about to be statted one by one.
+ *
+ * repos_path: session-relative path of the node
+ * rev:        revision of the node
+ * attr:       filled with a copy of the cached attributes
+ * subpool:    pool for temporary allocations
+ * return:     0 on success, or -errno on error
+ */
+int svnfs_attr_get(const char *repos_path, svn_revnum_t rev,
+                   svnfs_attr_t *attr, apr_pool_t *subpool);
+
+/*
+ * svnfs_attr_expect
+ *
+ * Notes that a node is about to be looked up, counting it as a miss under its
+ * parent if it is not in the cache.  Expecting a batch of siblings up front
+ * has the first of their lookups list the parent, rather than the first few
+ * each being statted on their own.
+ *
+ * repos_path: session-relative path of the node
+ * rev:        revision of the node
+ * subpool:    pool for temporary allocations
+ */
+void svnfs_attr_expect(const char *repos_path, svn_revnum_t rev,
+                       apr_pool_t *subpool);
+
+/*
+ * svnfs_attr_rev
+ *
+ * Finds the caches of a revision, creating them if needed, and marks them
+ * most recently used.  Evicts other revisions that are not busy while the
+ * caches are over capacity, so the caller must not be holding on to anything
+ * from another revision unless it is marked busy.  Must be called with
+ * svnfs_attr_lock held.
+ *
+ * rev:    the revision
+ * return: the caches of the revision
+ */
+svnfs_attr_rev_t *svnfs_attr_rev(svn_revnum_t rev);
+
+/*
+ * svnfs_dir_get
+ *
+ * Finds the directory cache entry for a directory, creating it if needed, as
+ * svnfs_attr_rev does for its revision.  Must be called with svnfs_attr_lock
+ * held.
+ *
+ * repos_path: session-relative path of the directory
+ * rev:        revision of the directory
+ * return:     the directory cache entry
+ */
+svnfs_dir_t *svnfs_dir_get(const char *repos_path, svn_revnum_t rev);
+
+/*
+ * svnfs_dir_store
+ *
+ * Records a directory listing in the directory and attribute caches.  Must be
+ * called with svnfs_attr_lock held.
+ *
+ * dir:        the directory cache entry to fill
+ * repos_path: session-relative path of the directory
+ * dirents:    listing as returned by svn_ra_get_dir2
+ * fields:     the SVN_DIRENT_* fields that were requested for the listing
+ * pool:       pool for temporary allocations
+ */
+void svnfs_dir_store(svnfs_dir_t *dir, const char *repos_path,
+                     apr_hash_t *dirents, apr_uint32_t fields,
+                     apr_pool_t *pool);
+
+/*
+ * svnfs_attr_fill
+ *
+ * Fills a stat struct from cached attributes.
+ *
+ * stbuf:      stat struct to fill
+ * repos_path: session-relative path of the node
+ * attr:       attributes of the node, with at least SVNFS_ATTR_FIELDS known
+ */
+void svnfs_attr_fill(struct stat *stbuf, const char *repos_path,
+                     const svnfs_attr_t *attr);
+
+/*
+ * svnfs_ra_open
+ *
+ * Opens a new session to svnfs_repository.
+ *
+ * session: pointer to receive the session
+ * pool:    pool from which to allocate the session; the session lives until
+ *          the pool is destroyed
+ * return:  SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+svn_error_t *svnfs_ra_open(svn_ra_session_t **session, apr_pool_t *pool);
+
+/*
+ * svnfs_ra_execute
+ *
+ * Runs a repository request on one of the I/O threads, waiting for it to
+ * finish.  Each thread has a session of its own.  If the request fails
+ * because the connection broke, the session is reopened and the request
+ * retried, up to svnfs_ctx.ra_retries times, after a randomised exponential
+ * backoff.  Other errors are returned immediately.
+ *
+ * STAT and DIR requests which take longer than most are duplicated on a
+ * second session, and whichever answer comes first is used.
+ *
+ * Each kind of request has a deadline, given by svnfs_ctx.timeout_*, past
+ * which it is cancelled and fails with APR_TIMEUP.  The session is reopened
+ * afterwards, since a cancelled request leaves it part way through an answer.
+ *
+ * op:     the request
+ * pool:   pool from which results are allocated
+ * return: SVN_NO_ERROR on success, or an svn_error_t* on failure
+ */
+svn_error_t *svnfs_ra_execute(svnfs_ra_op_t *op, apr_pool_t *pool);
+
+/*
+ * svnfs_ra_missing
+ *
+ * Determines whether a failed repository request asked for a path or
+ * revision that does not exist, or for a directory that is not one, which
+ * asking again will not change.
+ *
+ * err:    the error
+ * return: nonzero if the path is missing, zero for any other failure
+ */
+int svnfs_ra_missing(svn_error_t *err);
+
+/*
+ * svnfs_ra_errno
+ *
+ * Picks the errno with which a FUSE operation reports a failed repository
+ * request.
+ *
+ * err:      the error
+ * fallback: negated errno to use unless the request ran out of time
+ * return:   -ETIMEDOUT if the request passed its deadline, else fallback
+ */
+int svnfs_ra_errno(svn_error_t *err, int fallback);
+
+/*
+ * svnfs_ra_begin
+ *
+ * Starts a streamed FILE request on an I/O thread without waiting for it,
+ * so that the contents can be read as they arrive.  Only possible once the
+ * I/O threads are running.
+ *
+ * op:     the request, which need not stay put
+ * return: the job, of which the caller holds a reference, or NULL if the
+ *         request could not be started
+ */
+svnfs_ra_job_t *svnfs_ra_begin(svnfs_ra_op_t *op);
+
+/*
+ * svnfs_ra_await
+ *
+ * Waits until a request started by svnfs_ra_begin has written its file up to
+ * an offset, or is done, but not past its deadline.
+ *
+ * job:    the job
+ * offset: the offset
+ * return: 0 if the contents are there or the request succeeded, or -errno
+ *         if it failed or ran out of time short of the offset
+ */
+int svnfs_ra_await(svnfs_ra_job_t *job, apr_off_t offset);
+
+/*
+ * svnfs_ra_failed
+ *
+ * Determines whether a request started by svnfs_ra_begin is done and
+ * failed.
+ *
+ * job:    the job
+ * return: nonzero if the request failed, zero if it succeeded or is not done
+ */
+int svnfs_ra_failed(svnfs_ra_job_t *job);
+
+/*
+ * svnfs_ra_end
+ *
+ * Drops the reference to a job taken by svnfs_ra_begin, cancelling the
+ * request if it is not done yet.
+ *
+ * job:    the job
+ * return: nonzero if the request was done and succeeded, zero otherwise
+ */
+int svnfs_ra_end(svnfs_ra_job_t *job);
+
+/*
+ * svnfs_cache_fill
+ *
+ * Fetches a file from the repository into a new content cache entry.  If
+ * another thread is already fetching it, waits for that fetch instead, first
+ * lifting its throttling if this is a demand request.  A large file which
+ * has not been seen recently gets an entry on probation, which is only
+ * admitted when released if it was not read straight through.  So does a
+ * file which svnfs_cache_admit turns away.  An entry on probation is shared
+ * by every open of the file until it is released, those that waited for its
+ * fetch included, and a demand request returns it as soon as its fetch is
+ * under way, the contents being read as they arrive.
+ *
+ * key:        key of the entry in svnfs_cache_files
+ * repos_path: session-relative path of the file
+ * rev:        revision of the file
+ * priority:   priority class of the fetch
+ * cache:      pointer to receive the entry, with a reference held for the
+ *             caller
+ * subpool:    pool for temporary allocations
+ * return:     0 on success, or -errno on error
+ */
+int svnfs_cache_fill(const char *key, const char *repos_path, svn_revnum_t rev,
+                     svnfs_ra_class_t priority, svnfs_cache_t **cache,
+                     apr_pool_t *subpool);
+
+/*
+ * svnfs_arena_init
+ *
+ * Reserves the region of the memory arena, backed by huge pages.  Content
+ * cache entries are looked at on every open, so packing them into a few
+ * huge pages rather than scattering them over the heap spares the TLB; and
+ * since each is carved from a slab of its size class and recycled there on
+ * eviction, the arena never fragments.
+ *
+ * size:    size of the region in bytes, rounded up to whole huge pages
+ * hugetlb: nonzero to try reserved huge pages before transparent ones
+ * pool:    pool to allocate the arena's bookkeeping from
+ * return:  0 on success, or -errno on error
+ */
+int svnfs_arena_init(apr_size_t size, int hugetlb, apr_pool_t *pool);
+
+/*
+ * svnfs_arena_alloc
+ *
+ * Allocates from the memory arena, or from the heap if there is no arena,
+ * the allocation is too big for any size class, or the region is full.
+ *
+ * size:   bytes to allocate
+ * return: the allocation, or NULL if out of memory
+ */
+void *svnfs_arena_alloc(apr_size_t size);
+
+/*
+ * svnfs_arena_strdup
+ *
+ * Copies a string into memory from svnfs_arena_alloc.
+ *
+ * s:      the string
+ * return: the copy, or NULL if out of memory
+ */
+char *svnfs_arena_strdup(const char *s);
+
+/*
+ * svnfs_arena_release
+ *
+ * Returns memory from svnfs_arena_alloc to its size class, or to the heap.
+ *
+ * p: the allocation
+ */
+void svnfs_arena_release(void *p);
+
+/*
+ * svnfs_cache_new
+ *
+ * Makes a content cache entry for a file on disk, which has not yet been
+ * added to svnfs_cache_files.
+ *
+ * key:        key of the entry in svnfs_cache_files
+ * rev:        revision of the file
+ * cache_path: name of the file on disk, or "" if it has none
+ * fd:         open descriptor of the file, which the entry takes over
+ * size:       size of the file
+ * hash:       hash of the file in the persistent store, or 0
+ * checksum:   checksum of the file's contents, or 0
+ * return:     the entry, with a reference held for the caller, or NULL if
+ *             out of memory
+ */
+svnfs_cache_t *svnfs_cache_new(const char *key, svn_revnum_t rev,
+                               const char *cache_path, int fd,
+                               apr_off_t size, apr_uint64_t hash,
+                               apr_uint64_t checksum);
+
+/*
+ * svnfs_cache_read
  *
- * A mapping between a filename, a revision, and the name of a temporary file
- * on disk used for caching purposes.
+ * Reads from the file of a content cache entry, as svnfs_ctx.cache_io
+ * directs.
+ *
+ * cache:  the entry
+ * buf:    buffer to read into
+ * len:    size of buf
+ * offset: offset in the file to read from
+ * return: number of bytes read, short only at the end of the file, or
+ *         -errno on error
  */
-typedef struct svnfs_cache_t
-{
-	/* Revision for which this file is cached */
-	svn_revnum_t rev;
+int svnfs_cache_read(svnfs_cache_t *cache, char *buf, size_t len,
+                     off_t offset);
 
-	/* Filename on disk of cached file */
-	char *cache_path;
-} svnfs_cache_t;
+/*
+ * svnfs_cache_reopen
+ *
+ * Opens the file of a content cache entry again if svnfs_cache_evict closed
+ * it while the entry was idle.  The caller must hold a reference.
+ *
+ * cache:   the entry
+ * subpool: pool for temporary allocations
+ * return:  0 on success, or -errno on error
+ */
+int svnfs_cache_reopen(svnfs_cache_t *cache, apr_pool_t *subpool);
 
-/* }}}1 END STRUCTURES */
-
-/* HELPER OPERATIONS {{{1 */
+/*
+ * svnfs_cache_unbuffer
+ *
+ * Moves the file of a newly made content cache entry out of the page cache
+ * and, if svnfs_ctx.cache_io asks for it, switches it to direct I/O.
+ *
+ * cache: the entry
+ */
+void svnfs_cache_unbuffer(svnfs_cache_t *cache);
 
 /*
- * svnfs_path_split
+ * svnfs_cache_discard
  *
- * Splits a path of the form /{revision}/path... into a svn_revnum_t and a
- * char* path, which is allocated from pool.
+ * Closes and removes the file of a content cache entry which is in no list
+ * or hash, and frees the entry.
  *
- * path:       the path to be split
- * rev:        pointer to svn_revnum_t to receive revision number, or
- *             SVN_IGNORED_REVNUM if the path is the root ("/")
- * repos_path: pointer to char* to receive repository path to file (will be
- *             allocated from the APR pool)
- * return:     nonzero on success, zero on failure
+ * cache: the entry
  */
-int svnfs_path_split(const char *path, svn_revnum_t *rev,
-                           char **repos_path);
+void svnfs_cache_discard(svnfs_cache_t *cache);
+
+/*
+ * svnfs_cache_touch
+ *
+ * Moves a content cache entry to the most recently used end of the LRU list.
+ * Must be called with svnfs_cache_lock held.
+ *
+ * cache: the entry
+ */
+void svnfs_cache_touch(svnfs_cache_t *cache);
+
+/*
+ * svnfs_cache_sketch_add
+ *
+ * Counts an open of a file towards the frequency sketch.  Must be called
+ * with svnfs_cache_lock held.
+ *
+ * key: key of the file in svnfs_cache_files
+ */
+void svnfs_cache_sketch_add(const char *key);
+
+/*
+ * svnfs_cache_admit
+ *
+ * Adds a fetched entry to svnfs_cache_files and the LRU list, evicting
+ * others to make room.  If room would have to be made and the entry's file
+ * has not been opened more often lately than the first file that would be
+ * evicted, the entry is turned away instead and left on probation.  Pinned
+ * entries are always admitted; entries under a quota rule push out others
+ * under the same rule, and are turned away if that is not enough.  Must be
+ * called with svnfs_cache_lock held, and an admitted entry passed to
+ * svnfs_store_rename once the lock is let go.
+ *
+ * cache:  the entry
+ * return: nonzero if the entry was admitted, zero otherwise
+ */
+int svnfs_cache_admit(svnfs_cache_t *cache);
+
+/*
+ * svnfs_cache_settle
+ *
+ * Decides the fate of an entry on probation once its last handle is
+ * released.  If its contents never arrived in full it is thrown away.  If
+ * it was read out of order it is likely to be wanted again, and is
+ * offered to svnfs_cache_admit; if it was read straight through, as by a
+ * backup or a copy, or is turned away, it is thrown away.  Must be called
+ * with svnfs_cache_lock held.
+ *
+ * cache:  the entry
+ * return: nonzero if the entry was admitted, zero if it is gone
+ */
+int svnfs_cache_settle(svnfs_cache_t *cache);
+
+/*
+ * svnfs_cache_evict
+ *
+ * Evicts least recently used entries that are neither open nor pinned until
+ * the content cache fits in svnfs_ctx.cache_size again.  Must be called with
+ * svnfs_cache_lock held.
+ */
+void svnfs_cache_evict(void);
+
+/*
+ * svnfs_store_open
+ *
+ * Opens the index of the persistent content cache in svnfs_ctx.cache_dir,
+ * creating it if need be, and maps it into memory.  Nothing in the cache is
+ * looked at yet: each file is checked the first time it is opened, and the
+ * rest by the scrubber in the background.  An index left by a different
+ * repository or version is started afresh, and the files it described are
+ * swept up by the scrubber.
+ *
+ * pool:   pool to allocate the mapping from
+ * return: 0 on success, or -errno on error
+ */
+int svnfs_store_open(apr_pool_t *pool);
+
+/*
+ * svnfs_store_hash
+ *
+ * Computes the hash identifying a file in the persistent store.
+ *
+ * key:    key of the file in svnfs_cache_files
+ * return: the hash
+ */
+apr_uint64_t svnfs_store_hash(const char *key);
+
+/*
+ * svnfs_store_has
+ *
+ * Determines whether the persistent store holds a complete copy of a file
+ * which this mount has not yet loaded.  Must be called with svnfs_cache_lock
+ * held.
+ *
+ * key:    key of the file in svnfs_cache_files
+ * hash:   hash of the file
+ * return: nonzero if it does, zero otherwise or if there is no store
+ */
+int svnfs_store_has(const char *key, apr_uint64_t hash);
+
+/*
+ * svnfs_store_load
+ *
+ * Makes a content cache entry for a file kept by an earlier mount, after
+ * checking that the file is all there and matches its checksum.  A file
+ * which fails the check is discarded.  The caller must have registered the
+ * key in svnfs_cache_fills, and must offer the entry to svnfs_cache_admit.
+ *
+ * key:     key of the file in svnfs_cache_files
+ * rev:     revision of the file
+ * hash:    hash of the file
+ * cache:   pointer to receive the entry, with a reference held for the
+ *          caller
+ * subpool: pool for temporary allocations
+ * return:  0 on success, or -errno if the file must be fetched again
+ */
+int svnfs_store_load(const char *key, svn_revnum_t rev, apr_uint64_t hash,
+                     svnfs_cache_t **cache, apr_pool_t *subpool);
+
+/*
+ * svnfs_store_mktemp
+ *
+ * Creates a file in the persistent store to fetch a file into.  It is only
+ * given its permanent name when admitted, so that a fetch cut short never
+ * leaves anything that looks complete.
+ *
+ * hash:    hash of the file
+ * fd:      pointer to receive a descriptor of the file, open for reading
+ *          and writing
+ * path:    pointer to receive its name, allocated from subpool
+ * subpool: pool to allocate from
+ * return:  0 on success, or -errno on error
+ */
+int svnfs_store_mktemp(apr_uint64_t hash, int *fd, char **path,
+                       apr_pool_t *subpool);
+
+/*
+ * svnfs_store_checksum
+ *
+ * Reads a file through, computing its size and checksum.  Only needed for
+ * files kept by earlier mounts; the checksum of a file being fetched is
+ * worked out as it is written.
+ *
+ * path:     name of the file
+ * checksum: pointer to receive the checksum
+ * size:     pointer to receive the size
+ * return:   0 on success, or -errno on error
+ */
+int svnfs_store_checksum(const char *path, apr_uint64_t *checksum,
+                         apr_off_t *size);
+
+/*
+ * svnfs_store_keep
+ *
+ * Records an admitted entry in the index, and marks it as renaming so that
+ * the caller gives it its permanent name with svnfs_store_rename once it has
+ * let go of svnfs_cache_lock.  If the index is full the entry still works,
+ * but is forgotten at unmount.  Must be called with svnfs_cache_lock held.
+ *
+ * cache: the entry
+ */
+void svnfs_store_keep(svnfs_cache_t *cache);
+
+/*
+ * svnfs_store_rename
+ *
+ * Gives an entry recorded by svnfs_store_keep its permanent name, and drops
+ * the reference held meanwhile; does nothing unless the entry is renaming.
+ * Must be called without svnfs_cache_lock held, by a thread which holds a
+ * reference to the entry or which saw it marked as renaming.
+ *
+ * cache: the entry
+ */
+void svnfs_store_rename(svnfs_cache_t *cache);
+
+/*
+ * svnfs_store_forget
+ *
+ * Removes an entry's record from the index, if it has one.  Must be called
+ * with svnfs_cache_lock held.
+ *
+ * cache: the entry
+ */
+void svnfs_store_forget(svnfs_cache_t *cache);
+
+/*
+ * svnfs_store_unpin
+ *
+ * Clears the pin flag of every file in the index if no cache rule pins
+ * anything any more.  Must be called with svnfs_cache_lock held, or before
+ * there are other threads.
+ */
+void svnfs_store_unpin(void);
+
+/*
+ * svnfs_store_evict
+ *
+ * Evicts one file kept by an earlier mount which this mount has not opened;
+ * these are colder than anything on the LRU list.  Files which were pinned
+ * when admitted only go once no other such file is left.  Must be called
+ * with svnfs_cache_lock held.
+ *
+ * return: nonzero if a file was evicted, zero if there are none left
+ */
+int svnfs_store_evict(void);
+
+#ifdef SVNFS_HAVE_IO_URING
+/*
+ * svnfs_uring_stream
+ *
+ * Makes a stream which writes into a file from offset 0 through the
+ * calling thread's io_uring, keeping several writes in flight.  When closed
+ * it waits for them.  Only the calling thread may use the stream, and only
+ * until it makes another.  If io_uring cannot be set up, an ordinary stream
+ * on the file is returned instead.
+ *
+ * file:   the file, which should be empty
+ * pool:   pool to allocate the stream from
+ * return: the stream
+ */
+svn_stream_t *svnfs_uring_stream(apr_file_t *file, apr_pool_t *pool);
+
+/*
+ * svnfs_uring_drain
+ *
+ * Waits for any writes still in flight from a stream of the calling thread
+ * which failed before it was closed.
+ */
+void svnfs_uring_drain(void);
+
+/*
+ * svnfs_uring_checksum
+ *
+ * Reads a file through as svnfs_store_checksum does, keeping several reads
+ * in flight.
+ *
+ * fd:       descriptor of the file
+ * checksum: pointer to receive the checksum
+ * size:     pointer to receive the size
+ * return:   0 on success, -ENOSYS if io_uring is unavailable, or -errno on
+ *           another error
+ */
+int svnfs_uring_checksum(int fd, apr_uint64_t *checksum, apr_off_t *size);
+#endif
+
+/*
+ * svnfs_rule_parse
+ *
+ * Parses content cache rules, one per line:
+ *
+ *   pin /REVS/PREFIX
+ *   quota /REVS/PREFIX SIZE
+ *
+ * where REVS is a revision N, a range N-M or N-, or *, and SIZE is a number
+ * of bytes, optionally followed by K, M or G.  Blank lines and lines starting
+ * with # are ignored.
+ *
+ * text:   the rules
+ * rules:  pointer to receive an array of svnfs_rule_t *
+ * pool:   pool from which to allocate the rules
+ * return: 0 on success, or -EINVAL if a line could not be parsed
+ */
+int svnfs_rule_parse(const char *text, apr_array_header_t **rules,
+                     apr_pool_t *pool);
 
 /*
- * SVNFS_LOCK_READ
+ * svnfs_rule_match
  *
- * Convenience macro for apr_thread_rwlock_rdlock.
+ * Finds the rule governing a file.  Must be called with svnfs_cache_lock
+ * held.
+ *
+ * rev:        revision of the file
+ * repos_path: session-relative path of the file
+ * return:     the first matching rule, or NULL if none matches
+ */
+svnfs_rule_t *svnfs_rule_match(svn_revnum_t rev, const char *repos_path);
+
+/*
+ * svnfs_rules_set
+ *
+ * Replaces the content cache rules, reassigns every entry to its new rule,
+ * and evicts whatever no longer fits.
+ *
+ * text:   the new rules, as for svnfs_rule_parse
+ * return: 0 on success, or -EINVAL if the rules could not be parsed, in which
+ *         case the old rules stay in force
+ */
+int svnfs_rules_set(const char *text);
+
+/*
+ * svnfs_rules_render
+ *
+ * Writes out the content cache rules in the form svnfs_rule_parse reads,
+ * with the usage of each as a comment.
+ *
+ * pool:   pool from which to allocate the text
+ * return: the text
+ */
+char *svnfs_rules_render(apr_pool_t *pool);
+
+/*
+ * svnfs_ctl_path
+ *
+ * Determines whether a path names a control file.
+ *
+ * path:   path within the filesystem
+ * return: nonzero if path is SVNFS_CTL_RULES, SVNFS_CTL_QUERY or
+ *         SVNFS_CTL_STATS, zero otherwise
+ */
+int svnfs_ctl_path(const char *path);
+
+/*
+ * svnfs_ctl_open
+ *
+ * Opens a control file.  A reader of the rules sees the current rules; a
+ * writer starts from nothing, and what it writes replaces the rules when it
+ * closes the file.  A query starts out empty.  The stats may only be read.
+ *
+ * path:   path of the control file
+ * fi:     information about the file
+ * return: 0 on success, -errno on failure
+ */
+int svnfs_ctl_open(const char *path, struct fuse_file_info *fi);
+
+/*
+ * svnfs_ctl_read
+ *
+ * Reads from an open control file.  The first read of a query after it was
+ * written answers it: one line for each line written, in the same order,
+ * holding the path as written and then, separated by tabs, either "file" or
+ * "dir", the size, the inode number and the link count, or "error" and what
+ * went wrong.  The answer starts at the offset of that read, so a writer may
+ * read on from the end of its question or seek back to 0 first; reading
+ * from before that offset later starts the answer over.
+ *
+ * buf:    buffer to fill
+ * len:    size of buf
+ * offset: offset within the file to start reading from
+ * fi:     information about the file
+ * return: number of bytes read
+ */
+int svnfs_ctl_read(char *buf, size_t len, off_t offset,
+                   struct fuse_file_info *fi);
+
+/*
+ * svnfs_ctl_write
+ *
+ * Writes to an open control file.
+ *
+ * buf:    data to write
+ * len:    length of data
+ * offset: offset within the file to start writing at
+ * fi:     information about the file
+ * return: number of bytes written on success, -errno on failure
+ */
+int svnfs_ctl_write(const char *buf, size_t len, off_t offset,
+                    struct fuse_file_info *fi);
+
+/*
+ * svnfs_ctl_flush
+ *
+ * Applies what has been written to an open control file.
+ *
+ * fi:     information about the file
+ * return: 0 on success, -errno on failure
+ */
+int svnfs_ctl_flush(struct fuse_file_info *fi);
+
+/*
+ * svnfs_ctl_release
+ *
+ * Frees an open control file.
+ *
+ * fi: information about the file
+ */
+void svnfs_ctl_release(struct fuse_file_info *fi);
+
+/*
+ * svnfs_ino
+ *
+ * Derives an inode number from the identity of a node: its path relative to
+ * the repository root and the revision in which it was last changed.  The
+ * same node therefore has the same inode number in every revision it appears
+ * in, and across remounts.
+ *
+ * repos_path:  session-relative path of the node
+ * created_rev: revision in which the node was last changed
+ * return:      an inode number other than 0 or 1 (1 is the mount root)
+ */
+ino_t svnfs_ino(const char *repos_path, svn_revnum_t created_rev);
+
+/*
+ * svnfs_reject_add
+ *
+ * Adds patterns to the set of rejected names.  Patterns without wildcards are
+ * kept in a hash, so that only true globs cost an fnmatch per lookup.
+ *
+ * patterns: colon-separated list of glob patterns
+ */
+void svnfs_reject_add(const char *patterns);
+
+/*
+ * svnfs_reject_match
+ *
+ * Determines whether the last component of a path is a rejected name.  This
+ * takes no locks and does not allocate.
+ *
+ * path:   the path to be tested
+ * return: nonzero if the name matches a rejected pattern, zero otherwise
  */
-#define SVNFS_LOCK_READ do { \
-	if(apr_thread_rwlock_rdlock(svnfs_ra_session_lock) != APR_SUCCESS) \
-		return -EBUSY; \
-} while(0)
+int svnfs_reject_match(const char *path);
 
 /*
- * SVNFS_LOCK_WRITE
+ * svnfs_reject_listed
  *
- * Convenience macro for apr_thread_rwlock_wrlock.
+ * Determines whether a cached listing of a path's parent shows that the path
+ * exists, in which case a rejected name must be looked up after all.
+ *
+ * path:   the path to be tested
+ * return: nonzero if the path is known to exist, zero otherwise
+ */
+int svnfs_reject_listed(const char *path);
+
+/*
+ * svnfs_path_is_head
+ *
+ * Determines whether a path lies within the /HEAD directory, whose revision
+ * follows the youngest revision in the repository.
+ *
+ * path:   the path to be tested
+ * return: nonzero if path is /HEAD or below it, zero otherwise
  */
-#define SVNFS_LOCK_WRITE do { \
-	if(apr_thread_rwlock_wrlock(svnfs_ra_session_lock) != APR_SUCCESS) \
-		return -EBUSY; \
-} while(0)
+int svnfs_path_is_head(const char *path);
 
 /*
- * SVNFS_UNLOCK
+ * svnfs_head_keep_cache
  *
- * Convenience macro for apr_thread_rwlock_unlock.
+ * Decides whether the kernel may keep its cached pages for a file being
+ * opened through /HEAD, and records that the file has now been opened at rev.
+ * The pages are only still good if no commit has touched the file or any of
+ * its parent directories since the previous open.
+ *
+ * repos_path: repository path of the file being opened
+ * rev:        the revision /HEAD resolved to for this open
+ * return:     nonzero if the cached pages may be kept, zero otherwise
  */
-#define SVNFS_UNLOCK do { \
-	if(apr_thread_rwlock_unlock(svnfs_ra_session_lock) != APR_SUCCESS) \
-		return -EBUSY; \
-} while(0)
+int svnfs_head_keep_cache(const char *repos_path, svn_revnum_t rev);
 
 /* }}}1 END HELPER OPERATIONS */
 
+/* LIBRARY OPERATIONS {{{1 */
+
+/*
+ * svnfs_lib_open
+ *
+ * Finds the content cache entry for a file, filling it from the repository
+ * on a miss, and takes a reference to it.
+ *
+ * path:       path of the file, as it appears under the mount
+ * priority:   class of the request, should the repository be needed
+ * cache:      set to the cache entry
+ * keep_cache: if not NULL, set to whether what was read from the path before
+ *             may still be used
+ * return:     0 on success, or -errno on error
+ */
+int svnfs_lib_open(const char *path, svnfs_ra_class_t priority,
+                   svnfs_cache_t **cache, int *keep_cache);
+
+/*
+ * svnfs_lib_read
+ *
+ * Reads from a content cache entry taken by svnfs_lib_open, noting whether
+ * the file is being read in order, and waiting for contents which are still
+ * on their way.
+ *
+ * cache:  the cache entry
+ * buf:    buffer to read into
+ * len:    number of bytes to read
+ * offset: offset in the file at which to start
+ * return: the number of bytes read, or -errno on error
+ */
+int svnfs_lib_read(svnfs_cache_t *cache, char *buf, size_t len, off_t offset);
+
+/*
+ * svnfs_lib_close
+ *
+ * Drops the reference to a content cache entry taken by svnfs_lib_open, and
+ * settles whether an entry on probation stays in the cache.
+ *
+ * cache:  the cache entry
+ */
+void svnfs_lib_close(svnfs_cache_t *cache);
+
+/*
+ * svnfs_local_init
+ *
+ * A hook for tests and benchmarks, which is why it is declared here rather
+ * than in libsvnfs.h.  Sets up the caches from the same arguments as
+ * svnfs_lib_init, but never contacts the repository or starts a thread.
+ * Only what the caller puts in the caches by hand can be answered, which is
+ * what the in-process benchmarks want.
+ *
+ * argc:   number of arguments
+ * argv:   the arguments, starting with a program name
+ * return: 0 on success, or -1 on error
+ */
+int svnfs_local_init(int argc, char **argv);
+
+/* END LIBRARY OPERATIONS }}}1 */
+
 /* FUSE OPERATIONS {{{1 */
 
 /*
@@ -137,6 +1808,80 @@ int svnfs_fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
  */
 int svnfs_fuse_open(const char *path, struct fuse_file_info *fi);
 
+/*
+ * svnfs_fuse_write
+ *
+ * Writes to a control file.  Everything else is read-only.
+ *
+ * path:   path to file to write
+ * buf:    data to write
+ * len:    length of data
+ * offset: offset within file to start writing at
+ * fi:     information about the file
+ * return: number of bytes written on success, -errno on failure
+ */
+int svnfs_fuse_write(const char *path, const char *buf, size_t len,
+                     off_t offset, struct fuse_file_info *fi);
+
+/*
+ * svnfs_fuse_truncate
+ *
+ * Implements truncate(2), which only control files allow.  Since writing a
+ * control file replaces it whole, there is nothing to do.
+ *
+ * path:   path to file to truncate
+ * size:   new size
+ * return: 0 on success, -errno on failure
+ */
+int svnfs_fuse_truncate(const char *path, off_t size);
+
+/*
+ * svnfs_fuse_flush
+ *
+ * Applies what has been written to a control file, so that close(2) reports
+ * whether it was accepted.
+ *
+ * path:   path of the file being closed
+ * fi:     information about the file
+ * return: 0 on success, -errno on failure
+ */
+int svnfs_fuse_flush(const char *path, struct fuse_file_info *fi);
+
+/*
+ * svnfs_fuse_release
+ *
+ * Drops the reference to the content cache entry taken by svnfs_fuse_open,
+ * or frees a control file's contents.
+ *
+ * path:   path of the file being closed
+ * fi:     information about the file
+ * return: 0
+ */
+int svnfs_fuse_release(const char *path, struct fuse_file_info *fi);
+
+/*
+ * svnfs_fuse_statfs
+ *
+ * Implements statfs(2), reporting the capacity and usage of the content cache
+ * as the size of the filesystem.
+ *
+ * path:   path within the filesystem
+ * stbuf:  statvfs struct to fill
+ * return: 0
+ */
+int svnfs_fuse_statfs(const char *path, struct statvfs *stbuf);
+
+/*
+ * svnfs_fuse_init
+ *
+ * Starts the /HEAD tracking and hedging threads.  This cannot happen in
+ * main(), because fuse_main() forks into the background and threads do not
+ * survive a fork.
+ *
+ * return: private data for the filesystem (always NULL)
+ */
+void *svnfs_fuse_init(void);
+
 /* END FUSE OPERATIONS }}}1 */
 
 #endif /* _SVNFS_H_ */